@@ -6,13 +6,19 @@
 #define KTH_DATABASE_DATA_BASE_HPP
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <kth/domain.hpp>
 #include <kth/database/define.hpp>
 #include <kth/database/databases/internal_database.hpp>
+#include <kth/database/databases/worker_pool.hpp>
 #include <kth/database/define.hpp>
 #include <kth/database/settings.hpp>
 #include <kth/database/store.hpp>
@@ -30,6 +36,14 @@ public:
     using result_handler = handle0;
     using path = kth::path;
 
+    /// Accumulated timings of the push_all stages.
+    struct push_statistics {
+        size_t blocks;
+        std::chrono::nanoseconds prepare;   // Summed over the worker threads.
+        std::chrono::nanoseconds wait;      // Writer waiting for a prepared block.
+        std::chrono::nanoseconds write;     // Writer applying prepared blocks.
+    };
+
     // Construct.
     // ----------------------------------------------------------------------------
 
@@ -57,6 +71,8 @@ public:
 
     internal_database const& internal_db() const;
 
+    push_statistics push_stats() const;
+
     // Synchronous writers.
     // ------------------------------------------------------------------------
 
@@ -88,6 +104,7 @@ public:
 
 protected:
     void start();
+    uint32_t get_worker_threads() const;
 
 #if ! defined(KTH_DB_READONLY)
 
@@ -110,6 +127,11 @@ private:
 #if ! defined(KTH_DB_READONLY)
     code push_genesis(domain::chain::block const& block);
 
+    // Background indexer of the history and spend rows (full mode).
+    void start_indexer();
+    void stop_indexer();
+    void run_indexer();
+
     // Synchronous writers.
     // ------------------------------------------------------------------------
     bool pop(domain::chain::block& out_block);
@@ -126,6 +148,7 @@ private:
 #if ! defined(KTH_DB_READONLY)
     void push_next(code const& ec, block_const_ptr_list_const_ptr blocks, size_t index, size_t height, dispatcher& dispatch, result_handler handler);
     void do_push(block_const_ptr block, size_t height, uint32_t median_time_past, dispatcher& dispatch, result_handler handler);
+    void do_push_all(block_const_ptr_list_const_ptr blocks, size_t first_height, result_handler handler);
 
 
     void handle_pop(code const& ec, block_const_ptr_list_const_ptr incoming_blocks, size_t first_height, dispatcher& dispatch, result_handler handler);
@@ -134,6 +157,22 @@ private:
 
     std::atomic<bool> closed_;
     settings const& settings_;
+
+    // pipeline_depth threads preparing the blocks of push_all, apart from the
+    // internal database workers so the lookups do not queue behind them.
+    worker_pool pipeline_workers_;
+
+    std::atomic<uint64_t> pushed_blocks_{0};
+    std::atomic<uint64_t> prepare_ns_{0};
+    std::atomic<uint64_t> wait_ns_{0};
+    std::atomic<uint64_t> write_ns_{0};
+
+#if ! defined(KTH_DB_READONLY)
+    std::thread indexer_;
+    std::mutex indexer_mutex_;
+    std::condition_variable indexer_condition_;
+    bool indexer_stopped_ = false;
+#endif // ! defined(KTH_DB_READONLY)
 };
 
 } // namespace kth::database
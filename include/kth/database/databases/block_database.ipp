@@ -12,18 +12,24 @@ namespace kth::database {
 //public
 template <typename Clock>
 std::pair<domain::chain::block, uint32_t> internal_database_basis<Clock>::get_block(hash_digest const& hash) const {
-    auto key = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
-
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
+    auto ret = get_block(hash, db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+std::pair<domain::chain::block, uint32_t> internal_database_basis<Clock>::get_block(hash_digest const& hash, KTH_DB_txn* db_txn) const {
+    auto key = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
+
     KTH_DB_val value;
     if (kth_db_get(db_txn, dbi_block_header_by_hash_, &key, &value) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
-        // kth_db_txn_abort(db_txn);
         return {};
     }
 
@@ -31,28 +37,20 @@ std::pair<domain::chain::block, uint32_t> internal_database_basis<Clock>::get_bl
     auto height = *static_cast<uint32_t*>(kth_db_get_data(value));
 
     auto block = get_block(height, db_txn);
-
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
-
     return {block, height};
 }
 
 //public
 template <typename Clock>
 domain::chain::block internal_database_basis<Clock>::get_block(uint32_t height) const {
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return domain::chain::block{};
     }
 
     auto block = get_block(height, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return domain::chain::block{};
-    }
+    read_txns_.release(db_txn);
 
     return block;
 }
@@ -68,30 +66,42 @@ domain::chain::block internal_database_basis<Clock>::get_block(uint32_t height,
             return {};
         }
 
-        domain::chain::transaction::list tx_list;
+        KTH_DB_val value;
+        if (kth_db_get(db_txn, dbi_block_db_, &key, &value) != KTH_DB_SUCCESS) {
+            return {};
+        }
+        auto const range = block_tx_range::from_value(value);
 
+        // The ids of the block transactions are contiguous, a single range scan.
         KTH_DB_cursor* cursor;
-        if (kth_db_cursor_open(db_txn, dbi_block_db_, &cursor) != KTH_DB_SUCCESS) {
+        if (kth_db_cursor_open(db_txn, dbi_transaction_db_, &cursor) != KTH_DB_SUCCESS) {
             return {};
         }
 
-        KTH_DB_val value;
-        int rc;
-        if ((rc = kth_db_cursor_get(cursor, &key, &value, MDB_SET)) == 0) {
+        domain::chain::transaction::list tx_list;
+        tx_list.reserve(range.count);
 
-            auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));;
-            auto const entry = get_transaction(tx_id, db_txn);
+        auto tx_id = range.first;
+        auto tx_key = kth_db_make_value(sizeof(tx_id), &tx_id);
+        KTH_DB_val tx_value;
 
-            if ( ! entry.is_valid()) {
+        auto rc = kth_db_cursor_get(cursor, &tx_key, &tx_value, KTH_DB_SET);
+        for (uint32_t i = 0; i < range.count; ++i) {
+            if (rc != KTH_DB_SUCCESS) {
+                kth_db_cursor_close(cursor);
                 return {};
             }
 
+            auto data = db_value_to_data_chunk(tx_value);
+            auto const entry = domain::create_old<transaction_entry>(data);
+            if ( ! entry.is_valid()) {
+                kth_db_cursor_close(cursor);
+                return {};
+            }
             tx_list.push_back(std::move(entry.transaction()));
 
-            while ((rc = kth_db_cursor_get(cursor, &key, &value, MDB_NEXT_DUP)) == 0) {
-                auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));;
-                auto const entry = get_transaction(tx_id, db_txn);
-                tx_list.push_back(std::move(entry.transaction()));
+            if (i + 1 < range.count) {
+                rc = kth_db_cursor_get(cursor, &tx_key, &tx_value, KTH_DB_NEXT);
             }
         }
 
@@ -115,36 +125,66 @@ domain::chain::block internal_database_basis<Clock>::get_block(uint32_t height,
     return block;
 }
 
+template <typename Clock>
+uint32_t internal_database_basis<Clock>::get_median_time_past(uint32_t height, KTH_DB_txn* db_txn) const {
+    constexpr uint32_t median_time_past_interval = 11;
+
+    std::vector<uint32_t> timestamps;
+    timestamps.reserve(median_time_past_interval);
+    for (auto h = height > median_time_past_interval ? height - median_time_past_interval : 0; h < height; ++h) {
+        auto const header = get_header(h, db_txn);
+        if (header.is_valid()) {
+            timestamps.push_back(header.timestamp());
+        }
+    }
+
+    if (timestamps.empty()) {
+        return 0;
+    }
+
+    std::sort(timestamps.begin(), timestamps.end());
+    return timestamps[timestamps.size() / 2];
+}
+
 
 #if ! defined(KTH_DB_READONLY)
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::insert_block(domain::chain::block const& block, uint32_t height, uint64_t tx_count, KTH_DB_txn* db_txn) {
+    if (db_mode_ == db_mode_type::full) {
+        return insert_block(height, tx_count, block.transactions().size(), {}, db_txn);
+    }
+    //TODO: store tx hash
+    return insert_block(height, tx_count, 0, block.to_data(false), db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_block(prepared_block const& block, uint64_t tx_count, KTH_DB_txn* db_txn) {
+    return insert_block(block.height, tx_count, block.transactions.size(), block.block, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_block(uint32_t height, uint64_t tx_count, size_t txs, data_chunk const& data, KTH_DB_txn* db_txn) {
 
     auto key = kth_db_make_value(sizeof(height), &height);
 
     if (db_mode_ == db_mode_type::full) {
 
-        auto const& txs = block.transactions();
-
-        for (uint64_t i = tx_count; i < tx_count + txs.size(); ++i) {
-            auto value = kth_db_make_value(sizeof(i), &i);
+        auto const range = block_tx_range::to_value(tx_count, uint32_t(txs));
+        auto value = kth_db_make_value(range.size(), const_cast<uint8_t*>(range.data()));
 
-            auto res = kth_db_put(db_txn, dbi_block_db_, &key, &value, MDB_APPENDDUP);
-            if (res == KTH_DB_KEYEXIST) {
-                LOG_INFO(LOG_DATABASE, "Duplicate key in Block DB [insert_block] ", res);
-                return result_code::duplicated_key;
-            }
+        auto res = kth_db_put(db_txn, dbi_block_db_, &key, &value, KTH_DB_APPEND);
+        if (res == KTH_DB_KEYEXIST) {
+            LOG_INFO(LOG_DATABASE, "Duplicate key in Block DB [insert_block] ", res);
+            return result_code::duplicated_key;
+        }
 
-            if (res != KTH_DB_SUCCESS) {
-                LOG_INFO(LOG_DATABASE, "Error saving in Block DB [insert_block] ", res);
-                return result_code::other;
-            }
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error saving in Block DB [insert_block] ", res);
+            return result_code::other;
         }
     } else if (db_mode_ == db_mode_type::blocks) {
-        //TODO: store tx hash
-        auto data = block.to_data(false);
-        auto value = kth_db_make_value(data.size(), data.data());
+        auto value = kth_db_make_value(data.size(), const_cast<uint8_t*>(data.data()));
 
         auto res = kth_db_put(db_txn, dbi_block_db_, &key, &value, KTH_DB_APPEND);
         if (res == KTH_DB_KEYEXIST) {
@@ -165,31 +205,7 @@ template <typename Clock>
 result_code internal_database_basis<Clock>::remove_blocks_db(uint32_t height, KTH_DB_txn* db_txn) {
     auto key = kth_db_make_value(sizeof(height), &height);
 
-    if (db_mode_ == db_mode_type::full) {
-        KTH_DB_cursor* cursor;
-        if (kth_db_cursor_open(db_txn, dbi_block_db_, &cursor) != KTH_DB_SUCCESS) {
-            return {};
-        }
-
-        KTH_DB_val value;
-        int rc;
-        if ((rc = kth_db_cursor_get(cursor, &key, &value, MDB_SET)) == 0) {
-
-            if (kth_db_cursor_del(cursor, 0) != KTH_DB_SUCCESS) {
-                kth_db_cursor_close(cursor);
-                return result_code::other;
-            }
-
-            while ((rc = kth_db_cursor_get(cursor, &key, &value, MDB_NEXT_DUP)) == 0) {
-                if (kth_db_cursor_del(cursor, 0) != KTH_DB_SUCCESS) {
-                    kth_db_cursor_close(cursor);
-                    return result_code::other;
-                }
-            }
-        }
-
-        kth_db_cursor_close(cursor);
-    } else if (db_mode_ == db_mode_type::blocks) {
+    if (db_mode_ == db_mode_type::full || db_mode_ == db_mode_type::blocks) {
         auto res = kth_db_del(db_txn, dbi_block_db_, &key, NULL);
         if (res == KTH_DB_NOTFOUND) {
             LOG_INFO(LOG_DATABASE, "Key not found deleting blocks DB in LMDB [remove_blocks_db] - kth_db_del: ", res);
@@ -204,6 +220,37 @@ result_code internal_database_basis<Clock>::remove_blocks_db(uint32_t height, KT
     return result_code::success;
 }
 
+// Upgrade writer, tx ids are assigned in chain order: the range of the block
+// is extended or a new one is appended.
+template <typename Clock>
+result_code internal_database_basis<Clock>::index_block_tx_range(tx_id_t id, transaction_entry const& entry, KTH_DB_txn* db_txn) {
+    auto height = entry.height();
+    auto key = kth_db_make_value(sizeof(height), &height);
+    KTH_DB_val value;
+
+    block_tx_range range {id, 1};
+    unsigned int flags = KTH_DB_APPEND;
+
+    auto res = kth_db_get(db_txn, dbi_block_db_, &key, &value);
+    if (res == KTH_DB_SUCCESS) {
+        range = block_tx_range::from_value(value);
+        ++range.count;
+        flags = 0;
+    } else if (res != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Error getting from Block DB [index_block_tx_range] ", res);
+        return result_code::other;
+    }
+
+    auto const data = block_tx_range::to_value(range.first, range.count);
+    value = kth_db_make_value(data.size(), const_cast<uint8_t*>(data.data()));
+    res = kth_db_put(db_txn, dbi_block_db_, &key, &value, flags);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error saving in Block DB [index_block_tx_range] ", res);
+        return result_code::other;
+    }
+    return result_code::success;
+}
+
 #endif // ! defined(KTH_DB_READONLY)
 
 } // namespace kth::database
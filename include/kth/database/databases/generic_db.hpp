@@ -5,6 +5,8 @@
 #ifndef KTH_DATABASE_GENERIC_DB_HPP_
 #define KTH_DATABASE_GENERIC_DB_HPP_
 
+#include <cstdint>
+
 #if defined(KTH_USE_LIBMDBX)
 #include <mdbx.h>
 #define KTH_DB_txn MDBX_txn
@@ -15,6 +17,8 @@
 
 #define KTH_DB_SUCCESS MDBX_SUCCESS
 #define KTH_DB_KEYEXIST MDBX_KEYEXIST
+#define KTH_DB_READERS_FULL MDBX_READERS_FULL
+#define KTH_DB_MAP_FULL MDBX_MAP_FULL
 #define KTH_DB_RDONLY MDBX_RDONLY
 #define KTH_DB_NOTFOUND MDBX_NOTFOUND
 #define KTH_DB_SET MDBX_SET
@@ -32,19 +36,34 @@
 #define KTH_DB_APPEND MDBX_APPEND
 #define KTH_DB_LAST MDBX_LAST
 #define KTH_DB_FIRST MDBX_FIRST
+#define KTH_DB_CURRENT MDBX_CURRENT
 #define KTH_DB_DUPFIXED MDBX_DUPFIXED
+#define KTH_DB_INTEGERDUP MDBX_INTEGERDUP
+#define KTH_DB_APPENDDUP MDBX_APPENDDUP
+#define KTH_DB_NEXT_DUP MDBX_NEXT_DUP
+#define KTH_DB_NEXT_NODUP MDBX_NEXT_NODUP
+#define KTH_DB_GET_MULTIPLE MDBX_GET_MULTIPLE
+#define KTH_DB_NEXT_MULTIPLE MDBX_NEXT_MULTIPLE
+#define KTH_DB_PREV_MULTIPLE MDBX_PREV_MULTIPLE
+#define KTH_DB_GET_BOTH_RANGE MDBX_GET_BOTH_RANGE
+#define KTH_DB_LAST_DUP MDBX_LAST_DUP
 
 #define kth_db_txn_commit mdbx_txn_commit
 #define kth_db_cursor_close mdbx_cursor_close
 #define kth_db_cursor_get mdbx_cursor_get
 #define kth_db_cursor_del mdbx_cursor_del
+#define kth_db_cursor_put mdbx_cursor_put
 #define kth_db_txn_abort mdbx_txn_abort
+#define kth_db_txn_reset mdbx_txn_reset
+#define kth_db_txn_renew mdbx_txn_renew
 #define kth_db_dbi_close mdbx_dbi_close
 #define kth_db_env_sync mdbx_env_sync
 #define kth_db_txn_begin mdbx_txn_begin
 #define kth_db_env_set_mapsize mdbx_env_set_mapsize
 #define kth_db_env_create mdbx_env_create
 #define kth_db_env_set_maxdbs mdbx_env_set_maxdbs
+#define kth_db_env_get_maxreaders mdbx_env_get_maxreaders
+#define kth_db_env_set_maxreaders mdbx_env_set_maxreaders
 #define kth_db_env_open mdbx_env_open
 #define kth_db_dbi_open mdbx_dbi_open
 #define kth_db_put mdbx_put
@@ -52,6 +71,7 @@
 #define kth_db_cursor_open mdbx_cursor_open
 #define kth_db_env_close mdbx_env_close
 #define kth_db_del mdbx_del
+#define kth_db_drop mdbx_drop
 
 
 
@@ -77,6 +97,30 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
     return KTH_DB_val{data, size};
 }
 
+// Current map size and bytes used by the data file.
+inline
+int kth_db_env_map_usage(KTH_DB_env* env, uint64_t& map_size, uint64_t& used) {
+    MDBX_envinfo info;
+    auto res = mdbx_env_info_ex(env, nullptr, &info, sizeof(info));
+    if (res != MDBX_SUCCESS) {
+        return res;
+    }
+    map_size = info.mi_geo.current;
+    used = (info.mi_last_pgno + 1) * uint64_t(info.mi_dxb_pagesize);
+    return res;
+}
+
+// Number of entries of a table, duplicates included.
+inline
+int kth_db_entries(KTH_DB_txn* txn, KTH_DB_dbi dbi, uint64_t& entries) {
+    MDBX_stat stat;
+    auto res = mdbx_dbi_stat(txn, dbi, &stat, sizeof(stat));
+    if (res == MDBX_SUCCESS) {
+        entries = stat.ms_entries;
+    }
+    return res;
+}
+
 
 
 #else
@@ -89,6 +133,9 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
 
 #define KTH_DB_SUCCESS MDB_SUCCESS
 #define KTH_DB_KEYEXIST MDB_KEYEXIST
+#define KTH_DB_READERS_FULL MDB_READERS_FULL
+#define KTH_DB_MAP_FULL MDB_MAP_FULL
+#define KTH_DB_MAP_RESIZED MDB_MAP_RESIZED
 #define KTH_DB_RDONLY MDB_RDONLY
 #define KTH_DB_NOTFOUND MDB_NOTFOUND
 #define KTH_DB_SET MDB_SET
@@ -106,7 +153,17 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
 #define KTH_DB_APPEND MDB_APPEND
 #define KTH_DB_LAST MDB_LAST
 #define KTH_DB_FIRST MDB_FIRST
+#define KTH_DB_CURRENT MDB_CURRENT
 #define KTH_DB_DUPFIXED MDB_DUPFIXED
+#define KTH_DB_INTEGERDUP MDB_INTEGERDUP
+#define KTH_DB_APPENDDUP MDB_APPENDDUP
+#define KTH_DB_NEXT_DUP MDB_NEXT_DUP
+#define KTH_DB_NEXT_NODUP MDB_NEXT_NODUP
+#define KTH_DB_GET_MULTIPLE MDB_GET_MULTIPLE
+#define KTH_DB_NEXT_MULTIPLE MDB_NEXT_MULTIPLE
+#define KTH_DB_PREV_MULTIPLE MDB_PREV_MULTIPLE
+#define KTH_DB_GET_BOTH_RANGE MDB_GET_BOTH_RANGE
+#define KTH_DB_LAST_DUP MDB_LAST_DUP
 
 
 
@@ -114,13 +171,18 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
 #define kth_db_cursor_close mdb_cursor_close
 #define kth_db_cursor_get mdb_cursor_get
 #define kth_db_cursor_del mdb_cursor_del
+#define kth_db_cursor_put mdb_cursor_put
 #define kth_db_txn_abort mdb_txn_abort
+#define kth_db_txn_reset mdb_txn_reset
+#define kth_db_txn_renew mdb_txn_renew
 #define kth_db_dbi_close mdb_dbi_close
 #define kth_db_env_sync mdb_env_sync
 #define kth_db_txn_begin mdb_txn_begin
 #define kth_db_env_set_mapsize mdb_env_set_mapsize
 #define kth_db_env_create mdb_env_create
 #define kth_db_env_set_maxdbs mdb_env_set_maxdbs
+#define kth_db_env_get_maxreaders mdb_env_get_maxreaders
+#define kth_db_env_set_maxreaders mdb_env_set_maxreaders
 #define kth_db_env_open mdb_env_open
 #define kth_db_dbi_open mdb_dbi_open
 #define kth_db_put mdb_put
@@ -128,6 +190,7 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
 #define kth_db_cursor_open mdb_cursor_open
 #define kth_db_env_close mdb_env_close
 #define kth_db_del mdb_del
+#define kth_db_drop mdb_drop
 
 inline
 auto const& kth_db_get_data(KTH_DB_val const& x) {
@@ -144,5 +207,34 @@ KTH_DB_val kth_db_make_value(size_t size, void* data) {
     return KTH_DB_val{size, data};
 }
 
+// Current map size and bytes used by the data file.
+inline
+int kth_db_env_map_usage(KTH_DB_env* env, uint64_t& map_size, uint64_t& used) {
+    MDB_envinfo info;
+    auto res = mdb_env_info(env, &info);
+    if (res != MDB_SUCCESS) {
+        return res;
+    }
+    MDB_stat stat;
+    res = mdb_env_stat(env, &stat);
+    if (res != MDB_SUCCESS) {
+        return res;
+    }
+    map_size = info.me_mapsize;
+    used = (info.me_last_pgno + 1) * uint64_t(stat.ms_psize);
+    return res;
+}
+
+// Number of entries of a table, duplicates included.
+inline
+int kth_db_entries(KTH_DB_txn* txn, KTH_DB_dbi dbi, uint64_t& entries) {
+    MDB_stat stat;
+    auto res = mdb_stat(txn, dbi, &stat);
+    if (res == MDB_SUCCESS) {
+        entries = stat.ms_entries;
+    }
+    return res;
+}
+
 #endif
 #endif // KTH_DATABASE_GENERIC_DB_HPP_
@@ -14,10 +14,20 @@ namespace kth::database {
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::push_block_header(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn) {
+    auto valuearr = to_data_with_abla_state(block);
+    return push_block_header(valuearr, block.hash(), height, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::push_block_header(prepared_block const& block, KTH_DB_txn* db_txn) {
+    return push_block_header(block.header, block.hash, block.height, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::push_block_header(data_chunk const& header, hash_digest const& hash, uint32_t height, KTH_DB_txn* db_txn) {
 
-    auto valuearr = to_data_with_abla_state(block);             //TODO(fernando): podría estar afuera de la DBTx
     auto key = kth_db_make_value(sizeof(height), &height);
-    auto value = kth_db_make_value(valuearr.size(), valuearr.data());
+    auto value = kth_db_make_value(header.size(), const_cast<uint8_t*>(header.data()));
 
     auto res = kth_db_put(db_txn, dbi_block_header_, &key, &value, KTH_DB_APPEND);
     if (res == KTH_DB_KEYEXIST) {
@@ -30,8 +40,7 @@ result_code internal_database_basis<Clock>::push_block_header(domain::chain::blo
         return result_code::other;
     }
 
-    auto key_by_hash_arr = block.hash();                                    //TODO(fernando): podría estar afuera de la DBTx
-    auto key_by_hash = kth_db_make_value(key_by_hash_arr.size(), key_by_hash_arr.data());
+    auto key_by_hash = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
 
     res = kth_db_put(db_txn, dbi_block_header_by_hash_, &key_by_hash, &key, KTH_DB_NOOVERWRITE);
     if (res == KTH_DB_KEYEXIST) {
@@ -10,10 +10,9 @@
 namespace kth::database {
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_history_db(domain::wallet::payment_address const& address, data_chunk const& entry, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::insert_history_db(short_hash const& key_arr, data_chunk const& entry, KTH_DB_txn* db_txn) {
 
-    auto key_arr = address.hash20();     //TODO(fernando): should I take a reference?
-    auto key = kth_db_make_value(key_arr.size(), key_arr.data());
+    auto key = kth_db_make_value(key_arr.size(), const_cast<short_hash&>(key_arr).data());
     auto value = kth_db_make_value(entry.size(), const_cast<data_chunk&>(entry).data());
 
     auto res = kth_db_put(db_txn, dbi_history_db_, &key, &value, MDB_APPENDDUP);
@@ -25,97 +24,130 @@ result_code internal_database_basis<Clock>::insert_history_db(domain::wallet::pa
         LOG_INFO(LOG_DATABASE, "Error inserting history [insert_history_db] ", res);
         return result_code::other;
     }
+    ++counters_.history;
 
     return result_code::success;
 }
 
+// The rows of a block are sorted by address and written through a single
+// cursor, consecutive rows of an address are appended to the same leaf page.
+// The ids are the block relative ids plus history_base (see assign_history_ids()),
+// the rows of the unresolved inputs follow the prepared ones.
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_input_history(domain::chain::input_point const& inpoint, uint32_t height, domain::chain::input const& input, KTH_DB_txn* db_txn) {
-
-    auto const& prevout = input.previous_output();
-
-    if (prevout.validation.cache.is_valid()) {
-
-        uint64_t history_count = get_history_count(db_txn);
-
-        if (history_count == max_uint64) {
-            LOG_INFO(LOG_DATABASE, "Error getting history items count");
-            return result_code::other;
+result_code internal_database_basis<Clock>::insert_history(prepared_block const& block, uint64_t history_base, std::vector<prepared_history> const& unresolved, KTH_DB_txn* db_txn) {
+    struct history_put {
+        short_hash key;
+        history_row row;
+    };
+
+    std::vector<history_put> rows;
+    rows.reserve(block.history_rows + unresolved.size());
+
+    auto const add = [&rows](prepared_history const& history, uint64_t id) {
+        KTH_ASSERT(history.value.size() == sizeof(history_row));
+        for (auto const& key : history.keys) {
+            history_put put {key, {}};
+            std::memcpy(&put.row, history.value.data(), sizeof(put.row));
+            put.row.set_id(id++);
+            rows.push_back(put);
         }
+        return id;
+    };
 
-        uint64_t id = history_count;
-
-        // This results in a complete and unambiguous history for the
-        // address since standard outputs contain unambiguous address data.
-        for (auto const& address : prevout.validation.cache.addresses()) {
-            auto valuearr = history_entry::factory_to_data(id, inpoint, domain::chain::point_kind::spend, height, inpoint.index(), prevout.checksum());
-            auto res = insert_history_db(address, valuearr, db_txn);
-            if (res != result_code::success) {
-                return res;
+    for (auto const& tx : block.transactions) {
+        for (auto const& output : tx.outputs) {
+            add(output.history, history_base + output.history.id);
+        }
+        for (auto const& input : tx.inputs) {
+            if (input.history_resolved) {
+                add(input.history, history_base + input.history.id);
             }
-            ++id;
         }
-    } else {
-            //During an IBD with checkpoints some previous output info is missing.
-            //We can recover it by accessing the database
+    }
 
-            //TODO (Mario) check if we can query UTXO
-            //TODO (Mario) requiere_confirmed = true ??
+    auto id = history_base + block.history_rows;
+    for (auto const& history : unresolved) {
+        id = add(history, id);
+    }
 
-            auto entry = get_utxo(prevout, db_txn);
+    if (rows.empty()) {
+        return result_code::success;
+    }
 
-            //auto entry = get_transaction(prevout.hash(), max_uint32, true, db_txn);
+    // Rows of a block share the height, (key, row) order is (key, id) order.
+    std::sort(rows.begin(), rows.end(), [](history_put const& a, history_put const& b) {
+        return a.key != b.key ? a.key < b.key : a.row.id() < b.row.id();
+    });
 
-            if (entry.is_valid()) {
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_history_db_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    for (auto& put : rows) {
+        auto key = kth_db_make_value(put.key.size(), put.key.data());
+        auto value = kth_db_make_value(sizeof(put.row), &put.row);
 
-                //auto const& tx = entry.transaction();
+        auto res = kth_db_cursor_put(cursor, &key, &value, KTH_DB_APPENDDUP);
+        if (res == KTH_DB_KEYEXIST) {
+            LOG_INFO(LOG_DATABASE, "Duplicate key inserting history [insert_history] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::duplicated_key;
+        }
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error inserting history [insert_history] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+        ++counters_.history;
+    }
 
-                //auto const& out_output = tx.outputs()[prevout.index()];
+    kth_db_cursor_close(cursor);
+    return result_code::success;
+}
 
-                uint64_t history_count = get_history_count(db_txn);
-                if (history_count == max_uint64) {
-                    LOG_INFO(LOG_DATABASE, "Error getting history items count");
-                    return result_code::other;
-                }
+// The addresses of an input whose previous output was not populated are taken
+// from the UTXO set, before it is removed.
+template <typename Clock>
+result_code internal_database_basis<Clock>::resolve_input_history(prepared_input const& input, std::vector<prepared_history>& unresolved, KTH_DB_txn* db_txn) {
 
-                uint64_t id = history_count;
+    if (input.history_resolved) {
+        return result_code::success;
+    }
 
-                auto const& out_output = entry.output();
-                for (auto const& address : out_output.addresses()) {
-                    auto valuearr = history_entry::factory_to_data(id, inpoint, domain::chain::point_kind::spend, height, inpoint.index(), prevout.checksum());
-                    auto res = insert_history_db(address, valuearr, db_txn);
-                    if (res != result_code::success) {
-                        return res;
-                    }
-                    ++id;
-                }
-            }
-            else {
-                LOG_INFO(LOG_DATABASE, "Error finding UTXO for input history [insert_input_history]");
-            }
+    //During an IBD with checkpoints some previous output info is missing.
+    //We can recover it by accessing the database
+
+    //TODO (Mario) requiere_confirmed = true ??
+    auto entry = get_utxo(input.prevout, db_txn);
+
+    if ( ! entry.is_valid()) {
+        LOG_INFO(LOG_DATABASE, "Error finding UTXO for input history [resolve_input_history]");
+        return result_code::success;
     }
 
+    // Written after the prepared rows, they have no id yet (see insert_history()).
+    prepared_history history;
+    history.value = input.history.value;
+    for (auto const& address : history_addresses(entry.output())) {
+        history.keys.push_back(address.hash20());
+    }
+    unresolved.push_back(std::move(history));
     return result_code::success;
 }
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::insert_output_history(hash_digest const& tx_hash,uint32_t height, uint32_t index, domain::chain::output const& output, KTH_DB_txn* db_txn ) {
 
-    uint64_t history_count = get_history_count(db_txn);
-    if (history_count == max_uint64) {
-        LOG_INFO(LOG_DATABASE, "Error getting history items count");
-        return result_code::other;
-    }
-
-    uint64_t id = history_count;
+    uint64_t id = get_history_count();
 
     auto const outpoint = domain::chain::output_point {tx_hash, index};
     auto const value = output.value();
 
     // Standard outputs contain unambiguous address data.
-    for (auto const& address : output.addresses()) {
+    for (auto const& address : history_addresses(output)) {
         auto valuearr = history_entry::factory_to_data(id, outpoint, domain::chain::point_kind::output, height, index, value);
-        auto res = insert_history_db(address, valuearr, db_txn);
+        auto res = insert_history_db(address.hash20(), valuearr, db_txn);
         if (res != result_code::success) {
             return res;
         }
@@ -130,70 +162,170 @@ result_code internal_database_basis<Clock>::insert_output_history(hash_digest co
 
 template <typename Clock>
 // static
-domain::chain::history_compact internal_database_basis<Clock>::history_entry_to_history_compact(history_entry const& entry) {
-    return domain::chain::history_compact{entry.point_kind(), entry.point(), entry.height(), entry.value_or_checksum()};
+domain::chain::history_compact internal_database_basis<Clock>::history_row_to_history_compact(history_row const& row) {
+    return domain::chain::history_compact{row.point_kind(), row.point(), row.height(), row.value_or_checksum()};
 }
 
 template <typename Clock>
 domain::chain::history_compact::list internal_database_basis<Clock>::get_history(short_hash const& key, size_t limit, size_t from_height) const {
-
-    domain::chain::history_compact::list result;
-
-    if (limit == 0) {
-        return result;
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {};
     }
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
-        return result;
+    auto result = get_history(key, limit, from_height, db_txn);
+    read_txns_.release(db_txn);
+    return result;
+}
+
+// Visits the rows of an address in [lower, upper), by position (see history_row),
+// oldest or newest first: visit(row) returns false to stop.
+// The cursor seeks to the bound and the rows are pulled a page at a time, they
+// are read in place and are valid until the transaction ends.
+template <typename Clock>
+template <typename Visitor>
+void internal_database_basis<Clock>::for_each_history_row(short_hash const& key, history_row::position_t lower, history_row::position_t upper, bool newest_first, KTH_DB_txn* db_txn, Visitor visit) const {
+    if ( ! (lower < upper)) {
+        return;
     }
 
     KTH_DB_cursor* cursor;
     if (kth_db_cursor_open(db_txn, dbi_history_db_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
-        return result;
+        return;
     }
 
     auto key_hash = kth_db_make_value(key.size(), const_cast<short_hash&>(key).data());
-    KTH_DB_val value;
-    int rc;
-    if ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_SET)) == 0) {
 
-        auto data = db_value_to_data_chunk(value);
-        auto entry = domain::create_old<history_entry>(data);
-
-        if (from_height == 0 || entry.height() >= from_height) {
-            result.push_back(history_entry_to_history_compact(entry));
+    // First row at or after the bound.
+    auto bound = history_row::at(newest_first ? upper : lower);
+    auto value = kth_db_make_value(sizeof(bound), &bound);
+    auto rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_GET_BOTH_RANGE);
+    if (newest_first && rc == KTH_DB_NOTFOUND) {
+        // Every row is before the bound, the scan starts at the newest one.
+        rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_SET);
+        if (rc == KTH_DB_SUCCESS) {
+            rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_LAST_DUP);
         }
+    }
 
-        while ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_NEXT_DUP)) == 0) {
+    // The page returned is the entire page of the current row, the rows outside
+    // the bounds are skipped with a binary search (the page is sorted).
+    if (rc == KTH_DB_SUCCESS) {
+        rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_GET_MULTIPLE);
+    }
 
-            if (limit > 0 && result.size() >= limit) {
-                break;
+    bool more = true;
+    while (rc == KTH_DB_SUCCESS && more) {
+        auto const first = static_cast<history_row const*>(kth_db_get_data(value));
+        auto const last = first + kth_db_get_size(value) / sizeof(history_row);
+
+        if (newest_first) {
+            auto it = std::partition_point(first, last, [&upper](history_row const& row) {
+                return row.position() < upper;
+            });
+            while (more && it != first) {
+                --it;
+                more = ! (it->position() < lower) && visit(*it);
             }
-
-            auto data = db_value_to_data_chunk(value);
-            auto entry = domain::create_old<history_entry>(data);
-
-            if (from_height == 0 || entry.height() >= from_height) {
-                result.push_back(history_entry_to_history_compact(entry));
+            rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_PREV_MULTIPLE);
+        } else {
+            auto it = std::partition_point(first, last, [&lower](history_row const& row) {
+                return row.position() < lower;
+            });
+            for (; more && it != last; ++it) {
+                more = it->position() < upper && visit(*it);
             }
-
+            rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_NEXT_MULTIPLE);
         }
     }
 
     kth_db_cursor_close(cursor);
+}
+
+template <typename Clock>
+domain::chain::history_compact::list internal_database_basis<Clock>::get_history(short_hash const& key, size_t limit, size_t from_height, KTH_DB_txn* db_txn) const {
+    data_chunk next_token;
+    return get_history_page(key, limit, from_height, false, {}, next_token, db_txn);
+}
+
+template <typename Clock>
+domain::chain::history_compact::list internal_database_basis<Clock>::get_history_page(short_hash const& key, size_t limit, size_t from_height, bool newest_first, data_chunk const& token, data_chunk& next_token) const {
+    next_token.clear();
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {};
+    }
+
+    auto result = get_history_page(key, limit, from_height, newest_first, token, next_token, db_txn);
+    read_txns_.release(db_txn);
+    return result;
+}
+
+// The token is the position of the last row returned.
+template <typename Clock>
+domain::chain::history_compact::list internal_database_basis<Clock>::get_history_page(short_hash const& key, size_t limit, size_t from_height, bool newest_first, data_chunk const& token, data_chunk& next_token, KTH_DB_txn* db_txn) const {
+
+    domain::chain::history_compact::list result;
+    next_token.clear();
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
+    if (limit == 0) {
         return result;
     }
 
+    history_row::position_t lower {uint32_t(std::min<size_t>(from_height, max_uint32)), 0};
+    history_row::position_t upper {max_uint32, max_uint64};
+
+    if ( ! token.empty()) {
+        if (token.size() != history_row::position_size) {
+            LOG_INFO(LOG_DATABASE, "Invalid history token [get_history_page]");
+            return result;
+        }
+
+        auto row = history_row::at({0, 0});
+        std::copy(token.begin(), token.end(), row.height_be);
+        auto const last = row.position();
+        if (newest_first) {
+            upper = last;
+        } else {
+            lower = std::max(lower, history_row::position_t{last.first, last.second + 1});
+        }
+    }
+
+    // One row past the page is read, the token is only returned if it exists.
+    history_row::position_t last;
+    bool more = false;
+    for_each_history_row(key, lower, upper, newest_first, db_txn, [&](history_row const& row) {
+        if (result.size() == limit) {
+            more = true;
+            return false;
+        }
+        result.push_back(history_row_to_history_compact(row));
+        last = row.position();
+        return true;
+    });
+
+    if (more) {
+        auto const row = history_row::at(last);
+        next_token.assign(row.data(), row.data() + history_row::position_size);
+    }
+
     return result;
 }
 
 template <typename Clock>
 std::vector<hash_digest> internal_database_basis<Clock>::get_history_txns(short_hash const& key, size_t limit, size_t from_height) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {};
+    }
+
+    auto result = get_history_txns(key, limit, from_height, db_txn);
+    read_txns_.release(db_txn);
+    return result;
+}
+
+template <typename Clock>
+std::vector<hash_digest> internal_database_basis<Clock>::get_history_txns(short_hash const& key, size_t limit, size_t from_height, KTH_DB_txn* db_txn) const {
 
     std::set<hash_digest> temp;
     std::vector<hash_digest> result;
@@ -202,72 +334,112 @@ std::vector<hash_digest> internal_database_basis<Clock>::get_history_txns(short_
     if (limit == 0)
         return result;
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
-        return result;
-    }
+    history_row::position_t const lower {uint32_t(std::min<size_t>(from_height, max_uint32)), 0};
+    history_row::position_t const upper {max_uint32, max_uint64};
+    for_each_history_row(key, lower, upper, false, db_txn, [&](history_row const& row) {
+        // Avoid inserting the same tx
+        auto const& pair = temp.insert(row.tx_hash());
+        if (pair.second) {
+            result.push_back(*pair.first);
+        }
+        return result.size() < limit;
+    });
+
+    return result;
+}
 
+#if ! defined(KTH_DB_READONLY)
+
+// Rewrites the legacy rows of at most max_keys addresses after last_key. The
+// rows of an address are deleted and appended again in the new sort order.
+template <typename Clock>
+result_code internal_database_basis<Clock>::upgrade_history_values(data_chunk& last_key, size_t max_keys, bool& done, KTH_DB_txn* db_txn) {
     KTH_DB_cursor* cursor;
     if (kth_db_cursor_open(db_txn, dbi_history_db_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
-        return result;
+        return result_code::other;
     }
 
-    auto key_hash = kth_db_make_value(key.size(), const_cast<short_hash&>(key).data());;
+    KTH_DB_val key;
     KTH_DB_val value;
     int rc;
-    if ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_SET)) == 0) {
-
-        auto data = db_value_to_data_chunk(value);
-        auto entry = domain::create_old<history_entry>(data);
+    if (last_key.empty()) {
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_FIRST);
+    } else {
+        key = kth_db_make_value(last_key.size(), last_key.data());
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET_RANGE);
+        if (rc == KTH_DB_SUCCESS && db_value_to_data_chunk(key) == last_key) {
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT_NODUP);
+        }
+    }
 
-        if (from_height == 0 || entry.height() >= from_height) {
-            // Avoid inserting the same tx
-            auto const & pair = temp.insert(entry.point().hash());
-            if (pair.second){
-                // Add valid txns to the result vector
-                result.push_back(*pair.first);
+    std::vector<history_row> rows;
+    size_t count = 0;
+    while (rc == KTH_DB_SUCCESS && count < max_keys) {
+        last_key = db_value_to_data_chunk(key);
+
+        rows.clear();
+        while (rc == KTH_DB_SUCCESS) {
+            auto const data = db_value_to_data_chunk(value);
+            byte_reader reader(data);
+            auto const entry = history_entry::from_data_legacy(reader);
+            if ( ! entry) {
+                LOG_ERROR(LOG_DATABASE, "Error decoding legacy history entry [upgrade_history_values]");
+                kth_db_cursor_close(cursor);
+                return result_code::other;
             }
+            rows.push_back(history_row::make(entry->id(), entry->point(), entry->point_kind(), entry->height(), entry->index(), entry->value_or_checksum()));
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT_DUP);
+        }
+
+        if (rc != KTH_DB_NOTFOUND) {
+            break;
         }
 
-        while ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_NEXT_DUP)) == 0) {
+        std::sort(rows.begin(), rows.end(), [](history_row const& a, history_row const& b) {
+            return std::memcmp(a.data(), b.data(), sizeof(history_row)) < 0;
+        });
 
-            if (limit > 0 && result.size() >= limit) {
+        auto row_key = kth_db_make_value(last_key.size(), last_key.data());
+        rc = kth_db_del(db_txn, dbi_history_db_, &row_key, NULL);
+        for (auto& row : rows) {
+            if (rc != KTH_DB_SUCCESS) {
                 break;
             }
+            auto row_value = kth_db_make_value(sizeof(row), &row);
+            rc = kth_db_put(db_txn, dbi_history_db_, &row_key, &row_value, KTH_DB_APPENDDUP);
+        }
 
-            auto data = db_value_to_data_chunk(value);
-            auto entry = domain::create_old<history_entry>(data);
-
-            if (from_height == 0 || entry.height() >= from_height) {
-                // Avoid inserting the same tx
-                auto const & pair = temp.insert(entry.point().hash());
-                if (pair.second){
-                    // Add valid txns to the result vector
-                    result.push_back(*pair.first);
-                }
-            }
+        if (rc != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error rewriting history entries [upgrade_history_values] ", rc);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+        ++count;
 
+        // The writes moved the cursor.
+        key = kth_db_make_value(last_key.size(), last_key.data());
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET_RANGE);
+        if (rc == KTH_DB_SUCCESS) {
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT_NODUP);
         }
     }
 
     kth_db_cursor_close(cursor);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return result;
+    if (rc != KTH_DB_SUCCESS && rc != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Error iterating history entries [upgrade_history_values] ", rc);
+        return result_code::other;
     }
 
-    return result;
+    done = rc == KTH_DB_NOTFOUND;
+    return result_code::success;
 }
 
-#if ! defined(KTH_DB_READONLY)
-
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_transaction_history_db(domain::chain::transaction const& tx, size_t height, KTH_DB_txn* db_txn) {
 
     for (auto const& output: tx.outputs()) {
-        for (auto const& address : output.addresses()) {
+        for (auto const& address : history_addresses(output)) {
             auto res = remove_history_db(address.hash20(), height, db_txn);
             if (res != result_code::success) {
                 return res;
@@ -280,13 +452,25 @@ result_code internal_database_basis<Clock>::remove_transaction_history_db(domain
         auto const& prevout = input.previous_output();
 
         if (prevout.validation.cache.is_valid()) {
-            for (auto const& address : prevout.validation.cache.addresses()) {
+            for (auto const& address : history_addresses(prevout.validation.cache)) {
                 auto res = remove_history_db(address.hash20(), height, db_txn);
                 if (res != result_code::success) {
                     return res;
                 }
             }
         }
+        else if ( ! has_index(db_index_transaction_hash)) {
+            // The spent output was restored from the reorg pool before.
+            auto const entry = get_utxo(prevout, db_txn);
+            if (entry.is_valid()) {
+                for (auto const& address : history_addresses(entry.output())) {
+                    auto res = remove_history_db(address.hash20(), height, db_txn);
+                    if (res != result_code::success) {
+                        return res;
+                    }
+                }
+            }
+        }
         else {
 
             auto const& entry = get_transaction(prevout.hash(), max_uint32, db_txn);
@@ -296,7 +480,7 @@ result_code internal_database_basis<Clock>::remove_transaction_history_db(domain
                 auto const& tx = entry.transaction();
                 auto const& out_output = tx.outputs()[prevout.index()];
 
-                for (auto const& address : out_output.addresses()) {
+                for (auto const& address : history_addresses(out_output)) {
 
                     auto res = remove_history_db(address.hash20(), height, db_txn);
                     if (res != result_code::success) {
@@ -318,6 +502,8 @@ result_code internal_database_basis<Clock>::remove_transaction_history_db(domain
     return result_code::success;
 }
 
+// The rows of an address sort by height, the rows of the height are a single
+// run: the cursor seeks to its first row and deletes until the height changes.
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_history_db(short_hash const& key, size_t height, KTH_DB_txn* db_txn) {
 
@@ -327,34 +513,33 @@ result_code internal_database_basis<Clock>::remove_history_db(short_hash const&
         return result_code::other;
     }
 
-    auto key_hash = kth_db_make_value(key.size(), const_cast<short_hash&>(key).data());;
-    KTH_DB_val value;
-    int rc;
-    if ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_SET)) == 0) {
-
-        auto data = db_value_to_data_chunk(value);
-        auto entry = domain::create_old<history_entry>(data);
-
-        if (entry.height() == height) {
-
-            if (kth_db_cursor_del(cursor, 0) != KTH_DB_SUCCESS) {
-                kth_db_cursor_close(cursor);
-                return result_code::other;
-            }
+    auto key_hash = kth_db_make_value(key.size(), const_cast<short_hash&>(key).data());
+    auto const first = history_row::at({uint32_t(height), 0});
+
+    while (true) {
+        // Seek again after every delete instead of stepping, where a delete
+        // leaves the cursor differs between the engines.
+        auto bound = first;
+        auto value = kth_db_make_value(sizeof(bound), &bound);
+        auto rc = kth_db_cursor_get(cursor, &key_hash, &value, KTH_DB_GET_BOTH_RANGE);
+        if (rc == KTH_DB_NOTFOUND) {
+            break;
+        }
+        if (rc != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error seeking history [remove_history_db] ", rc);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
         }
 
-        while ((rc = kth_db_cursor_get(cursor, &key_hash, &value, MDB_NEXT_DUP)) == 0) {
-
-            auto data = db_value_to_data_chunk(value);
-            auto entry = domain::create_old<history_entry>(data);
+        if (history_db_row(value).height() != height) {
+            break;
+        }
 
-            if (entry.height() == height) {
-                if (kth_db_cursor_del(cursor, 0) != KTH_DB_SUCCESS) {
-                    kth_db_cursor_close(cursor);
-                    return result_code::other;
-                }
-            }
+        if (kth_db_cursor_del(cursor, 0) != KTH_DB_SUCCESS) {
+            kth_db_cursor_close(cursor);
+            return result_code::other;
         }
+        --counters_.history;
     }
 
     kth_db_cursor_close(cursor);
@@ -365,14 +550,11 @@ result_code internal_database_basis<Clock>::remove_history_db(short_hash const&
 #endif // ! defined(KTH_DB_READONLY)
 
 
+#if ! defined(KTH_DB_READONLY)
 template <typename Clock>
-uint64_t internal_database_basis<Clock>::get_history_count(KTH_DB_txn* db_txn) const {
-  MDB_stat db_stats;
-  auto ret = mdb_stat(db_txn, dbi_history_db_, &db_stats);
-  if (ret != KTH_DB_SUCCESS) {
-      return max_uint64;
-  }
-  return db_stats.ms_entries;
+uint64_t internal_database_basis<Clock>::get_history_count() const {
+    return counters_.history;
 }
+#endif // ! defined(KTH_DB_READONLY)
 
 } // namespace kth::database
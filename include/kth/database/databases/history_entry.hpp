@@ -5,11 +5,143 @@
 #ifndef KTH_DATABASE_HISTORY_ENTRY_HPP_
 #define KTH_DATABASE_HISTORY_ENTRY_HPP_
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
 #include <kth/domain.hpp>
 #include <kth/database/define.hpp>
 
 namespace kth::database {
 
+// Layout of the history_db values. Every field is a byte array, so a row can
+// be read in place from the DB page whatever its alignment.
+// height and id are big-endian: the duplicates of an address sort by
+// (height, id), the order in which they are appended. The rest is little-endian.
+struct history_row {
+    uint8_t height_be[4];
+    uint8_t id_be[8];
+    uint8_t hash[hash_size];
+    uint8_t point_index[4];
+    uint8_t kind;
+    uint8_t index_le[4];
+    uint8_t value_or_checksum_le[8];
+
+    static
+    history_row make(uint64_t id, domain::chain::point const& point, domain::chain::point_kind kind, uint32_t height, uint32_t index, uint64_t value_or_checksum) {
+        history_row row;
+        store_big_endian(row.height_be, height);
+        store_big_endian(row.id_be, id);
+        std::copy(point.hash().begin(), point.hash().end(), row.hash);
+        store_little_endian(row.point_index, point.index());
+        row.kind = static_cast<uint8_t>(kind);
+        store_little_endian(row.index_le, index);
+        store_little_endian(row.value_or_checksum_le, value_or_checksum);
+        return row;
+    }
+
+    uint32_t height() const {
+        return load_big_endian<uint32_t>(height_be);
+    }
+
+    uint64_t id() const {
+        return load_big_endian<uint64_t>(id_be);
+    }
+
+    void set_id(uint64_t id) {
+        store_big_endian(id_be, id);
+    }
+
+    // (height, id): the order of the rows of an address, the first bytes of the row.
+    using position_t = std::pair<uint32_t, uint64_t>;
+    static constexpr size_t position_size = sizeof(height_be) + sizeof(id_be);
+
+    position_t position() const {
+        return {height(), id()};
+    }
+
+    // Sorts before every row at the position.
+    static
+    history_row at(position_t position) {
+        history_row row {};
+        store_big_endian(row.height_be, position.first);
+        store_big_endian(row.id_be, position.second);
+        return row;
+    }
+
+    hash_digest tx_hash() const {
+        hash_digest res;
+        std::copy(std::begin(hash), std::end(hash), res.begin());
+        return res;
+    }
+
+    domain::chain::point point() const {
+        return domain::chain::point{tx_hash(), load_little_endian<uint32_t>(point_index)};
+    }
+
+    domain::chain::point_kind point_kind() const {
+        return domain::chain::point_kind(kind);
+    }
+
+    uint32_t index() const {
+        return load_little_endian<uint32_t>(index_le);
+    }
+
+    uint64_t value_or_checksum() const {
+        return load_little_endian<uint64_t>(value_or_checksum_le);
+    }
+
+    uint8_t const* data() const {
+        return height_be;
+    }
+
+private:
+    template <typename T, size_t N>
+    static
+    void store_big_endian(uint8_t (&out)[N], T x) {
+        static_assert(sizeof(T) == N);
+        for (size_t i = 0; i < N; ++i) {
+            out[N - 1 - i] = uint8_t(x >> (8 * i));
+        }
+    }
+
+    template <typename T, size_t N>
+    static
+    void store_little_endian(uint8_t (&out)[N], T x) {
+        static_assert(sizeof(T) == N);
+        for (size_t i = 0; i < N; ++i) {
+            out[i] = uint8_t(x >> (8 * i));
+        }
+    }
+
+    template <typename T, size_t N>
+    static
+    T load_big_endian(uint8_t const (&in)[N]) {
+        static_assert(sizeof(T) == N);
+        T x = 0;
+        for (size_t i = 0; i < N; ++i) {
+            x = T(x << 8) | in[i];
+        }
+        return x;
+    }
+
+    template <typename T, size_t N>
+    static
+    T load_little_endian(uint8_t const (&in)[N]) {
+        static_assert(sizeof(T) == N);
+        T x = 0;
+        for (size_t i = N; i > 0; --i) {
+            x = T(x << 8) | in[i - 1];
+        }
+        return x;
+    }
+};
+
+static_assert(sizeof(history_row) == 61, "history_row must not be padded");
+static_assert(alignof(history_row) == 1, "history_row must be readable at any alignment");
+
 class KD_API history_entry {
 public:
 
@@ -27,10 +159,16 @@ public:
 
     bool is_valid() const;
 
-    //TODO(fernando): make domain::chain::point::serialized_size() static and constexpr to make this constexpr too
-    // constexpr
-    static
-    size_t serialized_size(domain::chain::point const& point);
+    static constexpr
+    size_t serialized_size() {
+        return sizeof(history_row);
+    }
+
+    // The point is part of the fixed-size row, kept for compatibility.
+    static constexpr
+    size_t serialized_size(domain::chain::point const& /*point*/) {
+        return serialized_size();
+    }
 
     data_chunk to_data() const;
     void to_data(std::ostream& stream) const;
@@ -40,9 +178,16 @@ public:
         factory_to_data(sink,id_, point_, point_kind_, height_, index_, value_or_checksum_ );
     }
 
+    static
+    history_entry from_row(history_row const& row);
+
     static
     expect<history_entry> from_data(byte_reader& reader);
 
+    // Layout of the DB versions prior to 5: id | point | kind | height | index | value, all little-endian.
+    static
+    expect<history_entry> from_data_legacy(byte_reader& reader);
+
     static
     data_chunk factory_to_data(uint64_t id, domain::chain::point const& point, domain::chain::point_kind kind, uint32_t height, uint32_t index, uint64_t value_or_checksum);
 
@@ -52,12 +197,8 @@ public:
     template <typename W, KTH_IS_WRITER(W)>
     static
     void factory_to_data(W& sink, uint64_t id, domain::chain::point const& point, domain::chain::point_kind kind, uint32_t height, uint32_t index, uint64_t value_or_checksum) {
-        sink.write_8_bytes_little_endian(id);
-        point.to_data(sink, false);
-        sink.write_byte(static_cast<uint8_t>(kind));
-        sink.write_4_bytes_little_endian(height);
-        sink.write_4_bytes_little_endian(index);
-        sink.write_8_bytes_little_endian(value_or_checksum);
+        auto const row = history_row::make(id, point, kind, height, index, value_or_checksum);
+        sink.write_bytes(row.data(), sizeof(row));
     }
 
 private:
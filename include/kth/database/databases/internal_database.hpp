@@ -5,7 +5,21 @@
 #ifndef KTH_DATABASE_INTERNAL_DATABASE_HPP_
 #define KTH_DATABASE_INTERNAL_DATABASE_HPP_
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include <boost/range/adaptor/reversed.hpp>
 #include <boost/interprocess/mapped_region.hpp>
@@ -19,10 +33,15 @@
 #include <kth/database/define.hpp>
 
 #include <kth/database/databases/header_abla_entry.hpp>
+#include <kth/database/databases/prepared_block.hpp>
 #include <kth/database/databases/result_code.hpp>
 #include <kth/database/databases/property_code.hpp>
+#include <kth/database/databases/read_txn_pool.hpp>
 #include <kth/database/databases/tools.hpp>
+#include <kth/database/databases/utxo_cache.hpp>
 #include <kth/database/databases/utxo_entry.hpp>
+#include <kth/database/databases/utxo_view.hpp>
+#include <kth/database/databases/worker_pool.hpp>
 #include <kth/database/databases/history_entry.hpp>
 #include <kth/database/databases/transaction_entry.hpp>
 #include <kth/database/databases/transaction_unconfirmed_entry.hpp>
@@ -54,7 +73,136 @@ constexpr size_t max_dbs_blocks_ = 8;      // KTH_DB_NEW_BLOCKS
 constexpr size_t max_dbs_pruned_ = 7;       // KTH_DB_NEW_PRUNED
 
 constexpr size_t env_open_mode_ = 0664;
+constexpr uint32_t default_max_readers = 126;        // LMDB default
 constexpr int directory_exists = 0;
+constexpr std::chrono::seconds grow_retry_delay {10};     // after a growth held off by the readers
+
+// 0: legacy utxo_entry encoding (no db_version property)
+// 1: compact utxo_entry encoding
+// 2: block_db keeps every tx id of the block (full mode)
+// 3: transaction_hash_db keyed by the hash prefix (full mode)
+// 4: block_db keeps the range of tx ids of the block (full mode)
+// 5: history_db values are fixed-size history_row (full mode)
+// 6: transaction_hash_db duplicates keep 8 more bytes of the hash (full mode)
+constexpr uint32_t current_db_version = 6;
+
+// Confirmed transactions are numbered in chain order. The id is stored as a
+// native-endian 8-byte integer: the key of transaction_db and the sorted
+// duplicates of transaction_hash_db and block_db (full mode).
+using tx_id_t = uint64_t;
+
+// LMDB only aligns the data of integer keys and fixed-size duplicates, copy
+// the id instead of dereferencing it (it compiles to a single load).
+inline
+tx_id_t tx_id_from_value(KTH_DB_val const& value) {
+    tx_id_t id;
+    std::memcpy(&id, kth_db_get_data(value), sizeof(id));
+    return id;
+}
+
+// transaction_hash_db key: the first 8 bytes of the hash, as an integer.
+// Hashes sharing a prefix are told apart by tx_hash_value.
+inline
+uint64_t tx_hash_prefix(hash_digest const& hash) {
+    uint64_t prefix;
+    std::memcpy(&prefix, hash.data(), sizeof(prefix));
+    return prefix;
+}
+
+// block_db flags in full mode, versions 2 and 3: key: block height, sorted
+// duplicates: tx ids.
+constexpr uint32_t block_tx_ids_flags = KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED | KTH_DB_INTEGERDUP;
+
+// block_db value in full mode: the ids of the block transactions are contiguous.
+// first tx id (8 bytes) | tx count (4 bytes)
+struct block_tx_range {
+    static constexpr size_t value_size = sizeof(tx_id_t) + sizeof(uint32_t);
+
+    static
+    block_tx_range from_value(KTH_DB_val const& value) {
+        auto const data = static_cast<uint8_t const*>(kth_db_get_data(value));
+        block_tx_range res;
+        std::memcpy(&res.first, data, sizeof(res.first));
+        std::memcpy(&res.count, data + sizeof(res.first), sizeof(res.count));
+        return res;
+    }
+
+    static
+    std::array<uint8_t, value_size> to_value(tx_id_t first, uint32_t count) {
+        std::array<uint8_t, value_size> res;
+        std::memcpy(res.data(), &first, sizeof(first));
+        std::memcpy(res.data() + sizeof(first), &count, sizeof(count));
+        return res;
+    }
+
+    tx_id_t first;
+    uint32_t count;
+};
+
+// transaction_hash_db flags, versions 3 to 5: key: hash prefix, sorted duplicates: tx ids.
+constexpr uint32_t tx_hash_ids_flags = KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED | KTH_DB_INTEGERDUP;
+
+// transaction_hash_db flags: key: hash prefix, sorted duplicates: tx_hash_value.
+constexpr uint32_t tx_hash_prefix_flags = KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED;
+
+// transaction_hash_db duplicate: the hash bytes 8 to 15 | tx id (8 bytes).
+// The duplicates sort byte-wise, the candidates of a hash are reached with one
+// seek and only the ones matching 16 bytes of the hash are read and hashed.
+struct tx_hash_value {
+    static constexpr size_t hash_offset = sizeof(uint64_t);
+    static constexpr size_t hash_size = sizeof(uint64_t);
+    static constexpr size_t value_size = hash_size + sizeof(tx_id_t);
+
+    static
+    std::array<uint8_t, value_size> to_value(hash_digest const& hash, tx_id_t id) {
+        std::array<uint8_t, value_size> res;
+        std::memcpy(res.data(), hash.data() + hash_offset, hash_size);
+        std::memcpy(res.data() + hash_size, &id, sizeof(id));
+        return res;
+    }
+
+    static
+    bool matches(KTH_DB_val const& value, hash_digest const& hash) {
+        return std::memcmp(kth_db_get_data(value), hash.data() + hash_offset, hash_size) == 0;
+    }
+
+    static
+    tx_id_t id(KTH_DB_val const& value) {
+        tx_id_t res;
+        std::memcpy(&res, static_cast<uint8_t const*>(kth_db_get_data(value)) + hash_size, sizeof(res));
+        return res;
+    }
+};
+
+// dbi_utxo_ key: point.to_data(KTH_INTERNAL_DB_WIRE) on the stack, the hash
+// and the little-endian index (4 bytes on the wire format, 2 bytes otherwise).
+constexpr size_t utxo_key_size = hash_size + (KTH_INTERNAL_DB_WIRE ? sizeof(uint32_t) : sizeof(uint16_t));
+using utxo_key_t = std::array<uint8_t, utxo_key_size>;
+
+inline
+utxo_key_t to_utxo_key(domain::chain::output_point const& point) {
+    utxo_key_t key;
+    auto const& hash = point.hash();
+    std::copy(hash.begin(), hash.end(), key.begin());
+    auto index = point.index();
+    for (size_t i = hash_size; i < utxo_key_size; ++i) {
+        key[i] = uint8_t(index & 0xff);
+        index >>= 8;
+    }
+    KTH_ASSERT(data_chunk(key.begin(), key.end()) == point.to_data(KTH_INTERNAL_DB_WIRE));
+    return key;
+}
+
+// history_db values are read in place, the row is valid while the
+// transaction is alive and the page is not modified.
+inline
+history_row const& history_db_row(KTH_DB_val const& value) {
+    KTH_ASSERT(kth_db_get_size(value) == sizeof(history_row));
+    return *static_cast<history_row const*>(kth_db_get_data(value));
+}
+
+template <typename Clock>
+class read_snapshot_basis;
 
 template <typename Clock = std::chrono::system_clock>
 class KD_API internal_database_basis {
@@ -80,7 +228,7 @@ public:
     constexpr static char spend_db_name[] = "spend";
     constexpr static char transaction_unconfirmed_db_name[] = "transaction_unconfirmed";
 
-    internal_database_basis(path const& db_dir, db_mode_type mode, uint32_t reorg_pool_limit, uint64_t db_max_size, bool safe_mode);
+    internal_database_basis(path const& db_dir, db_mode_type mode, uint32_t reorg_pool_limit, uint64_t db_max_size, bool safe_mode, uint32_t cache_capacity = 0, uint32_t batch_max_blocks = 0, uint64_t batch_max_bytes = 0, uint32_t max_readers = 0, uint64_t db_growth_step = 0, db_indexes_t indexes = db_index_all, uint32_t worker_threads = 0);
     ~internal_database_basis();
 
     // Non-copyable, non-movable
@@ -97,13 +245,55 @@ public:
 #if ! defined(KTH_DB_READONLY)
     result_code push_genesis(domain::chain::block const& block);
 
-    //TODO(fernando): optimization: consider passing a list of outputs to insert and a list of inputs to delete instead of an entire Block.
-    //                  avoiding inserting and erasing internal spenders
     result_code push_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past);
+
+    // Serializes everything push_block() writes, it does not access the DB and
+    // can be called from any thread, i.e. while the previous block is being pushed.
+    // With threads > 1 the transactions of large blocks are split across the calling
+    // thread and up to threads - 1 of the worker_threads workers.
+    prepared_block prepare_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past, size_t threads = 1) const;
+    result_code push_block(prepared_block const& block);
+
+    // Blocks pushed between begin_batch() and end_batch() share LMDB write transactions,
+    // committed every batch_max_blocks blocks or batch_max_bytes bytes.
+    // The write transaction is bound to the calling thread: only push_block() and
+    // end_batch() of the thread that called begin_batch() use it, the other threads
+    // push their blocks in their own transactions once the batch is committed.
+    bool begin_batch();
+    result_code end_batch();
+
+    // Blocks of the batch discarded by the last push_block() of the batch owner,
+    // when it failed. Without safe_mode there are no nested transactions, a failing
+    // block discards the blocks pushed since the last commit of the batch.
+    uint32_t discarded_blocks() const;
+
+    // Writes the history and spend rows of up to max_blocks stored blocks, from
+    // the indexed height on (full mode with db_index_deferred). It can be called
+    // from any thread, it waits for the open write transaction or batch.
+    result_code index_blocks(uint32_t max_blocks, uint32_t& out_blocks);
 #endif
 
     utxo_entry get_utxo(domain::chain::output_point const& point) const;
 
+    // Read-only transaction held by the caller, returns nullptr on error.
+    // Views obtained through it are valid until end_read() is called.
+    KTH_DB_txn* begin_read() const;
+    void end_read(KTH_DB_txn* db_txn) const;
+
+    // Pool of reset read transactions shared by the getters.
+    read_txn_pool const& read_txns() const;
+
+    // Reads the entry in place, nothing is copied unless it comes from the UTXO cache.
+    utxo_view get_utxo_view(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const;
+
+    // Entries are returned in the order of points, invalid if not found.
+    // The points are looked up in key order through one cursor; with threads > 1 the
+    // sorted range is split across the calling thread and up to threads - 1 of the
+    // worker_threads workers, each one with its own read transaction.
+    // Returns nullopt if any of the lookups could not be done (i.e. no reader slot),
+    // a missing entry would be taken as a missing UTXO.
+    std::optional<std::vector<utxo_entry>> get_utxos(std::span<domain::chain::output_point const> points, size_t threads = 1) const;
+
     result_code get_last_height(uint32_t& out_height) const;
 
     std::pair<domain::chain::header, uint32_t> get_header(hash_digest const& hash) const;
@@ -129,8 +319,18 @@ public:
     domain::chain::history_compact::list get_history(short_hash const& key, size_t limit, size_t from_height) const;
     std::vector<hash_digest> get_history_txns(short_hash const& key, size_t limit, size_t from_height) const;
 
+    // Up to limit rows at or above from_height, oldest or newest first. The rows
+    // continue after token (empty: from the start), next_token is left empty
+    // when there are no more rows.
+    domain::chain::history_compact::list get_history_page(short_hash const& key, size_t limit, size_t from_height, bool newest_first, data_chunk const& token, data_chunk& next_token) const;
+
     domain::chain::input_point get_spend(domain::chain::output_point const& point) const;
 
+    // The history and spend rows of the blocks below the indexed height are
+    // stored, the address queries are complete up to the tip when it is above it.
+    result_code get_indexed_height(uint32_t& out_height) const;
+    bool is_index_complete() const;
+
     std::vector<transaction_unconfirmed_entry> get_all_transaction_unconfirmed() const;
 
     transaction_unconfirmed_entry get_transaction_unconfirmed(hash_digest const& hash) const;
@@ -140,13 +340,43 @@ public:
 #endif // ! defined(KTH_DB_READONLY)
 
 private:
+    friend class read_snapshot_basis<Clock>;
 
 #if ! defined(KTH_DB_READONLY)
     bool create_db_mode_property();
+
+    bool create_db_version_property();
+
+    bool upgrade_db_version(uint32_t version);
+
+    result_code set_db_version(uint32_t version, KTH_DB_txn* db_txn);
+
+    bool upgrade_utxo_encoding();
+
+    // Writes the rows of a full mode index for a stored transaction.
+    using tx_index_writer = result_code (internal_database_basis::*)(tx_id_t id, transaction_entry const& entry, KTH_DB_txn* db_txn);
+
+    bool upgrade_tx_index(uint32_t version, char const* name, uint32_t flags, KTH_DB_dbi& dbi, tx_index_writer write);
+
+    result_code rebuild_tx_index(tx_id_t& next_id, size_t max_entries, bool& done, tx_index_writer write, KTH_DB_txn* db_txn);
+
+    result_code index_block_tx_range(tx_id_t id, transaction_entry const& entry, KTH_DB_txn* db_txn);
+
+    result_code index_transaction_hash(tx_id_t id, transaction_entry const& entry, KTH_DB_txn* db_txn);
+
+    bool upgrade_history_layout();
+
+    result_code upgrade_history_values(data_chunk& last_key, size_t max_keys, bool& done, KTH_DB_txn* db_txn);
 #endif
 
+    uint32_t stored_layout_version(KTH_DB_txn* db_txn) const;
+
     bool verify_db_mode_property() const;
 
+    bool verify_db_version_property();
+
+    bool verify_utxo_cache_property();
+
     bool open_internal();
 
     bool is_old_block(domain::chain::block const& block) const;
@@ -155,56 +385,125 @@ private:
 
     size_t adjust_db_size(size_t size) const;
 
+    uint32_t get_max_readers() const;
+
+    bool has_index(db_indexes_t index) const;
+
+    // Empty for the outputs not indexed with db_index_history_standard.
+    domain::wallet::payment_address::list history_addresses(domain::chain::output const& output) const;
+
+    bool index_on_push(uint32_t height) const;
+
+#if ! defined(KTH_DB_READONLY)
+    // Map growth, the map can only be resized when no write transaction is open.
+    uint64_t map_space_needed(uint64_t bytes) const;
+    bool map_nearly_full(uint64_t needed) const;
+    bool ensure_map_space(uint64_t needed);
+    bool grow_map(uint64_t needed);
+#endif
+
     bool create_and_open_environment();
 
     bool open_databases();
 
     utxo_entry get_utxo(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const;
 
+    result_code get_last_height(uint32_t& out_height, KTH_DB_txn* db_txn) const;
+
+    result_code get_indexed_height(uint32_t& out_height, KTH_DB_txn* db_txn) const;
+
+    bool is_index_complete(KTH_DB_txn* db_txn) const;
+
+    std::pair<domain::chain::header, uint32_t> get_header(hash_digest const& hash, KTH_DB_txn* db_txn) const;
+
+    domain::chain::header::list get_headers(uint32_t from, uint32_t to, KTH_DB_txn* db_txn) const;
+
+    std::pair<result_code, utxo_pool_t> get_utxo_pool_from(uint32_t from, uint32_t to, KTH_DB_txn* db_txn) const;
+
+    using utxo_lookup_t = std::pair<data_chunk, size_t>;     // (key, index in the result)
+    bool get_utxos(utxo_lookup_t const* first, utxo_lookup_t const* last, std::vector<utxo_entry>& out) const;
+
 #if ! defined(KTH_DB_READONLY)
     result_code insert_reorg_pool(uint32_t height, KTH_DB_val& key, KTH_DB_txn* db_txn);
 
+    result_code insert_reorg_pool(uint32_t height, KTH_DB_val& key, KTH_DB_val& value, KTH_DB_txn* db_txn);
+
     result_code remove_utxo(uint32_t height, domain::chain::output_point const& point, bool insert_reorg, KTH_DB_txn* db_txn);
 
-    result_code insert_utxo(domain::chain::output_point const& point, domain::chain::output const& output, data_chunk const& fixed_data, KTH_DB_txn* db_txn);
+    result_code remove_utxo(uint32_t height, domain::chain::output_point const& point, data_chunk const& key, bool insert_reorg, KTH_DB_txn* db_txn);
 
-    result_code remove_inputs(hash_digest const& tx_id, uint32_t height, domain::chain::input::list const& inputs, bool insert_reorg, KTH_DB_txn* db_txn);
+    result_code insert_utxo(domain::chain::output_point const& point, data_chunk const& key, data_chunk const& value, uint32_t height, KTH_DB_txn* db_txn);
 
-    result_code insert_outputs(hash_digest const& tx_id, uint32_t height, domain::chain::output::list const& outputs, data_chunk const& fixed_data, KTH_DB_txn* db_txn);
+    result_code insert_utxos(std::vector<prepared_output const*>& outputs, KTH_DB_txn* db_txn);
 
-    result_code insert_outputs_error_treatment(uint32_t height, data_chunk const& fixed_data, hash_digest const& txid, domain::chain::output::list const& outputs, KTH_DB_txn* db_txn);
+    result_code remove_utxos(std::vector<prepared_input const*>& inputs, uint32_t height, bool insert_reorg, KTH_DB_txn* db_txn);
 
-    template <typename I>
-    result_code push_transactions_outputs_non_coinbase(uint32_t height, data_chunk const& fixed_data, I f, I l, KTH_DB_txn* db_txn);
+    result_code flush_utxo_cache(bool all, KTH_DB_txn* db_txn);
 
-    template <typename I>
-    result_code remove_transactions_inputs_non_coinbase(uint32_t height, I f, I l, bool insert_reorg, KTH_DB_txn* db_txn);
+    result_code upgrade_utxo_values(KTH_DB_dbi dbi, data_chunk& last_key, size_t max_entries, bool& done, KTH_DB_txn* db_txn);
 
-    template <typename I>
-    result_code push_transactions_non_coinbase(uint32_t height, data_chunk const& fixed_data, I f, I l, bool insert_reorg, KTH_DB_txn* db_txn);
+    result_code update_utxo_cache_property(KTH_DB_txn* db_txn);
+
+    // Restores the outputs of the blocks from height on that were lost with the UTXO cache.
+    bool recover_utxo_set(uint32_t from);
+    result_code recover_utxo_set(uint32_t from, KTH_DB_txn* db_txn);
+
+    bool load_counters();
+
+    result_code save_counters(KTH_DB_txn* db_txn);
+
+    bool flush_utxo_cache();
+
+    result_code push_block_cached(prepared_block const& block, KTH_DB_txn* db_txn);
+
+    bool batch_owned() const;
+
+    result_code push_block_batched(prepared_block const& block);
+
+    result_code commit_batch();
+
+    void abort_batch();
+
+    prepared_transaction prepare_transaction(domain::chain::transaction const& tx, uint32_t position, uint32_t height, uint32_t median_time_past, data_chunk const& fixed) const;
+
+    static
+    void assign_history_ids(prepared_block& block);
+
+    result_code remove_inputs(prepared_block const& block, std::vector<prepared_history>& unresolved, KTH_DB_txn* db_txn);
+
+    result_code insert_outputs(prepared_transaction const& tx, uint32_t height, KTH_DB_txn* db_txn);
+
+    result_code insert_outputs(prepared_block const& block, KTH_DB_txn* db_txn);
 
     result_code push_block_header(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn);
 
-    result_code push_block_reorg(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn);
+    result_code push_block_header(prepared_block const& block, KTH_DB_txn* db_txn);
+
+    result_code push_block_header(data_chunk const& header, hash_digest const& hash, uint32_t height, KTH_DB_txn* db_txn);
+
+    result_code push_block_reorg(prepared_block const& block, KTH_DB_txn* db_txn);
 
-    result_code push_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past, bool insert_reorg, KTH_DB_txn* db_txn);
+    result_code push_block(prepared_block const& block, KTH_DB_txn* db_txn);
 
     result_code push_genesis(domain::chain::block const& block, KTH_DB_txn* db_txn);
 
-    result_code remove_outputs(hash_digest const& txid, domain::chain::output::list const& outputs, KTH_DB_txn* db_txn);
+    static
+    std::unordered_set<domain::chain::point> spent_in_block(domain::chain::block const& block);
+
+    result_code remove_outputs(hash_digest const& txid, domain::chain::output::list const& outputs, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn);
 
     result_code insert_output_from_reorg_and_remove(domain::chain::output_point const& point, KTH_DB_txn* db_txn);
 
-    result_code insert_inputs(domain::chain::input::list const& inputs, KTH_DB_txn* db_txn);
+    result_code insert_inputs(domain::chain::input::list const& inputs, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn);
 
     template <typename I>
-    result_code insert_transactions_inputs_non_coinbase(I f, I l, KTH_DB_txn* db_txn);
+    result_code insert_transactions_inputs_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn);
 
     template <typename I>
-    result_code remove_transactions_outputs_non_coinbase(I f, I l, KTH_DB_txn* db_txn);
+    result_code remove_transactions_outputs_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn);
 
     template <typename I>
-    result_code remove_transactions_non_coinbase(I f, I l, KTH_DB_txn* db_txn);
+    result_code remove_transactions_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn);
 
     result_code remove_block_header(hash_digest const& hash, uint32_t height, KTH_DB_txn* db_txn);
 
@@ -213,6 +512,12 @@ private:
     result_code remove_reorg_index(uint32_t height, KTH_DB_txn* db_txn);
 
     result_code remove_block(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn);
+
+    result_code get_unindexed_size(uint32_t max_blocks, uint64_t& out_bytes) const;
+
+    result_code index_blocks(uint32_t max_blocks, uint64_t needed, bool& out_map_full, uint32_t& out_blocks);
+
+    result_code index_block(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn);
 #endif
 
     domain::chain::header get_header(uint32_t height, KTH_DB_txn* db_txn) const;
@@ -238,41 +543,61 @@ private:
 
     domain::chain::block get_block(uint32_t height, KTH_DB_txn* db_txn) const;
 
-    domain::chain::block get_block(hash_digest const& hash, KTH_DB_txn* db_txn) const;
+    // Median of the timestamps of the 11 blocks below height, as the chain state computes it.
+    uint32_t get_median_time_past(uint32_t height, KTH_DB_txn* db_txn) const;
+
+    std::pair<domain::chain::block, uint32_t> get_block(hash_digest const& hash, KTH_DB_txn* db_txn) const;
 
 #if ! defined(KTH_DB_READONLY)
     result_code insert_block(domain::chain::block const& block, uint32_t height, uint64_t tx_count, KTH_DB_txn* db_txn);
 
+    result_code insert_block(prepared_block const& block, uint64_t tx_count, KTH_DB_txn* db_txn);
+
+    result_code insert_block(uint32_t height, uint64_t tx_count, size_t txs, data_chunk const& data, KTH_DB_txn* db_txn);
+
     result_code remove_transactions(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn);
 
-    result_code insert_transaction(uint64_t id, domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position , KTH_DB_txn* db_txn);
+    result_code insert_transaction(tx_id_t id, domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position , KTH_DB_txn* db_txn);
+
+    result_code insert_transaction(tx_id_t id, hash_digest const& hash, data_chunk const& entry, KTH_DB_txn* db_txn);
+
+    result_code insert_transaction_hash(hash_digest const& hash, tx_id_t id, KTH_DB_txn* db_txn);
     //data_chunk serialize_txs(domain::chain::block const& block);
 
-    template <typename I>
-    result_code insert_transactions(I f, I l, uint32_t height, uint32_t median_time_past,uint64_t tx_count, KTH_DB_txn* db_txn);
+    result_code insert_transactions(prepared_block const& block, uint64_t tx_count, KTH_DB_txn* db_txn);
 #endif // ! defined(KTH_DB_READONLY)
 
     transaction_entry get_transaction(hash_digest const& hash, size_t fork_height, KTH_DB_txn* db_txn) const;
-    transaction_entry get_transaction(uint64_t id, KTH_DB_txn* db_txn) const;
+    transaction_entry get_transaction(tx_id_t id, KTH_DB_txn* db_txn) const;
+    transaction_entry find_transaction(hash_digest const& hash, tx_id_t& out_id, KTH_DB_txn* db_txn) const;
 
 
 #if ! defined(KTH_DB_READONLY)
-    result_code insert_input_history(domain::chain::input_point const& inpoint, uint32_t height, domain::chain::input const& input, KTH_DB_txn* db_txn);
+    result_code resolve_input_history(prepared_input const& input, std::vector<prepared_history>& unresolved, KTH_DB_txn* db_txn);
 
     result_code insert_output_history(hash_digest const& tx_hash,uint32_t height, uint32_t index, domain::chain::output const& output, KTH_DB_txn* db_txn);
 
-    result_code insert_history_db(domain::wallet::payment_address const& address, data_chunk const& entry, KTH_DB_txn* db_txn);
+    result_code insert_history_db(short_hash const& key, data_chunk const& entry, KTH_DB_txn* db_txn);
+
+    result_code insert_history(prepared_block const& block, uint64_t history_base, std::vector<prepared_history> const& unresolved, KTH_DB_txn* db_txn);
 #endif // ! defined(KTH_DB_READONLY)
 
+    domain::chain::history_compact::list get_history(short_hash const& key, size_t limit, size_t from_height, KTH_DB_txn* db_txn) const;
+    std::vector<hash_digest> get_history_txns(short_hash const& key, size_t limit, size_t from_height, KTH_DB_txn* db_txn) const;
+    domain::chain::history_compact::list get_history_page(short_hash const& key, size_t limit, size_t from_height, bool newest_first, data_chunk const& token, data_chunk& next_token, KTH_DB_txn* db_txn) const;
+
+    template <typename Visitor>
+    void for_each_history_row(short_hash const& key, history_row::position_t lower, history_row::position_t upper, bool newest_first, KTH_DB_txn* db_txn, Visitor visit) const;
+
     static
-    domain::chain::history_compact history_entry_to_history_compact(history_entry const& entry);
+    domain::chain::history_compact history_row_to_history_compact(history_row const& row);
 
 #if ! defined(KTH_DB_READONLY)
     result_code remove_history_db(short_hash const& key, size_t height, KTH_DB_txn* db_txn);
 
     result_code remove_transaction_history_db(domain::chain::transaction const& tx, size_t height, KTH_DB_txn* db_txn);
 
-    result_code insert_spend(domain::chain::output_point const& out_point, domain::chain::input_point const& in_point, KTH_DB_txn* db_txn);
+    result_code insert_spend(data_chunk const& out_point, data_chunk const& in_point, KTH_DB_txn* db_txn);
 
     result_code remove_spend(domain::chain::output_point const& out_point, KTH_DB_txn* db_txn);
 
@@ -283,8 +608,12 @@ private:
     result_code remove_transaction_unconfirmed(hash_digest const& tx_id,  KTH_DB_txn* db_txn);
 #endif
 
+    domain::chain::input_point get_spend(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const;
+
     transaction_unconfirmed_entry get_transaction_unconfirmed(hash_digest const& hash, KTH_DB_txn* db_txn) const;
 
+    std::vector<transaction_unconfirmed_entry> get_all_transaction_unconfirmed(KTH_DB_txn* db_txn) const;
+
 
 #if ! defined(KTH_DB_READONLY)
     result_code update_transaction(domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position, KTH_DB_txn* db_txn);
@@ -296,9 +625,11 @@ private:
 
     uint32_t get_clock_now() const;
 
-    uint64_t get_tx_count(KTH_DB_txn* db_txn) const;
+#if ! defined(KTH_DB_READONLY)
+    uint64_t get_tx_count() const;
 
-    uint64_t get_history_count(KTH_DB_txn* db_txn) const;
+    uint64_t get_history_count() const;
+#endif // ! defined(KTH_DB_READONLY)
 
 // Data members ----------------------------
     path const db_dir_;
@@ -308,10 +639,50 @@ private:
     bool db_opened_ = false;
     db_mode_type db_mode_;
     uint64_t db_max_size_;
+    uint64_t const db_growth_step_;
+    std::chrono::steady_clock::time_point grow_retry_;
+    db_indexes_t const indexes_;
     bool safe_mode_;
     //bool fast_mode = false;
 
+    // Outputs of old blocks (IBD) are kept in memory until the cache is full.
+    utxo_cache utxo_cache_;
+    bool use_utxo_cache_ = false;
+    bool utxo_cache_dirty_ = false;
+
+    // Rows of transaction_db and history_db (full mode), the next ids to assign.
+    // counters_ follows the open write transaction, committed_counters_ what is in the DB.
+    // indexed: blocks whose history and spend rows are stored (the indexed height).
+    struct table_counters {
+        uint64_t txs = 0;
+        uint64_t history = 0;
+        uint64_t indexed = 0;
+    };
+    table_counters counters_;
+    table_counters committed_counters_;
+
+    // Multi-block write transactions
+    uint32_t const batch_max_blocks_;
+    uint64_t const batch_max_bytes_;
+    // Thread that called begin_batch(), the only one using batch_txn_ and the
+    // batch counters. batch_txn_ is only set and cleared under write_mutex_.
+    std::atomic<std::thread::id> batch_owner_{};
+    KTH_DB_txn* batch_txn_ = nullptr;
+    bool batch_utxo_cache_dirty_ = false;
+    uint32_t batch_blocks_ = 0;
+    std::atomic<uint32_t> discarded_blocks_{0};
+    uint64_t batch_bytes_ = 0;
+    std::chrono::steady_clock::time_point batch_start_;
+
+    // Serializes the writers with the background indexer, held by the batch
+    // from begin_batch() to its commit or abort.
+    std::mutex write_mutex_;
+
     KTH_DB_env* env_;
+    uint32_t const max_readers_;
+    mutable read_txn_pool read_txns_;
+    // worker_threads threads, only used by get_utxos() and prepare_block().
+    mutable worker_pool workers_;
     KTH_DB_dbi dbi_block_header_;
     KTH_DB_dbi dbi_block_header_by_hash_;
     KTH_DB_dbi dbi_utxo_;
@@ -367,12 +738,12 @@ constexpr char internal_database_basis<Clock>::db_properties_name[];
 
 template <typename Clock>
 constexpr char internal_database_basis<Clock>::block_db_name[];                  //key: block height, value: block
-                                                                                 //key: block height, value: tx hashes
+                                                                                 //key: block height, value: tx id range (full mode)
 template <typename Clock>
-constexpr char internal_database_basis<Clock>::transaction_db_name[];            //key: tx hash, value: tx
+constexpr char internal_database_basis<Clock>::transaction_db_name[];            //key: tx id, value: tx
 
 template <typename Clock>
-constexpr char internal_database_basis<Clock>::transaction_hash_db_name[];            //key: tx hash, value: tx
+constexpr char internal_database_basis<Clock>::transaction_hash_db_name[];            //key: tx hash prefix, value: tx ids
 
 template <typename Clock>
 constexpr char internal_database_basis<Clock>::history_db_name[];            //key: tx hash, value: tx
@@ -398,4 +769,6 @@ using internal_database = internal_database_basis<std::chrono::system_clock>;
 #include <kth/database/databases/transaction_database.ipp>
 #include <kth/database/databases/utxo_database.ipp>
 
+#include <kth/database/databases/read_snapshot.hpp>
+
 #endif // KTH_DATABASE_INTERNAL_DATABASE_HPP_
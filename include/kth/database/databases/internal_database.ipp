@@ -13,13 +13,20 @@ namespace kth::database {
 using utxo_pool_t = std::unordered_map<domain::chain::point, utxo_entry>;
 
 template <typename Clock>
-internal_database_basis<Clock>::internal_database_basis(path const& db_dir, db_mode_type mode, uint32_t reorg_pool_limit, uint64_t db_max_size, bool safe_mode)
+internal_database_basis<Clock>::internal_database_basis(path const& db_dir, db_mode_type mode, uint32_t reorg_pool_limit, uint64_t db_max_size, bool safe_mode, uint32_t cache_capacity, uint32_t batch_max_blocks, uint64_t batch_max_bytes, uint32_t max_readers, uint64_t db_growth_step, db_indexes_t indexes, uint32_t worker_threads)
     : db_dir_(db_dir)
     , db_mode_(mode)
     , reorg_pool_limit_(reorg_pool_limit)
     , limit_(blocks_to_seconds(reorg_pool_limit))
     , db_max_size_(db_max_size)
+    , db_growth_step_(db_growth_step)
+    , indexes_(mode == db_mode_type::full ? indexes : 0)
     , safe_mode_(safe_mode)
+    , utxo_cache_(mode == db_mode_type::pruned ? 0 : cache_capacity)
+    , batch_max_blocks_(batch_max_blocks)
+    , batch_max_bytes_(batch_max_bytes)
+    , max_readers_(max_readers)
+    , workers_(worker_threads)
 {}
 
 template <typename Clock>
@@ -53,7 +60,12 @@ bool internal_database_basis<Clock>::create() {
         return false;
     }
 
-    return true;
+    ret = create_db_version_property();
+    if ( ! ret ) {
+        return false;
+    }
+
+    return load_counters();
 }
 
 template <typename Clock>
@@ -76,6 +88,20 @@ bool internal_database_basis<Clock>::create_db_mode_property() {
         return false;
     }
 
+    if (db_mode_ == db_mode_type::full) {
+        property_code_ = property_code::db_indexes;
+        key = kth_db_make_value(sizeof(property_code_), &property_code_);
+        db_indexes_t indexes = indexes_ & db_index_stored;
+        value = kth_db_make_value(sizeof(indexes), &indexes);
+
+        res = kth_db_put(db_txn, dbi_properties_, &key, &value, KTH_DB_NOOVERWRITE);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [create_db_mode_property] ", static_cast<int32_t>(res));
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+    }
+
     res = kth_db_txn_commit(db_txn);
     if (res != KTH_DB_SUCCESS) {
         return false;
@@ -84,6 +110,342 @@ bool internal_database_basis<Clock>::create_db_mode_property() {
     return true;
 }
 
+template <typename Clock>
+bool internal_database_basis<Clock>::create_db_version_property() {
+
+    KTH_DB_txn* db_txn;
+    auto res = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    property_code property_code_ = property_code::db_version;
+    uint32_t version = current_db_version;
+    auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    auto value = kth_db_make_value(sizeof(version), &version);
+
+    res = kth_db_put(db_txn, dbi_properties_, &key, &value, KTH_DB_NOOVERWRITE);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [create_db_version_property] ", static_cast<int32_t>(res));
+        kth_db_txn_abort(db_txn);
+        return false;
+    }
+
+    res = kth_db_txn_commit(db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    return true;
+}
+
+// Upgrades the DB one version at a time. Each step splits its work in several
+// transactions, the progress is saved with each one so an interrupted upgrade
+// is resumed on the next open.
+template <typename Clock>
+bool internal_database_basis<Clock>::upgrade_db_version(uint32_t version) {
+    LOG_INFO(LOG_DATABASE, "Upgrading the DB from version ", version, " to ", current_db_version, ", it may take a while.");
+
+    if (version < 1 && ! upgrade_utxo_encoding()) {
+        return false;
+    }
+
+    // block_db is filled by the version 4 upgrade.
+    if (version < 2 && ! upgrade_tx_index(2, block_db_name, block_tx_ids_flags, dbi_block_db_, nullptr)) {
+        return false;
+    }
+
+    // transaction_hash_db is filled by the version 6 upgrade.
+    if (version < 3 && ! upgrade_tx_index(3, transaction_hash_db_name, tx_hash_ids_flags, dbi_transaction_hash_db_, nullptr)) {
+        return false;
+    }
+
+    if (version < 4 && ! upgrade_tx_index(4, block_db_name, KTH_DB_INTEGERKEY, dbi_block_db_, &internal_database_basis::index_block_tx_range)) {
+        return false;
+    }
+
+    if (version < 5 && ! upgrade_history_layout()) {
+        return false;
+    }
+
+    if (version < 6 && ! upgrade_tx_index(6, transaction_hash_db_name, tx_hash_prefix_flags, dbi_transaction_hash_db_, &internal_database_basis::index_transaction_hash)) {
+        return false;
+    }
+
+    LOG_INFO(LOG_DATABASE, "DB upgraded to version ", current_db_version);
+    return true;
+}
+
+// Saves the version reached by an upgrade step and clears its progress.
+template <typename Clock>
+result_code internal_database_basis<Clock>::set_db_version(uint32_t version, KTH_DB_txn* db_txn) {
+    property_code version_code = property_code::db_version;
+    auto key = kth_db_make_value(sizeof(version_code), &version_code);
+    auto value = kth_db_make_value(sizeof(version), &version);
+    auto res = kth_db_put(db_txn, dbi_properties_, &key, &value, 0);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [set_db_version] ", static_cast<int32_t>(res));
+        return result_code::other;
+    }
+
+    property_code progress_code = property_code::db_upgrade_progress;
+    auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+    res = kth_db_del(db_txn, dbi_properties_, &progress_key, NULL);
+    if (res != KTH_DB_SUCCESS && res != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Failed deleting in DB Properties [set_db_version] ", static_cast<int32_t>(res));
+        return result_code::other;
+    }
+    return result_code::success;
+}
+
+// Version 0 to 1: rewrites the reorg pool and the UTXO set with the compact
+// utxo_entry encoding.
+template <typename Clock>
+bool internal_database_basis<Clock>::upgrade_utxo_encoding() {
+    constexpr size_t entries_per_txn = 100000;
+
+    LOG_INFO(LOG_DATABASE, "Rewriting the UTXO set with the compact encoding.");
+
+    property_code progress_code = property_code::db_upgrade_progress;
+    auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+
+    // progress: stage (0: reorg pool, 1: UTXO set) | last key rewritten
+    uint8_t stage = 0;
+    data_chunk last_key;
+    {
+        KTH_DB_txn* db_txn;
+        if (kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn) != KTH_DB_SUCCESS) {
+            return false;
+        }
+
+        KTH_DB_val value;
+        if (kth_db_get(db_txn, dbi_properties_, &progress_key, &value) == KTH_DB_SUCCESS) {
+            auto const progress = db_value_to_data_chunk(value);
+            if ( ! progress.empty()) {
+                stage = progress.front();
+                last_key.assign(progress.begin() + 1, progress.end());
+            }
+        }
+        kth_db_txn_commit(db_txn);
+    }
+
+    size_t rewritten = 0;
+    while (stage < 2) {
+        KTH_DB_txn* db_txn;
+        auto res = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [upgrade_utxo_encoding] ", res);
+            return false;
+        }
+
+        bool done;
+        auto const dbi = stage == 0 ? dbi_reorg_pool_ : dbi_utxo_;
+        if (upgrade_utxo_values(dbi, last_key, entries_per_txn, done, db_txn) != result_code::success) {
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        if (done) {
+            ++stage;
+            last_key.clear();
+        }
+
+        if (stage < 2) {
+            data_chunk progress {stage};
+            extend_data(progress, last_key);
+            auto value = kth_db_make_value(progress.size(), progress.data());
+            res = kth_db_put(db_txn, dbi_properties_, &progress_key, &value, 0);
+            if (res != KTH_DB_SUCCESS) {
+                LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [upgrade_utxo_encoding] ", static_cast<int32_t>(res));
+                kth_db_txn_abort(db_txn);
+                return false;
+            }
+        } else if (set_db_version(1, db_txn) != result_code::success) {
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        res = kth_db_txn_commit(db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [upgrade_utxo_encoding] ", res);
+            return false;
+        }
+
+        rewritten += entries_per_txn;
+        LOG_DEBUG(LOG_DATABASE, "DB upgrade, entries rewritten: ~", rewritten);
+    }
+
+    return true;
+}
+
+// Versions 2 and 4 (block_db) and 3 and 6 (transaction_hash_db): in full mode the
+// index is created again, with its new flags, and filled from transaction_db
+// unless write is null.
+// The progress stage is the target version, see stored_layout_version().
+template <typename Clock>
+bool internal_database_basis<Clock>::upgrade_tx_index(uint32_t version, char const* name, uint32_t flags, KTH_DB_dbi& dbi, tx_index_writer write) {
+    constexpr size_t entries_per_txn = 100000;
+
+    property_code progress_code = property_code::db_upgrade_progress;
+    auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+
+    // progress: stage | next tx id
+    tx_id_t next_id = 0;
+    bool started = false;
+    {
+        KTH_DB_txn* db_txn;
+        if (kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn) != KTH_DB_SUCCESS) {
+            return false;
+        }
+
+        KTH_DB_val value;
+        if (kth_db_get(db_txn, dbi_properties_, &progress_key, &value) == KTH_DB_SUCCESS
+            && kth_db_get_size(value) == 1 + sizeof(tx_id_t)
+            && *static_cast<uint8_t*>(kth_db_get_data(value)) == version) {
+            std::memcpy(&next_id, static_cast<uint8_t*>(kth_db_get_data(value)) + 1, sizeof(next_id));
+            started = true;
+        }
+        kth_db_txn_commit(db_txn);
+    }
+
+    if (db_mode_ == db_mode_type::full && write != nullptr) {
+        LOG_INFO(LOG_DATABASE, "Rebuilding the ", name, " index.");
+    }
+
+    while (true) {
+        KTH_DB_txn* db_txn;
+        auto res = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [upgrade_tx_index] ", res);
+            return false;
+        }
+
+        bool done = true;
+        if (db_mode_ == db_mode_type::full) {
+            if ( ! started) {
+                res = kth_db_drop(db_txn, dbi, 1);
+                if (res == KTH_DB_SUCCESS) {
+                    res = kth_db_dbi_open(db_txn, name, KTH_DB_CREATE | flags, &dbi);
+                }
+                if (res != KTH_DB_SUCCESS) {
+                    LOG_ERROR(LOG_DATABASE, "Error creating ", name, " again [upgrade_tx_index] ", res);
+                    kth_db_txn_abort(db_txn);
+                    return false;
+                }
+                started = true;
+            }
+
+            if (write != nullptr && rebuild_tx_index(next_id, entries_per_txn, done, write, db_txn) != result_code::success) {
+                kth_db_txn_abort(db_txn);
+                return false;
+            }
+        }
+
+        if ( ! done) {
+            uint8_t progress[1 + sizeof(tx_id_t)] = {uint8_t(version)};
+            std::memcpy(progress + 1, &next_id, sizeof(next_id));
+            auto value = kth_db_make_value(sizeof(progress), progress);
+            res = kth_db_put(db_txn, dbi_properties_, &progress_key, &value, 0);
+            if (res != KTH_DB_SUCCESS) {
+                LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [upgrade_tx_index] ", static_cast<int32_t>(res));
+                kth_db_txn_abort(db_txn);
+                return false;
+            }
+        } else if (set_db_version(version, db_txn) != result_code::success) {
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        res = kth_db_txn_commit(db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [upgrade_tx_index] ", res);
+            return false;
+        }
+
+        if (done) {
+            return true;
+        }
+        LOG_DEBUG(LOG_DATABASE, "DB upgrade, transactions indexed: ", next_id);
+    }
+}
+
+// Version 4 to 5: rewrites the history rows of every address with the
+// history_row layout (full mode).
+template <typename Clock>
+bool internal_database_basis<Clock>::upgrade_history_layout() {
+    constexpr size_t keys_per_txn = 10000;
+    constexpr uint8_t stage = 5;
+
+    property_code progress_code = property_code::db_upgrade_progress;
+    auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+
+    // progress: stage | last address rewritten
+    data_chunk last_key;
+    {
+        KTH_DB_txn* db_txn;
+        if (kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn) != KTH_DB_SUCCESS) {
+            return false;
+        }
+
+        KTH_DB_val value;
+        if (kth_db_get(db_txn, dbi_properties_, &progress_key, &value) == KTH_DB_SUCCESS
+            && kth_db_get_size(value) == 1 + short_hash_size
+            && *static_cast<uint8_t*>(kth_db_get_data(value)) == stage) {
+            auto const progress = db_value_to_data_chunk(value);
+            last_key.assign(progress.begin() + 1, progress.end());
+        }
+        kth_db_txn_commit(db_txn);
+    }
+
+    if (db_mode_ == db_mode_type::full) {
+        LOG_INFO(LOG_DATABASE, "Rewriting the history rows.");
+    }
+
+    size_t rewritten = 0;
+    while (true) {
+        KTH_DB_txn* db_txn;
+        auto res = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [upgrade_history_layout] ", res);
+            return false;
+        }
+
+        bool done = true;
+        if (db_mode_ == db_mode_type::full && upgrade_history_values(last_key, keys_per_txn, done, db_txn) != result_code::success) {
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        if ( ! done) {
+            data_chunk progress {stage};
+            extend_data(progress, last_key);
+            auto value = kth_db_make_value(progress.size(), progress.data());
+            res = kth_db_put(db_txn, dbi_properties_, &progress_key, &value, 0);
+            if (res != KTH_DB_SUCCESS) {
+                LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [upgrade_history_layout] ", static_cast<int32_t>(res));
+                kth_db_txn_abort(db_txn);
+                return false;
+            }
+        } else if (set_db_version(5, db_txn) != result_code::success) {
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        res = kth_db_txn_commit(db_txn);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [upgrade_history_layout] ", res);
+            return false;
+        }
+
+        if (done) {
+            return true;
+        }
+
+        rewritten += keys_per_txn;
+        LOG_DEBUG(LOG_DATABASE, "DB upgrade, addresses rewritten: ~", rewritten);
+    }
+}
+
 #endif // ! defined(KTH_DB_READONLY)
 
 
@@ -100,6 +462,23 @@ bool internal_database_basis<Clock>::open() {
         return false;
     }
 
+    ret = verify_db_version_property();
+    if ( ! ret ) {
+        return false;
+    }
+
+    ret = verify_utxo_cache_property();
+    if ( ! ret ) {
+        return false;
+    }
+
+#if ! defined(KTH_DB_READONLY)
+    ret = load_counters();
+    if ( ! ret ) {
+        return false;
+    }
+#endif
+
     return true;
 }
 
@@ -107,6 +486,12 @@ bool internal_database_basis<Clock>::open() {
 template <typename Clock>
 bool internal_database_basis<Clock>::open_internal() {
 
+    // The background indexer finds the spent outputs through transaction_hash_db.
+    if (has_index(db_index_deferred) && has_index(db_index_history) && ! has_index(db_index_transaction_hash)) {
+        LOG_ERROR(LOG_DATABASE, "The history index can not be built in the background without the transaction hash index.");
+        return false;
+    }
+
     if ( ! create_and_open_environment()) {
         LOG_ERROR(LOG_DATABASE, "Error configuring LMDB environment.");
         return false;
@@ -138,6 +523,20 @@ bool internal_database_basis<Clock>::verify_db_mode_property() const {
 
     auto const db_mode_db = *static_cast<db_mode_type*>(kth_db_get_data(value));
 
+    auto indexes_db = db_index_all;
+    if (db_mode_db == db_mode_type::full) {
+        property_code_ = property_code::db_indexes;
+        key = kth_db_make_value(sizeof(property_code_), &property_code_);
+        res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+        if (res == KTH_DB_SUCCESS) {
+            std::memcpy(&indexes_db, kth_db_get_data(value), sizeof(indexes_db));
+        } else if (res != KTH_DB_NOTFOUND) {
+            LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [verify_db_mode_property] ", static_cast<int32_t>(res));
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+    }
+
     res = kth_db_txn_commit(db_txn);
     if (res != KTH_DB_SUCCESS) {
         return false;
@@ -151,12 +550,370 @@ bool internal_database_basis<Clock>::verify_db_mode_property() const {
         return false;
     }
 
+    // A disabled index would be left incomplete, an enabled one would be missing
+    // the rows of the blocks already in the DB.
+    // Building them in the background or in push_block() can be switched.
+    if (db_mode_ == db_mode_type::full && (indexes_ & db_index_stored) != indexes_db) {
+        LOG_ERROR(LOG_DATABASE, "Error validating DB Indexes, the DB was created with other indexes. Node DB Indexes: "
+           , indexes_ & db_index_stored
+           , ", Actual DB Indexes: "
+           , indexes_db);
+        return false;
+    }
+
+    return true;
+}
+
+// DBs created before the db_version property have version 0.
+template <typename Clock>
+bool internal_database_basis<Clock>::verify_db_version_property() {
+
+    KTH_DB_txn* db_txn;
+    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    property_code property_code_ = property_code::db_version;
+
+    auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    KTH_DB_val value;
+
+    uint32_t version = 0;
+    res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+    if (res == KTH_DB_SUCCESS) {
+        version = *static_cast<uint32_t*>(kth_db_get_data(value));
+    } else if (res != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [verify_db_version_property] ", static_cast<int32_t>(res));
+        kth_db_txn_abort(db_txn);
+        return false;
+    }
+
+    res = kth_db_txn_commit(db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    if (version == current_db_version) {
+        return true;
+    }
+
+    if (version > current_db_version) {
+        LOG_ERROR(LOG_DATABASE, "Error validating DB Version, the DB was created by a newer version of the node. Node DB Version: "
+           , current_db_version
+           , ", Actual DB Version: "
+           , version);
+        return false;
+    }
+
+#if defined(KTH_DB_READONLY)
+    LOG_ERROR(LOG_DATABASE, "The DB has to be upgraded from version ", version, " to ", current_db_version, ", open it with a read-write node first.");
+    return false;
+#else
+    return upgrade_db_version(version);
+#endif
+}
+
+// Version of the index layout stored in the DB, it can be ahead of the
+// db_version property while an upgrade that recreates an index is running.
+// The DB being created has the current layout.
+template <typename Clock>
+uint32_t internal_database_basis<Clock>::stored_layout_version(KTH_DB_txn* db_txn) const {
+    property_code version_code = property_code::db_version;
+    auto version_key = kth_db_make_value(sizeof(version_code), &version_code);
+    KTH_DB_val value;
+
+    uint32_t version = 0;
+    if (kth_db_get(db_txn, dbi_properties_, &version_key, &value) == KTH_DB_SUCCESS) {
+        std::memcpy(&version, kth_db_get_data(value), sizeof(version));
+    } else {
+        // Neither the version nor the mode: the DB is being created.
+        property_code mode_code = property_code::db_mode;
+        auto mode_key = kth_db_make_value(sizeof(mode_code), &mode_code);
+        if (kth_db_get(db_txn, dbi_properties_, &mode_key, &value) != KTH_DB_SUCCESS) {
+            return current_db_version;
+        }
+    }
+
+    // upgrade_tx_index() stage: the index of that version was already created.
+    property_code progress_code = property_code::db_upgrade_progress;
+    auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+    if (kth_db_get(db_txn, dbi_properties_, &progress_key, &value) == KTH_DB_SUCCESS
+        && kth_db_get_size(value) == 1 + sizeof(tx_id_t)) {
+        version = std::max(version, uint32_t(*static_cast<uint8_t*>(kth_db_get_data(value))));
+    }
+    return version;
+}
+
+// The UTXO cache was not flushed on shutdown, the UTXO set stored in the DB is
+// missing the cached outputs. They are restored from the stored blocks.
+template <typename Clock>
+bool internal_database_basis<Clock>::verify_utxo_cache_property() {
+
+    KTH_DB_txn* db_txn;
+    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    property_code property_code_ = property_code::utxo_cache_dirty;
+
+    auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    KTH_DB_val value;
+
+    res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+    if (res == KTH_DB_NOTFOUND) {
+        kth_db_txn_commit(db_txn);
+        return true;
+    }
+
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [verify_utxo_cache_property] ", static_cast<int32_t>(res));
+        kth_db_txn_abort(db_txn);
+        return false;
+    }
+
+    auto const dirty = *static_cast<uint8_t*>(kth_db_get_data(value)) != 0;
+
+    // Stored with every commit of a non-empty cache, all the blocks are replayed without it.
+    uint32_t from = 0;
+    property_code_ = property_code::utxo_cache_from;
+    key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+    if (res == KTH_DB_SUCCESS) {
+        std::memcpy(&from, kth_db_get_data(value), sizeof(from));
+    } else if (res != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [verify_utxo_cache_property] ", static_cast<int32_t>(res));
+        kth_db_txn_abort(db_txn);
+        return false;
+    }
+
+    res = kth_db_txn_commit(db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    if ( ! dirty) {
+        return true;
+    }
+
+#if defined(KTH_DB_READONLY)
+    LOG_ERROR(LOG_DATABASE, "The UTXO cache was not flushed to the DB, the UTXO set is incomplete. The node was not closed properly, open the DB for writing to recover it.");
+    return false;
+#else
+    if (db_mode_ == db_mode_type::pruned) {
+        LOG_ERROR(LOG_DATABASE, "The UTXO cache was not flushed to the DB, the UTXO set is incomplete. The node was not closed properly, the DB has to be rebuilt.");
+        return false;
+    }
+
+    LOG_INFO(LOG_DATABASE, "The UTXO cache was not flushed to the DB, the node was not closed properly. Restoring the UTXO set from block ", from);
+    return recover_utxo_set(from);
+#endif
+}
+
+#if ! defined(KTH_DB_READONLY)
+
+template <typename Clock>
+bool internal_database_basis<Clock>::recover_utxo_set(uint32_t from) {
+    KTH_DB_txn* db_txn;
+    auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+    if (res0 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [recover_utxo_set] ", res0);
+        return false;
+    }
+
+    // The stored property is cleared, the cache is empty.
+    utxo_cache_dirty_ = true;
+    auto res = recover_utxo_set(from, db_txn);
+    if (res == result_code::success) {
+        res = update_utxo_cache_property(db_txn);
+    }
+
+    if (res != result_code::success) {
+        kth_db_txn_abort(db_txn);
+        return false;
+    }
+
+    auto res2 = kth_db_txn_commit(db_txn);
+    if (res2 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [recover_utxo_set] ", res2);
+        return false;
+    }
+
+    utxo_cache_dirty_ = false;
     return true;
 }
 
+// Every output of the blocks below from is in dbi_utxo_ or spent, the outputs
+// of the blocks from it on are inserted unless a later block spends them.
+// The ones flushed before the cache was lost are already there.
+template <typename Clock>
+result_code internal_database_basis<Clock>::recover_utxo_set(uint32_t from, KTH_DB_txn* db_txn) {
+    uint32_t last;
+    auto res = get_last_height(last, db_txn);
+    if (res == result_code::db_empty) {
+        return result_code::success;
+    }
+    if (res != result_code::success) {
+        return res;
+    }
+
+    std::unordered_set<domain::chain::point> spent;
+    for (auto height = from; height <= last; ++height) {
+        auto const block = get_block(height, db_txn);
+        if ( ! block.is_valid()) {
+            LOG_ERROR(LOG_DATABASE, "Error reading block ", height, " [recover_utxo_set]");
+            return result_code::other;
+        }
+        auto const& txs = block.transactions();
+        for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+            for (auto const& input : it->inputs()) {
+                spent.insert(input.previous_output());
+            }
+        }
+    }
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_utxo_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    size_t restored = 0;
+    for (auto height = from; height <= last; ++height) {
+        auto const block = get_block(height, db_txn);
+        auto const median_time_past = get_median_time_past(height, db_txn);
+        auto const fixed_coinbase = utxo_entry::to_data_fixed(height, median_time_past, true);
+        auto const fixed = utxo_entry::to_data_fixed(height, median_time_past, false);
+
+        auto const& txs = block.transactions();
+        for (size_t position = 0; position < txs.size(); ++position) {
+            auto const hash = txs[position].hash();
+            uint32_t index = 0;
+            for (auto const& output : txs[position].outputs()) {
+                domain::chain::output_point const point {hash, index++};
+                if (spent.count(point) != 0) {
+                    continue;
+                }
+
+                auto const keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);
+                auto const valuearr = utxo_entry::to_data_with_fixed(output, position == 0 ? fixed_coinbase : fixed);
+                auto key = kth_db_make_value(keyarr.size(), const_cast<uint8_t*>(keyarr.data()));
+                auto value = kth_db_make_value(valuearr.size(), const_cast<uint8_t*>(valuearr.data()));
+
+                auto rc = kth_db_cursor_put(cursor, &key, &value, KTH_DB_NOOVERWRITE);
+                if (rc == KTH_DB_KEYEXIST) {
+                    continue;
+                }
+                if (rc != KTH_DB_SUCCESS) {
+                    LOG_ERROR(LOG_DATABASE, "Error restoring UTXO [recover_utxo_set] ", rc);
+                    kth_db_cursor_close(cursor);
+                    return result_code::other;
+                }
+                ++restored;
+            }
+        }
+    }
+
+    kth_db_cursor_close(cursor);
+    LOG_INFO(LOG_DATABASE, "UTXO set restored, ", restored, " outputs of the blocks ", from, " to ", last);
+    return result_code::success;
+}
+
+#endif // ! defined(KTH_DB_READONLY)
+
+#if ! defined(KTH_DB_READONLY)
+
+// Databases written before the counters were stored count their rows once.
+template <typename Clock>
+bool internal_database_basis<Clock>::load_counters() {
+    counters_ = table_counters{};
+    committed_counters_ = counters_;
+
+    if (db_mode_ != db_mode_type::full) {
+        return true;
+    }
+
+    KTH_DB_txn* db_txn;
+    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+    std::tuple<property_code, KTH_DB_dbi, uint64_t&> const counters[] = {
+        {property_code::tx_count, dbi_transaction_db_, counters_.txs},
+        {property_code::history_count, dbi_history_db_, counters_.history},
+        {property_code::indexed_height, dbi_block_db_, counters_.indexed},
+    };
+
+    for (auto const& [code, dbi, counter] : counters) {
+        auto property_code_ = code;
+        auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+        KTH_DB_val value;
+
+        res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+        if (res == KTH_DB_SUCCESS && kth_db_get_size(value) == sizeof(uint64_t)) {
+            std::memcpy(&counter, kth_db_get_data(value), sizeof(uint64_t));
+            continue;
+        }
+
+        if (res != KTH_DB_SUCCESS && res != KTH_DB_NOTFOUND) {
+            LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [load_counters] ", static_cast<int32_t>(res));
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+
+        res = kth_db_entries(db_txn, dbi, counter);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Failed counting the DB entries [load_counters] ", static_cast<int32_t>(res));
+            kth_db_txn_abort(db_txn);
+            return false;
+        }
+    }
+
+    kth_db_txn_abort(db_txn);
+    committed_counters_ = counters_;
+    return true;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::save_counters(KTH_DB_txn* db_txn) {
+    if (db_mode_ != db_mode_type::full) {
+        return result_code::success;
+    }
+
+    std::pair<property_code, uint64_t> const counters[] = {
+        {property_code::tx_count, counters_.txs},
+        {property_code::history_count, counters_.history},
+        {property_code::indexed_height, counters_.indexed},
+    };
+
+    for (auto [property_code_, counter] : counters) {
+        auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+        auto value = kth_db_make_value(sizeof(counter), &counter);
+
+        auto res = kth_db_put(db_txn, dbi_properties_, &key, &value, 0);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [save_counters] ", static_cast<int32_t>(res));
+            return result_code::other;
+        }
+    }
+    return result_code::success;
+}
+
+#endif // ! defined(KTH_DB_READONLY)
+
 template <typename Clock>
 bool internal_database_basis<Clock>::close() {
     if (db_opened_) {
+#if ! defined(KTH_DB_READONLY)
+        if (end_batch() != result_code::success) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting the batch [close]");
+        }
+
+        if ( ! flush_utxo_cache()) {
+            LOG_ERROR(LOG_DATABASE, "Error flushing the UTXO cache [close]");
+        }
+#endif
 
         //TODO(fernando): check sync
         //Force synchronous flush (use with KTH_DB_NOSYNC or MDB_NOMETASYNC, with other flags do nothing)
@@ -188,6 +945,8 @@ bool internal_database_basis<Clock>::close() {
     }
 
     if (env_created_) {
+        LOG_INFO(LOG_DATABASE, "Read transactions: peak of ", read_txns_.peak_readers(), " reader slots in use, ", read_txns_.max_readers(), " available.");
+        read_txns_.close();
         kth_db_env_close(env_);
         env_created_ = false;
     }
@@ -199,6 +958,7 @@ bool internal_database_basis<Clock>::close() {
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::push_genesis(domain::chain::block const& block) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
     KTH_DB_txn* db_txn;
     auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
@@ -209,13 +969,16 @@ result_code internal_database_basis<Clock>::push_genesis(domain::chain::block co
     auto res = push_genesis(block, db_txn);
     if ( !  succeed(res)) {
         kth_db_txn_abort(db_txn);
+        counters_ = committed_counters_;
         return res;
     }
 
     auto res2 = kth_db_txn_commit(db_txn);
     if (res2 != KTH_DB_SUCCESS) {
+        counters_ = committed_counters_;
         return result_code::other;
     }
+    committed_counters_ = counters_;
     return res;
 }
 
@@ -224,28 +987,104 @@ result_code internal_database_basis<Clock>::push_genesis(domain::chain::block co
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::push_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past) {
+    return push_block(prepare_block(block, height, median_time_past, workers_.size() + 1));
+}
 
-    KTH_DB_txn* db_txn;
-    auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
-    if (res0 != KTH_DB_SUCCESS) {
-        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [push_block] ", res0);
-        return result_code::other;
+template <typename Clock>
+result_code internal_database_basis<Clock>::push_block(prepared_block const& block) {
+
+    if (batch_owned()) {
+        return push_block_batched(block);
     }
 
-    //TODO: save reorg blocks after the last checkpoint
-    auto res = push_block(block, height, median_time_past, ! is_old_block(block), db_txn);
-    if ( !  succeed(res)) {
-        kth_db_txn_abort(db_txn);
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    auto const needed = map_space_needed(block.serialized_size);
+    ensure_map_space(needed);
+
+    // A block that does not fit in the map is retried once the map is grown.
+    bool retried = false;
+    while (true) {
+        KTH_DB_txn* db_txn;
+        auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+        if (res0 != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [push_block] ", res0);
+            return result_code::other;
+        }
+
+        auto res = push_block_cached(block, db_txn);
+        if ( !  succeed(res)) {
+            kth_db_txn_abort(db_txn);
+            utxo_cache_.rollback();
+            counters_ = committed_counters_;
+            if (res == result_code::other && ! retried && map_nearly_full(needed) && grow_map(needed)) {
+                retried = true;
+                continue;
+            }
+            return res;
+        }
+
+        auto res2 = kth_db_txn_commit(db_txn);
+        if (res2 != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [push_block] ", res2);
+            utxo_cache_.rollback();
+            counters_ = committed_counters_;
+            if (res2 == KTH_DB_MAP_FULL && ! retried && grow_map(needed)) {
+                retried = true;
+                continue;
+            }
+            return result_code::other;
+        }
+
+        utxo_cache_.commit();
+        utxo_cache_dirty_ = utxo_cache_.size() != 0;
+        committed_counters_ = counters_;
         return res;
     }
+}
 
-    auto res2 = kth_db_txn_commit(db_txn);
-    if (res2 != KTH_DB_SUCCESS) {
-        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [push_block] ", res2);
-        return result_code::other;
+template <typename Clock>
+bool internal_database_basis<Clock>::begin_batch() {
+    if (batch_max_blocks_ <= 1 && batch_max_bytes_ == 0) {
+        return false;
     }
 
-    return res;
+    if (batch_owned()) {
+        return true;
+    }
+
+    // A batch of another thread is waited for.
+    write_mutex_.lock();
+    discarded_blocks_ = 0;
+    ensure_map_space(map_space_needed(batch_max_bytes_));
+
+    auto res = kth_db_txn_begin(env_, NULL, 0, &batch_txn_);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [begin_batch] ", res);
+        batch_txn_ = nullptr;
+        write_mutex_.unlock();
+        return false;
+    }
+
+    batch_owner_ = std::this_thread::get_id();
+    batch_utxo_cache_dirty_ = utxo_cache_dirty_;
+    batch_blocks_ = 0;
+    batch_bytes_ = 0;
+    batch_start_ = std::chrono::steady_clock::now();
+    return true;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::end_batch() {
+    if ( ! batch_owned()) {
+        return result_code::success;
+    }
+    return commit_batch();
+}
+
+template <typename Clock>
+uint32_t internal_database_basis<Clock>::discarded_blocks() const {
+    return discarded_blocks_;
 }
 
 #endif // ! defined(KTH_DB_READONLY)
@@ -254,6 +1093,13 @@ result_code internal_database_basis<Clock>::push_block(domain::chain::block cons
 template <typename Clock>
 utxo_entry internal_database_basis<Clock>::get_utxo(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const {
 
+    if (utxo_cache_.enabled()) {
+        auto cached = utxo_cache_.find(point);
+        if (cached) {
+            return domain::create_old<utxo_entry>(*cached);
+        }
+    }
+
     auto keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);
     auto key = kth_db_make_value(keyarr.size(), keyarr.data());
     KTH_DB_val value;
@@ -269,41 +1115,172 @@ utxo_entry internal_database_basis<Clock>::get_utxo(domain::chain::output_point
 template <typename Clock>
 utxo_entry internal_database_basis<Clock>::get_utxo(domain::chain::output_point const& point) const {
 
-    KTH_DB_txn* db_txn;
-    auto res0 = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res0 != KTH_DB_SUCCESS) {
-        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [get_utxo] ", res0);
+    if (utxo_cache_.enabled()) {
+        auto cached = utxo_cache_.find(point);
+        if (cached) {
+            return domain::create_old<utxo_entry>(*cached);
+        }
+    }
+
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
     auto ret = get_utxo(point, db_txn);
 
-    res0 = kth_db_txn_commit(db_txn);
-    if (res0 != KTH_DB_SUCCESS) {
-        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [get_utxo] ", res0);
-        return {};
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+KTH_DB_txn* internal_database_basis<Clock>::begin_read() const {
+    return read_txns_.acquire();
+}
+
+template <typename Clock>
+void internal_database_basis<Clock>::end_read(KTH_DB_txn* db_txn) const {
+    read_txns_.release(db_txn);
+}
+
+template <typename Clock>
+read_txn_pool const& internal_database_basis<Clock>::read_txns() const {
+    return read_txns_;
+}
+
+template <typename Clock>
+utxo_view internal_database_basis<Clock>::get_utxo_view(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const {
+
+    if (utxo_cache_.enabled()) {
+        auto cached = utxo_cache_.find(point);
+        if (cached) {
+            return utxo_view::from_data(std::move(*cached));
+        }
+    }
+
+    auto keyarr = to_utxo_key(point);
+    auto key = kth_db_make_value(keyarr.size(), keyarr.data());
+    KTH_DB_val value;
+
+    auto res0 = kth_db_get(db_txn, dbi_utxo_, &key, &value);
+    if (res0 != KTH_DB_SUCCESS) {
+        return {};
+    }
+
+    return utxo_view::from_data(utxo_view::bytes_t{static_cast<uint8_t const*>(kth_db_get_data(value)), kth_db_get_size(value)});
+}
+
+template <typename Clock>
+std::optional<std::vector<utxo_entry>> internal_database_basis<Clock>::get_utxos(std::span<domain::chain::output_point const> points, size_t threads) const {
+    // Below this size per thread the extra read transactions do not pay off.
+    constexpr size_t min_lookups_per_thread = 1024;
+
+    std::vector<utxo_entry> res(points.size());
+
+    std::vector<utxo_lookup_t> lookups;
+    lookups.reserve(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (utxo_cache_.enabled()) {
+            auto cached = utxo_cache_.find(points[i]);
+            if (cached) {
+                res[i] = domain::create_old<utxo_entry>(*cached);
+                continue;
+            }
+        }
+        lookups.emplace_back(points[i].to_data(KTH_INTERNAL_DB_WIRE), i);
+    }
+
+    std::sort(lookups.begin(), lookups.end(), [](auto const& a, auto const& b) {
+        return a.first < b.first;
+    });
+
+    auto const first = lookups.data();
+    auto const last = first + lookups.size();
+
+    threads = std::max<size_t>(1, std::min({threads, workers_.size() + 1, lookups.size() / min_lookups_per_thread}));
+    if (threads == 1) {
+        if ( ! get_utxos(first, last, res)) {
+            return std::nullopt;
+        }
+        return res;
+    }
+
+    // Threads write disjoint positions of res.
+    auto const chunk = (lookups.size() + threads - 1) / threads;
+    std::vector<std::future<bool>> workers;
+    workers.reserve(threads - 1);
+    for (size_t from = chunk; from < lookups.size(); from += chunk) {
+        auto const to = std::min(from + chunk, lookups.size());
+        workers.push_back(workers_.submit([this, from, to, first, &res] {
+            return get_utxos(first + from, first + to, res);
+        }));
+    }
+
+    // Every worker is waited for, they write to res.
+    auto done = get_utxos(first, first + chunk, res);
+    for (auto& worker : workers) {
+        done = worker.get() && done;
+    }
+
+    if ( ! done) {
+        LOG_ERROR(LOG_DATABASE, "Error looking up UTXOs [get_utxos]");
+        return std::nullopt;
+    }
+    return res;
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::get_utxos(utxo_lookup_t const* first, utxo_lookup_t const* last, std::vector<utxo_entry>& out) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return false;
+    }
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_utxo_, &cursor) != KTH_DB_SUCCESS) {
+        read_txns_.release(db_txn);
+        return false;
+    }
+
+    for (auto it = first; it != last; ++it) {
+        auto key = kth_db_make_value(it->first.size(), const_cast<uint8_t*>(it->first.data()));
+        KTH_DB_val value;
+        if (kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET) == KTH_DB_SUCCESS) {
+            out[it->second] = domain::create_old<utxo_entry>(db_value_to_data_chunk(value));
+        }
     }
 
-    return ret;
+    kth_db_cursor_close(cursor);
+    read_txns_.release(db_txn);
+    return true;
 }
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::get_last_height(uint32_t& out_height) const {
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return result_code::other;
     }
 
+    auto ret = get_last_height(out_height, db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::get_last_height(uint32_t& out_height, KTH_DB_txn* db_txn) const {
     KTH_DB_cursor* cursor;
     if (kth_db_cursor_open(db_txn, dbi_block_header_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
         return result_code::other;
     }
 
     KTH_DB_val key;
     int rc;
     if ((rc = kth_db_cursor_get(cursor, &key, nullptr, KTH_DB_LAST)) != KTH_DB_SUCCESS) {
+        kth_db_cursor_close(cursor);
         return result_code::db_empty;
     }
 
@@ -311,29 +1288,106 @@ result_code internal_database_basis<Clock>::get_last_height(uint32_t& out_height
     out_height = *static_cast<uint32_t*>(kth_db_get_data(key));
 
     kth_db_cursor_close(cursor);
+    return result_code::success;
+}
 
-    // kth_db_txn_abort(db_txn);
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
+template <typename Clock>
+result_code internal_database_basis<Clock>::get_indexed_height(uint32_t& out_height) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return result_code::other;
+    }
+
+    auto ret = get_indexed_height(out_height, db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+// DBs written before the indexed_height property have every block indexed.
+template <typename Clock>
+result_code internal_database_basis<Clock>::get_indexed_height(uint32_t& out_height, KTH_DB_txn* db_txn) const {
+    auto property_code_ = property_code::indexed_height;
+    auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    KTH_DB_val value;
+
+    auto res = kth_db_get(db_txn, dbi_properties_, &key, &value);
+    if (res == KTH_DB_SUCCESS && kth_db_get_size(value) == sizeof(uint64_t)) {
+        uint64_t indexed;
+        std::memcpy(&indexed, kth_db_get_data(value), sizeof(indexed));
+        out_height = uint32_t(indexed);
+        return result_code::success;
+    }
+
+    if (res != KTH_DB_SUCCESS && res != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Failed getting DB Properties [get_indexed_height] ", static_cast<int32_t>(res));
         return result_code::other;
     }
 
+    uint32_t last_height;
+    auto ret = get_last_height(last_height, db_txn);
+    if (ret == result_code::db_empty) {
+        out_height = 0;
+        return result_code::success;
+    }
+    if (ret != result_code::success) {
+        return ret;
+    }
+
+    out_height = last_height + 1;
     return result_code::success;
 }
 
 template <typename Clock>
-std::pair<domain::chain::header, uint32_t> internal_database_basis<Clock>::get_header(hash_digest const& hash) const {
-    auto key  = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
+bool internal_database_basis<Clock>::is_index_complete() const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return false;
+    }
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto ret = is_index_complete(db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::is_index_complete(KTH_DB_txn* db_txn) const {
+    uint32_t indexed_height;
+    if (get_indexed_height(indexed_height, db_txn) != result_code::success) {
+        return false;
+    }
+
+    uint32_t last_height;
+    auto ret = get_last_height(last_height, db_txn);
+    if (ret == result_code::db_empty) {
+        return true;
+    }
+    return ret == result_code::success && indexed_height > last_height;
+}
+
+template <typename Clock>
+std::pair<domain::chain::header, uint32_t> internal_database_basis<Clock>::get_header(hash_digest const& hash) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
+    auto ret = get_header(hash, db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+std::pair<domain::chain::header, uint32_t> internal_database_basis<Clock>::get_header(hash_digest const& hash, KTH_DB_txn* db_txn) const {
+    auto key  = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
+
     KTH_DB_val value;
     if (kth_db_get(db_txn, dbi_block_header_by_hash_, &key, &value) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
-        // kth_db_txn_abort(db_txn);
         return {};
     }
 
@@ -341,62 +1395,56 @@ std::pair<domain::chain::header, uint32_t> internal_database_basis<Clock>::get_h
     auto height = *static_cast<uint32_t*>(kth_db_get_data(value));
 
     auto header = get_header(height, db_txn);
-
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
-
     return {header, height};
 }
 
 template <typename Clock>
 domain::chain::header internal_database_basis<Clock>::get_header(uint32_t height) const {
-    KTH_DB_txn* db_txn;
-    auto ret1 = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (ret1 != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
     auto ret2 = get_header(height, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
+    read_txns_.release(db_txn);
 
     return ret2;
 }
 
 template <typename Clock>
 std::optional<header_with_abla_state_t> internal_database_basis<Clock>::get_header_and_abla_state(uint32_t height) const {
-    KTH_DB_txn* db_txn;
-    auto zzz = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (zzz != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
     auto res = get_header_and_abla_state(height, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
+    read_txns_.release(db_txn);
 
     return res;
 }
 
 template <typename Clock>
 domain::chain::header::list internal_database_basis<Clock>::get_headers(uint32_t from, uint32_t to) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {};
+    }
+
+    auto list = get_headers(from, to, db_txn);
+    read_txns_.release(db_txn);
+    return list;
+}
+
+template <typename Clock>
+domain::chain::header::list internal_database_basis<Clock>::get_headers(uint32_t from, uint32_t to, KTH_DB_txn* db_txn) const {
     // precondition: from <= to
     domain::chain::header::list list;
 
-    KTH_DB_txn* db_txn;
-    auto zzz = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (zzz != KTH_DB_SUCCESS) {
-        return list;
-    }
-
     KTH_DB_cursor* cursor;
     if (kth_db_cursor_open(db_txn, dbi_block_header_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
         return list;
     }
 
@@ -406,7 +1454,6 @@ domain::chain::header::list internal_database_basis<Clock>::get_headers(uint32_t
     int rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET);
     if (rc != KTH_DB_SUCCESS) {
         kth_db_cursor_close(cursor);
-        kth_db_txn_commit(db_txn);
         return list;
     }
 
@@ -421,7 +1468,6 @@ domain::chain::header::list internal_database_basis<Clock>::get_headers(uint32_t
     }
 
     kth_db_cursor_close(cursor);
-    kth_db_txn_commit(db_txn);
     return list;
 }
 
@@ -477,6 +1523,8 @@ result_code internal_database_basis<Clock>::prune() {
     auto amount_to_delete = reorg_count - reorg_pool_limit_;
     auto remove_until = first_height + amount_to_delete;
 
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
     KTH_DB_txn* db_txn;
     auto zzz = kth_db_txn_begin(env_, NULL, 0, &db_txn);
     if (zzz != KTH_DB_SUCCESS) {
@@ -534,18 +1582,25 @@ result_code internal_database_basis<Clock>::insert_reorg_into_pool(utxo_pool_t&
 
 template <typename Clock>
 std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_pool_from(uint32_t from, uint32_t to) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {result_code::other, {}};
+    }
+
+    auto ret = get_utxo_pool_from(from, to, db_txn);
+
+    read_txns_.release(db_txn);
+
+    return ret;
+}
+
+template <typename Clock>
+std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_pool_from(uint32_t from, uint32_t to, KTH_DB_txn* db_txn) const {
     // precondition: from <= to
     utxo_pool_t pool;
 
-    KTH_DB_txn* db_txn;
-    auto zzz = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (zzz != KTH_DB_SUCCESS) {
-        return {result_code::other, pool};
-    }
-
     KTH_DB_cursor* cursor;
     if (kth_db_cursor_open(db_txn, dbi_reorg_index_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
         return {result_code::other, pool};
     }
 
@@ -556,14 +1611,12 @@ std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_poo
     int rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET_RANGE);
     if (rc != KTH_DB_SUCCESS) {
         kth_db_cursor_close(cursor);
-        kth_db_txn_commit(db_txn);
         return {result_code::key_not_found, pool};
     }
 
     auto current_height = *static_cast<uint32_t*>(kth_db_get_data(key));
     if (current_height < from) {
         kth_db_cursor_close(cursor);
-        kth_db_txn_commit(db_txn);
         return {result_code::other, pool};
     }
     // if (current_height > from) {
@@ -573,14 +1626,12 @@ std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_poo
     // }
     if (current_height > to) {
         kth_db_cursor_close(cursor);
-        kth_db_txn_commit(db_txn);
         return {result_code::other, pool};
     }
 
     auto res = insert_reorg_into_pool(pool, value, db_txn);
     if (res != result_code::success) {
         kth_db_cursor_close(cursor);
-        kth_db_txn_commit(db_txn);
         return {res, pool};
     }
 
@@ -588,24 +1639,17 @@ std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_poo
         current_height = *static_cast<uint32_t*>(kth_db_get_data(key));
         if (current_height > to) {
             kth_db_cursor_close(cursor);
-            kth_db_txn_commit(db_txn);
-            return {result_code::other, pool};
+                return {result_code::other, pool};
         }
 
         res = insert_reorg_into_pool(pool, value, db_txn);
         if (res != result_code::success) {
             kth_db_cursor_close(cursor);
-            kth_db_txn_commit(db_txn);
-            return {res, pool};
+                return {res, pool};
         }
     }
 
     kth_db_cursor_close(cursor);
-
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {result_code::other, pool};
-    }
-
     return {result_code::success, pool};
 }
 
@@ -613,6 +1657,7 @@ std::pair<result_code, utxo_pool_t> internal_database_basis<Clock>::get_utxo_poo
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::push_transaction_unconfirmed(domain::chain::transaction const& tx, uint32_t height) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
 
     KTH_DB_txn* db_txn;
     if (kth_db_txn_begin(env_, NULL, 0, &db_txn) != KTH_DB_SUCCESS) {
@@ -667,16 +1712,9 @@ bool internal_database_basis<Clock>::create_and_open_environment() {
     }
     env_created_ = true;
 
-    // TODO(fernando): see what to do with mdb_env_set_maxreaders ----------------------------------------------
-    // int threads = tools::get_max_concurrency();
-    // if (threads > 110 &&	/* maxreaders default is 126, leave some slots for other read processes */
-    //     (result = mdb_env_set_maxreaders(m_env, threads+16)))
-    //     throw0(DB_ERROR(lmdb_error("Failed to set max number of readers: ", result).c_str()));
-    // ----------------------------------------------------------------------------------------------------------------
-
-    auto res = kth_db_env_set_mapsize(env_, adjust_db_size(db_max_size_));
+    auto res = kth_db_env_set_maxreaders(env_, get_max_readers());
     if (res != KTH_DB_SUCCESS) {
-        LOG_ERROR(LOG_DATABASE, "Error setting max memory map size. Verify do you have enough free space. [create_and_open_environment] ", static_cast<int32_t>(res));
+        LOG_ERROR(LOG_DATABASE, "Error setting the number of readers [create_and_open_environment] ", static_cast<int32_t>(res));
         return false;
     }
 
@@ -710,7 +1748,167 @@ bool internal_database_basis<Clock>::create_and_open_environment() {
     }
 
     res = kth_db_env_open(env_, db_dir_.string().c_str(), mdb_flags, env_open_mode_);
-    return res == KTH_DB_SUCCESS;
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+
+#if ! defined(KTH_DB_READONLY)
+    // The map size is not set before opening, the stored one is used. It is
+    // only raised to db_max_size, a smaller setting never shrinks the map.
+    uint64_t map_size;
+    uint64_t used;
+    res = kth_db_env_map_usage(env_, map_size, used);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error getting the map size [create_and_open_environment] ", static_cast<int32_t>(res));
+        return false;
+    }
+
+    auto const min_size = adjust_db_size(db_max_size_);
+    if (map_size < min_size) {
+        res = kth_db_env_set_mapsize(env_, min_size);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error setting max memory map size. Verify do you have enough free space. [create_and_open_environment] ", static_cast<int32_t>(res));
+            return false;
+        }
+    }
+#endif // ! defined(KTH_DB_READONLY)
+
+    // Half of the reader table is left for transactions that are not pooled
+    // (snapshots, get_utxos() workers, other processes).
+    unsigned int max_readers;
+    res = kth_db_env_get_maxreaders(env_, &max_readers);
+    if (res != KTH_DB_SUCCESS) {
+        return false;
+    }
+    read_txns_.open(env_, max_readers / 2, max_readers);
+    return true;
+}
+
+#if ! defined(KTH_DB_READONLY)
+
+// Rough upper bound of the map space used by `bytes` of serialized blocks
+// (blocks, transactions, history, spends, UTXOs and reorg data).
+template <typename Clock>
+uint64_t internal_database_basis<Clock>::map_space_needed(uint64_t bytes) const {
+    constexpr uint64_t index_factor = 4;
+    constexpr uint64_t min_space = uint64_t(64) << 20;     // 64 MiB
+    return std::max(bytes * index_factor, min_space);
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::map_nearly_full(uint64_t needed) const {
+    if (db_growth_step_ == 0) {
+        return false;
+    }
+
+    uint64_t map_size;
+    uint64_t used;
+    if (kth_db_env_map_usage(env_, map_size, used) != KTH_DB_SUCCESS) {
+        return false;
+    }
+    return used >= map_size || map_size - used < needed;
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::ensure_map_space(uint64_t needed) {
+    if ( ! map_nearly_full(needed)) {
+        return true;
+    }
+
+    // Readers held the last growth off, the map is not full yet.
+    if (std::chrono::steady_clock::now() < grow_retry_) {
+        return false;
+    }
+    return grow_map(needed);
+}
+
+// Same scheme as the LMDB users that resize online: new read transactions are
+// held back until the active ones finish, then the map is resized. A reader
+// that does not finish in time (i.e. a long-lived snapshot) makes the growth
+// fail instead of stalling the writer, ensure_map_space() retries it later.
+// Precondition: the writer has no open transaction.
+template <typename Clock>
+bool internal_database_basis<Clock>::grow_map(uint64_t needed) {
+    if (db_growth_step_ == 0 || batch_txn_ != nullptr) {
+        return false;
+    }
+
+    uint64_t map_size;
+    uint64_t used;
+    auto res = kth_db_env_map_usage(env_, map_size, used);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error getting the map size [grow_map] ", static_cast<int32_t>(res));
+        return false;
+    }
+
+    auto const increase = std::max(needed, db_growth_step_);
+
+    // The data file is sparse, only the used pages take disk space, but running
+    // out of disk with a map that claims to have room would crash the process.
+    std::error_code ec;
+    auto const space = std::filesystem::space(db_dir_, ec);
+    if (ec) {
+        LOG_INFO(LOG_DATABASE, "Unable to query free disk space [grow_map] ", ec.message());
+    } else if (space.available < increase) {
+        LOG_ERROR(LOG_DATABASE, "Insufficient free space to grow the database: ", space.available >> 20, " MiB available, ", increase >> 20, " MiB needed [grow_map]");
+        return false;
+    }
+
+    auto const new_size = adjust_db_size(map_size + increase);
+    auto const resized = read_txns_.resize_map(new_size);
+    if ( ! resized) {
+        LOG_INFO(LOG_DATABASE, "Read transactions still active, the map growth is postponed [grow_map]");
+        grow_retry_ = std::chrono::steady_clock::now() + grow_retry_delay;
+        return false;
+    }
+
+    res = *resized;
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error setting the new map size [grow_map] ", static_cast<int32_t>(res));
+        return false;
+    }
+
+    LOG_INFO(LOG_DATABASE, "Database map size increased. Old: ", map_size >> 20, " MiB, New: ", new_size >> 20, " MiB");
+    return true;
+}
+
+#endif // ! defined(KTH_DB_READONLY)
+
+// Full mode index enabled in the settings (always false in the other modes).
+template <typename Clock>
+bool internal_database_basis<Clock>::has_index(db_indexes_t index) const {
+    return (indexes_ & index) != 0;
+}
+
+// Addresses the history rows of the output are keyed by.
+template <typename Clock>
+domain::wallet::payment_address::list internal_database_basis<Clock>::history_addresses(domain::chain::output const& output) const {
+    if (has_index(db_index_history_standard)) {
+        auto const& ops = output.script().operations();
+        if ( ! domain::chain::script::is_pay_key_hash_pattern(ops) && ! domain::chain::script::is_pay_script_hash_pattern(ops)) {
+            return {};
+        }
+    }
+    return output.addresses();
+}
+
+// The history and spend rows of the block at height are written by push_block()
+// unless they are deferred or the indexer has not reached the previous blocks,
+// history ids follow the block order.
+template <typename Clock>
+bool internal_database_basis<Clock>::index_on_push(uint32_t height) const {
+    return ! has_index(db_index_deferred) && counters_.indexed == height;
+}
+
+// Every reading thread may hold a pooled transaction and a snapshot or
+// get_utxos() transaction at the same time, half of the slots are pooled.
+template <typename Clock>
+uint32_t internal_database_basis<Clock>::get_max_readers() const {
+    if (max_readers_ != 0) {
+        return max_readers_;
+    }
+    auto const threads = std::max(1u, std::thread::hardware_concurrency());
+    return std::max(default_max_readers, 4 * threads + 16);
 }
 
 /*
@@ -739,19 +1937,6 @@ bool internal_database_basis<Clock>::set_fast_flags_environment(bool enabled) {
 }
 */
 
-inline
-int compare_uint64(KTH_DB_val const* a, KTH_DB_val const* b) {
-
-    //TODO(fernando): check this casts... something smells bad
-    const uint64_t va = *(const uint64_t *)kth_db_get_data(*a);
-    const uint64_t vb = *(const uint64_t *)kth_db_get_data(*b);
-
-    //std::cout << "va: " << va << std::endl;
-    //std::cout << "vb: " << va << std::endl;
-
-    return (va < vb) ? -1 : va > vb;
-}
-
 template <typename Clock>
 bool internal_database_basis<Clock>::open_databases() {
     KTH_DB_txn* db_txn;
@@ -777,19 +1962,28 @@ bool internal_database_basis<Clock>::open_databases() {
     if ( ! open_db(reorg_block_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_reorg_block_)) return false;
     if ( ! open_db(db_properties_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_properties_)) return false;
 
-    if (db_mode_ == db_mode_type::blocks || db_mode_ == db_mode_type::full) {
+    // A handle already open in the transaction is returned as is, regardless of
+    // the flags, so block_db must be opened once with the flags of the mode.
+    if (db_mode_ == db_mode_type::blocks) {
         if ( ! open_db(block_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_block_db_)) return false;
     }
 
     if (db_mode_ == db_mode_type::full) {
-        if ( ! open_db(block_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED  | MDB_INTEGERDUP, &dbi_block_db_)) return false;
+        // Indexes not upgraded yet are opened with their original flags.
+        auto const layout = stored_layout_version(db_txn);
+        uint32_t const block_db_flags = layout == 2 || layout == 3 ? block_tx_ids_flags : uint32_t(KTH_DB_INTEGERKEY);
+        uint32_t const transaction_hash_db_flags = layout >= 6 ? tx_hash_prefix_flags : layout >= 3 ? tx_hash_ids_flags : 0;
+
+        if ( ! open_db(block_db_name, KTH_DB_CONDITIONAL_CREATE | block_db_flags, &dbi_block_db_)) return false;
         if ( ! open_db(transaction_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_transaction_db_)) return false;
-        if ( ! open_db(transaction_hash_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_transaction_hash_db_)) return false;
+        if ( ! open_db(transaction_hash_db_name, KTH_DB_CONDITIONAL_CREATE | transaction_hash_db_flags, &dbi_transaction_hash_db_)) return false;
         if ( ! open_db(history_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_DUPSORT | KTH_DB_DUPFIXED, &dbi_history_db_)) return false;
         if ( ! open_db(spend_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_spend_db_)) return false;
         if ( ! open_db(transaction_unconfirmed_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_transaction_unconfirmed_db_)) return false;
 
-        mdb_set_dupsort(db_txn, dbi_history_db_, compare_uint64);
+        // history_db duplicates sort byte-wise (see history_row). Prior to version 5
+        // they were sorted by id with a custom comparator, the upgrade to version 5
+        // only walks and deletes those duplicates, it does not compare them.
     }
 
     db_opened_ = kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS;
@@ -798,150 +1992,321 @@ bool internal_database_basis<Clock>::open_databases() {
 
 
 
-#if ! defined(KTH_DB_READONLY)
+#if ! defined(KTH_DB_READONLY)
+
+// Inputs of the non-coinbase transactions.
+template <typename Clock>
+result_code internal_database_basis<Clock>::remove_inputs(prepared_block const& block, std::vector<prepared_history>& unresolved, KTH_DB_txn* db_txn) {
+    auto const& txs = block.transactions;
+    auto const index = index_on_push(block.height);
+
+    std::vector<prepared_input const*> to_remove;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        for (auto const& input : it->inputs) {
+            if (index && has_index(db_index_history)) {
+                // Before the UTXO is removed, it could be needed to get the addresses.
+                auto res = resolve_input_history(input, unresolved, db_txn);
+                if (res != result_code::success) {
+                    return res;
+                }
+            }
+
+            if (index && has_index(db_index_spend)) {
+                auto res = insert_spend(input.key, input.spend, db_txn);
+                if (res != result_code::success) {
+                    return res;
+                }
+            }
+
+            if (input.created_in_block) {
+                continue;
+            }
+
+            if (use_utxo_cache_ && utxo_cache_.remove(input.prevout)) {
+                // Created and spent while cached, it never reaches the DB.
+                continue;
+            }
+            to_remove.push_back(&input);
+        }
+    }
+
+    return remove_utxos(to_remove, block.height, block.insert_reorg, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_outputs(prepared_transaction const& tx, uint32_t height, KTH_DB_txn* db_txn) {
+    for (auto const& output : tx.outputs) {
+        auto res = insert_utxo(output.point, output.key, output.value, height, db_txn);
+        if (res == result_code::duplicated_key) {
+            //TODO(fernando): log and continue
+            return result_code::success_duplicate_coinbase;
+        }
+        if (res != result_code::success) {
+            return res;
+        }
+    }
+    return result_code::success;
+}
+
+// Outputs of the non-coinbase transactions.
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_outputs(prepared_block const& block, KTH_DB_txn* db_txn) {
+    auto const& txs = block.transactions;
+
+    std::vector<prepared_output const*> to_insert;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        for (auto const& output : it->outputs) {
+            if (output.spent_in_block) {
+                // Nothing to insert.
+            } else if (use_utxo_cache_) {
+                auto res = insert_utxo(output.point, output.key, output.value, block.height, db_txn);
+                if (res == result_code::duplicated_key) {
+                    return result_code::success_duplicate_coinbase;
+                }
+                if (res != result_code::success) {
+                    return res;
+                }
+            } else {
+                to_insert.push_back(&output);
+            }
+        }
+    }
+
+    auto res = insert_utxos(to_insert, db_txn);
+    if (res == result_code::duplicated_key) {
+        return result_code::success_duplicate_coinbase;
+    }
+    return res;
+}
+
+template <typename Clock>
+prepared_transaction internal_database_basis<Clock>::prepare_transaction(domain::chain::transaction const& tx, uint32_t position, uint32_t height, uint32_t median_time_past, data_chunk const& fixed) const {
+    auto const full = db_mode_ == db_mode_type::full;
+    auto const deferred = has_index(db_index_deferred);
+    auto const history = has_index(db_index_history) && ! deferred;
+
+    prepared_transaction ptx;
+    ptx.hash = tx.hash();
+
+    if (full) {
+        ptx.entry = transaction_entry::factory_to_data(tx, height, median_time_past, position);
+    }
+
+    auto const& outputs = tx.outputs();
+    ptx.outputs.reserve(outputs.size());
+    uint32_t index = 0;
+    for (auto const& output : outputs) {
+        prepared_output pout;
+        pout.point = domain::chain::output_point{ptx.hash, index};
+        pout.key = pout.point.to_data(KTH_INTERNAL_DB_WIRE);
+        pout.value = utxo_entry::to_data_with_fixed(output, fixed);
+
+        if (history) {
+            // Standard outputs contain unambiguous address data.
+            pout.history.value = history_entry::factory_to_data(0, pout.point, domain::chain::point_kind::output, height, index, output.value());
+            for (auto const& address : history_addresses(output)) {
+                pout.history.keys.push_back(address.hash20());
+            }
+        }
+
+        ptx.outputs.push_back(std::move(pout));
+        ++index;
+    }
+
+    if (position > 0) {
+        auto const& inputs = tx.inputs();
+        ptx.inputs.reserve(inputs.size());
+        index = 0;
+        for (auto const& input : inputs) {
+            domain::chain::input_point const inpoint {ptx.hash, index};
+            auto const& prevout = input.previous_output();
+
+            prepared_input pin;
+            pin.prevout = prevout;
+            pin.key = prevout.to_data(KTH_INTERNAL_DB_WIRE);
+
+            if (has_index(db_index_spend) && ! deferred) {
+                pin.spend = inpoint.to_data();
+            }
+
+            if (history) {
+                pin.history.value = history_entry::factory_to_data(0, inpoint, domain::chain::point_kind::spend, height, inpoint.index(), prevout.checksum());
+
+                // This results in a complete and unambiguous history for the
+                // address since standard outputs contain unambiguous address data.
+                pin.history_resolved = prevout.validation.cache.is_valid();
+                if (pin.history_resolved) {
+                    for (auto const& address : history_addresses(prevout.validation.cache)) {
+                        pin.history.keys.push_back(address.hash20());
+                    }
+                }
+            }
+
+            ptx.inputs.push_back(std::move(pin));
+            ++index;
+        }
+    }
+
+    return ptx;
+}
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::remove_inputs(hash_digest const& tx_id, uint32_t height, domain::chain::input::list const& inputs, bool insert_reorg, KTH_DB_txn* db_txn) {
-    uint32_t pos = 0;
-    for (auto const& input: inputs) {
-        domain::chain::input_point const inpoint {tx_id, pos};
-        auto const& prevout = input.previous_output();
+prepared_block internal_database_basis<Clock>::prepare_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past, size_t threads) const {
+    //precondition: block.transactions().size() >= 1
+    constexpr size_t min_txs_per_thread = 256;
 
-        if (db_mode_ == db_mode_type::full) {
-            auto res = insert_input_history(inpoint, height, input, db_txn);
-            if (res != result_code::success) {
-                return res;
-            }
+    auto const& txs = block.transactions();
+
+    prepared_block res;
+    res.height = height;
+    res.median_time_past = median_time_past;
+    //TODO: save reorg blocks after the last checkpoint
+    res.insert_reorg = ! is_old_block(block);
+    res.hash = block.hash();
+    res.header = to_data_with_abla_state(block);
+
+    if (db_mode_ == db_mode_type::blocks || res.insert_reorg) {
+        res.block = block.to_data(false);
+        res.serialized_size = res.block.size();
+    } else {
+        res.serialized_size = block.serialized_size(false);
+    }
+
+    auto const fixed_coinbase = utxo_entry::to_data_fixed(height, median_time_past, true);
+    auto const fixed = utxo_entry::to_data_fixed(height, median_time_past, false);
+
+    // Script matching and serialization dominate, the transactions of large
+    // blocks are prepared in parallel. Threads write disjoint positions.
+    res.transactions.resize(txs.size());
+    auto const prepare = [&](size_t from, size_t to) {
+        for (auto i = from; i < to; ++i) {
+            res.transactions[i] = prepare_transaction(txs[i], uint32_t(i), height, median_time_past, i == 0 ? fixed_coinbase : fixed);
         }
+    };
 
-        auto res = remove_utxo(height, prevout, insert_reorg, db_txn);
-        if (res != result_code::success) {
-            return res;
+    threads = std::max<size_t>(1, std::min({threads, workers_.size() + 1, txs.size() / min_txs_per_thread}));
+    if (threads == 1) {
+        prepare(0, txs.size());
+    } else {
+        auto const chunk = (txs.size() + threads - 1) / threads;
+        std::vector<std::future<void>> workers;
+        workers.reserve(threads - 1);
+        for (size_t from = chunk; from < txs.size(); from += chunk) {
+            workers.push_back(workers_.submit([&prepare, from, to = std::min(from + chunk, txs.size())] { prepare(from, to); }));
         }
 
-        if (db_mode_ == db_mode_type::full) {
-            //insert in spend database
-            res = insert_spend(prevout, inpoint, db_txn);
-            if (res != result_code::success) {
-                return res;
-            }
+        prepare(0, chunk);
+        for (auto& worker : workers) {
+            worker.get();
         }
+    }
 
-        ++pos;
+    // Outputs created and spent in the same block cancel out, neither the
+    // insert nor the remove reach dbi_utxo_ (nor the reorg pool, on pop they
+    // are recomputed from the stored block, see spent_in_block()).
+    // The coinbase outputs are immature, they can not be spent in the same block.
+    std::unordered_map<domain::chain::point, prepared_output*> created;
+    for (auto it = res.transactions.begin() + 1; it != res.transactions.end(); ++it) {
+        for (auto& output : it->outputs) {
+            created.emplace(output.point, &output);
+        }
     }
-    return result_code::success;
-}
 
-template <typename Clock>
-result_code internal_database_basis<Clock>::insert_outputs(hash_digest const& tx_id, uint32_t height, domain::chain::output::list const& outputs, data_chunk const& fixed_data, KTH_DB_txn* db_txn) {
-    uint32_t pos = 0;
-    for (auto const& output: outputs) {
+    if ( ! created.empty()) {
+        for (auto it = res.transactions.begin() + 1; it != res.transactions.end(); ++it) {
+            for (auto& input : it->inputs) {
+                auto found = created.find(input.prevout);
+                if (found == created.end()) {
+                    continue;
+                }
 
-        auto res = insert_utxo(domain::chain::point{tx_id, pos}, output, fixed_data, db_txn);
-        if (res != result_code::success) {
-            return res;
-        }
+                found->second->spent_in_block = true;
+                input.created_in_block = true;
 
-        if (db_mode_ == db_mode_type::full) {
-            res = insert_output_history(tx_id, height, pos, output, db_txn);
-            if (res != result_code::success) {
-                return res;
+                // The UTXO is not in the DB, the addresses are taken from the output.
+                if ( ! input.history_resolved) {
+                    input.history.keys = found->second->history.keys;
+                    input.history_resolved = true;
+                }
             }
         }
-
-        ++pos;
     }
-    return result_code::success;
-}
-
-template <typename Clock>
-result_code internal_database_basis<Clock>::insert_outputs_error_treatment(uint32_t height, data_chunk const& fixed_data, hash_digest const& txid, domain::chain::output::list const& outputs, KTH_DB_txn* db_txn) {
-    auto res = insert_outputs(txid,height, outputs, fixed_data, db_txn);
 
-    if (res == result_code::duplicated_key) {
-        //TODO(fernando): log and continue
-        return result_code::success_duplicate_coinbase;
+    if (has_index(db_index_history) && ! has_index(db_index_deferred)) {
+        assign_history_ids(res);
     }
+
     return res;
 }
 
+// Row ids are a prefix sum over the rows of the block, in the order push_block()
+// writes them: coinbase outputs, outputs, inputs. The rows of the inputs whose
+// addresses are only known inside the write transaction get the ids after them.
+// static
 template <typename Clock>
-template <typename I>
-result_code internal_database_basis<Clock>::push_transactions_outputs_non_coinbase(uint32_t height, data_chunk const& fixed_data, I f, I l, KTH_DB_txn* db_txn) {
-    // precondition: [f, l) is a valid range and there are no coinbase transactions in it.
+void internal_database_basis<Clock>::assign_history_ids(prepared_block& block) {
+    uint64_t rows = 0;
+    auto const assign = [&rows](prepared_history& history) {
+        history.id = rows;
+        rows += history.keys.size();
+    };
 
-    while (f != l) {
-        auto const& tx = *f;
-        auto res = insert_outputs_error_treatment(height, fixed_data, tx.hash(), tx.outputs(), db_txn);
-        if (res != result_code::success) {
-            return res;
-        }
-        ++f;
+    auto& txs = block.transactions;
+    for (auto& output : txs.front().outputs) {
+        assign(output.history);
     }
-    return result_code::success;
-}
-
-template <typename Clock>
-template <typename I>
-result_code internal_database_basis<Clock>::remove_transactions_inputs_non_coinbase(uint32_t height, I f, I l, bool insert_reorg, KTH_DB_txn* db_txn) {
-    while (f != l) {
-        auto const& tx = *f;
-        auto res = remove_inputs(tx.hash(), height, tx.inputs(), insert_reorg, db_txn);
-        if (res != result_code::success) {
-            return res;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        for (auto& output : it->outputs) {
+            assign(output.history);
         }
-        ++f;
     }
-    return result_code::success;
-}
-
-template <typename Clock>
-template <typename I>
-result_code internal_database_basis<Clock>::push_transactions_non_coinbase(uint32_t height, data_chunk const& fixed_data, I f, I l, bool insert_reorg, KTH_DB_txn* db_txn) {
-    // precondition: [f, l) is a valid range and there are no coinbase transactions in it.
-
-    auto res = push_transactions_outputs_non_coinbase(height, fixed_data, f, l, db_txn);
-    if (res != result_code::success) {
-        return res;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        for (auto& input : it->inputs) {
+            if (input.history_resolved) {
+                assign(input.history);
+            }
+        }
     }
-
-    return remove_transactions_inputs_non_coinbase(height, f, l, insert_reorg, db_txn);
+    block.history_rows = rows;
 }
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::push_block(domain::chain::block const& block, uint32_t height, uint32_t median_time_past, bool insert_reorg, KTH_DB_txn* db_txn) {
-    //precondition: block.transactions().size() >= 1
+result_code internal_database_basis<Clock>::push_block(prepared_block const& block, KTH_DB_txn* db_txn) {
+    //precondition: block.transactions.size() >= 1
 
-    auto res = push_block_header(block, height, db_txn);
+    auto res = push_block_header(block, db_txn);
     if (res != result_code::success) {
         return res;
     }
 
-    auto const& txs = block.transactions();
+    auto const& txs = block.transactions;
+    uint64_t history_base = 0;
 
     if (db_mode_ == db_mode_type::full) {
-        auto tx_count = get_tx_count(db_txn);
+        auto tx_count = get_tx_count();
 
-        res = insert_block(block, height, tx_count, db_txn);
+        res = insert_block(block, tx_count, db_txn);
         if (res != result_code::success) {
             return res;
         }
 
-        res = insert_transactions(txs.begin(), txs.end(), height, median_time_past, tx_count, db_txn);
+        res = insert_transactions(block, tx_count, db_txn);
         if (res == result_code::duplicated_key) {
             res = result_code::success_duplicate_coinbase;
         } else if (res != result_code::success) {
             return res;
         }
+
+        history_base = get_history_count();
     } else if (db_mode_ == db_mode_type::blocks) {
-        res = insert_block(block, height, 0, db_txn);
+        res = insert_block(block, 0, db_txn);
         if (res != result_code::success) {
             return res;
         }
     }
 
-    if ( insert_reorg ) {
-        res = push_block_reorg(block, height, db_txn);
+    if (block.insert_reorg) {
+        res = push_block_reorg(block, db_txn);
         if (res != result_code::success) {
             return res;
         }
@@ -949,24 +2314,200 @@ result_code internal_database_basis<Clock>::push_block(domain::chain::block cons
 
     auto const& coinbase = txs.front();
 
-    auto fixed = utxo_entry::to_data_fixed(height, median_time_past, true);
-    auto res0 = insert_outputs_error_treatment(height, fixed, coinbase.hash(), coinbase.outputs(), db_txn);
+    auto res0 = insert_outputs(coinbase, block.height, db_txn);
     if ( ! succeed(res0)) {
         return res0;
     }
 
-    fixed.back() = 0;
-    res = push_transactions_non_coinbase(height, fixed, txs.begin() + 1, txs.end(), insert_reorg, db_txn);
+    // Outputs of all the transactions are inserted before removing the inputs,
+    // a transaction could spend an output created later in the same block.
+    res = insert_outputs(block, db_txn);
     if (res != result_code::success) {
         return res;
     }
 
-    if (res == result_code::success_duplicate_coinbase)
+    auto const index = db_mode_ == db_mode_type::full && index_on_push(block.height);
+
+    std::vector<prepared_history> unresolved;
+    res = remove_inputs(block, unresolved, db_txn);
+    if (res != result_code::success) {
         return res;
+    }
+
+    if (index && has_index(db_index_history)) {
+        res = insert_history(block, history_base, unresolved, db_txn);
+        if (res != result_code::success) {
+            return res;
+        }
+    }
+
+    if (index) {
+        ++counters_.indexed;
+    }
 
     return res0;
 }
 
+template <typename Clock>
+result_code internal_database_basis<Clock>::push_block_cached(prepared_block const& block, KTH_DB_txn* db_txn) {
+    // The reorg pool is fed from dbi_utxo_, so recent blocks need every UTXO in the DB.
+    use_utxo_cache_ = utxo_cache_.enabled() && ! block.insert_reorg;
+
+    auto res = result_code::success;
+    if ( ! use_utxo_cache_) {
+        res = flush_utxo_cache(true, db_txn);
+    }
+
+    if (succeed(res)) {
+        res = push_block(block, db_txn);
+    }
+
+    if (succeed(res) && use_utxo_cache_ && utxo_cache_.full()) {
+        auto const res_flush = flush_utxo_cache(false, db_txn);
+        if (res_flush != result_code::success) {
+            res = res_flush;
+        }
+    }
+
+    if (succeed(res)) {
+        auto const res_prop = update_utxo_cache_property(db_txn);
+        if (res_prop != result_code::success) {
+            res = res_prop;
+        }
+    }
+
+    if (succeed(res)) {
+        auto const res_counters = save_counters(db_txn);
+        if (res_counters != result_code::success) {
+            res = res_counters;
+        }
+    }
+
+    return res;
+}
+
+// Without WRITEMAP every block is pushed in a nested transaction, so a failing block
+// does not discard the previous blocks of the batch. With WRITEMAP nested transactions
+// are not supported and a failing block aborts the entire batch.
+template <typename Clock>
+result_code internal_database_basis<Clock>::push_block_batched(prepared_block const& block) {
+    // The map can not be resized while the batch is open: the batch is committed
+    // first and the block is pushed in a new one.
+    auto const needed = map_space_needed(block.serialized_size);
+    if (map_nearly_full(needed)) {
+        auto const res_commit = commit_batch();
+        if (res_commit != result_code::success) {
+            return res_commit;
+        }
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            grow_map(needed);
+        }
+        if ( ! begin_batch()) {
+            return push_block(block);
+        }
+    }
+
+    auto const nested = safe_mode_;
+
+    KTH_DB_txn* db_txn = batch_txn_;
+    if (nested) {
+        auto res0 = kth_db_txn_begin(env_, batch_txn_, 0, &db_txn);
+        if (res0 != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining nested LMDB Transaction [push_block_batched] ", res0);
+            return result_code::other;
+        }
+    }
+
+    auto const savepoint = utxo_cache_.savepoint();
+    auto const counters_savepoint = counters_;
+
+    auto res = push_block_cached(block, db_txn);
+    if ( ! succeed(res)) {
+        if (nested) {
+            kth_db_txn_abort(db_txn);
+            utxo_cache_.rollback(savepoint);
+            counters_ = counters_savepoint;
+        } else {
+            abort_batch();
+        }
+        return res;
+    }
+
+    if (nested) {
+        auto res2 = kth_db_txn_commit(db_txn);
+        if (res2 != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error commiting nested LMDB Transaction [push_block_batched] ", res2);
+            utxo_cache_.rollback(savepoint);
+            counters_ = counters_savepoint;
+            return result_code::other;
+        }
+    }
+
+    // Value stored in the batch transaction, not committed yet.
+    utxo_cache_dirty_ = utxo_cache_.size() != 0;
+
+    ++batch_blocks_;
+    batch_bytes_ += block.serialized_size;
+
+    auto const blocks_reached = batch_max_blocks_ > 1 && batch_blocks_ >= batch_max_blocks_;
+    auto const bytes_reached = batch_max_bytes_ != 0 && batch_bytes_ >= batch_max_bytes_;
+    if ( ! blocks_reached && ! bytes_reached) {
+        return res;
+    }
+
+    auto const res_commit = commit_batch();
+    if (res_commit != result_code::success) {
+        return res_commit;
+    }
+
+    // If a new batch can not be started the next blocks are pushed one by one.
+    begin_batch();
+    return res;
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::batch_owned() const {
+    return batch_owner_.load() == std::this_thread::get_id();
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::commit_batch() {
+    auto res = kth_db_txn_commit(batch_txn_);
+    batch_txn_ = nullptr;
+    batch_owner_ = std::thread::id{};
+    write_mutex_.unlock();
+
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [commit_batch] ", res);
+        utxo_cache_.rollback();
+        utxo_cache_dirty_ = batch_utxo_cache_dirty_;
+        counters_ = committed_counters_;
+        return result_code::other;
+    }
+
+    utxo_cache_.commit();
+    committed_counters_ = counters_;
+
+    auto const elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - batch_start_).count();
+    auto const blocks_per_sec = elapsed == 0 ? 0.0 : double(batch_blocks_) * 1000.0 / double(elapsed);
+    LOG_DEBUG(LOG_DATABASE, "Batch commited: ", batch_blocks_, " blocks, ", batch_bytes_, " bytes, ", elapsed, " ms, ", blocks_per_sec, " blocks/s [commit_batch]");
+    return result_code::success;
+}
+
+template <typename Clock>
+void internal_database_basis<Clock>::abort_batch() {
+    kth_db_txn_abort(batch_txn_);
+    batch_txn_ = nullptr;
+    batch_owner_ = std::thread::id{};
+    discarded_blocks_ = batch_blocks_;
+    write_mutex_.unlock();
+    utxo_cache_.rollback();
+    utxo_cache_dirty_ = batch_utxo_cache_dirty_;
+    counters_ = committed_counters_;
+    LOG_ERROR(LOG_DATABASE, "Batch aborted, ", batch_blocks_, " blocks discarded [abort_batch]");
+}
+
 template <typename Clock>
 result_code internal_database_basis<Clock>::push_genesis(domain::chain::block const& block, KTH_DB_txn* db_txn) {
     auto res = push_block_header(block, 0, db_txn);
@@ -975,7 +2516,7 @@ result_code internal_database_basis<Clock>::push_genesis(domain::chain::block co
     }
 
     if (db_mode_ == db_mode_type::full) {
-        auto tx_count = get_tx_count(db_txn);
+        auto tx_count = get_tx_count();
         res = insert_block(block, 0, tx_count, db_txn);
 
         if (res != result_code::success) {
@@ -992,10 +2533,17 @@ result_code internal_database_basis<Clock>::push_genesis(domain::chain::block co
             return res;
         }
 
-        res = insert_output_history(hash, 0, 0, coinbase.outputs()[0], db_txn);
-        if (res != result_code::success) {
-            return res;
+        if (index_on_push(0)) {
+            if (has_index(db_index_history)) {
+                res = insert_output_history(hash, 0, 0, coinbase.outputs()[0], db_txn);
+                if (res != result_code::success) {
+                    return res;
+                }
+            }
+            ++counters_.indexed;
         }
+
+        res = save_counters(db_txn);
     } else if (db_mode_ == db_mode_type::blocks) {
         res = insert_block(block, 0, 0, db_txn);
     }
@@ -1003,11 +2551,41 @@ result_code internal_database_basis<Clock>::push_genesis(domain::chain::block co
     return res;
 }
 
+// Outputs created and spent in the same block, they never reach dbi_utxo_ nor
+// the reorg pool (see prepare_block()).
+template <typename Clock>
+std::unordered_set<domain::chain::point> internal_database_basis<Clock>::spent_in_block(domain::chain::block const& block) {
+    auto const& txs = block.transactions();
+
+    std::unordered_set<domain::chain::point> created;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        auto const hash = it->hash();
+        for (uint32_t index = 0; index < it->outputs().size(); ++index) {
+            created.emplace(hash, index);
+        }
+    }
+
+    std::unordered_set<domain::chain::point> res;
+    for (auto it = txs.begin() + 1; it != txs.end(); ++it) {
+        for (auto const& input : it->inputs()) {
+            domain::chain::point const& prevout = input.previous_output();
+            if (created.count(prevout) != 0) {
+                res.insert(prevout);
+            }
+        }
+    }
+    return res;
+}
+
 template <typename Clock>
-result_code internal_database_basis<Clock>::remove_outputs(hash_digest const& txid, domain::chain::output::list const& outputs, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::remove_outputs(hash_digest const& txid, domain::chain::output::list const& outputs, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn) {
     uint32_t pos = outputs.size() - 1;
     for (auto const& output: outputs) {
         domain::chain::output_point const point {txid, pos};
+        if (spent.count(point) != 0) {
+            --pos;
+            continue;
+        }
         auto res = remove_utxo(0, point, false, db_txn);
         if (res != result_code::success) {
             return res;
@@ -1018,9 +2596,12 @@ result_code internal_database_basis<Clock>::remove_outputs(hash_digest const& tx
 }
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_inputs(domain::chain::input::list const& inputs, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::insert_inputs(domain::chain::input::list const& inputs, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn) {
     for (auto const& input: inputs) {
         auto const& point = input.previous_output();
+        if (spent.count(point) != 0) {
+            continue;
+        }
 
         auto res = insert_output_from_reorg_and_remove(point, db_txn);
         if (res != result_code::success) {
@@ -1032,12 +2613,12 @@ result_code internal_database_basis<Clock>::insert_inputs(domain::chain::input::
 
 template <typename Clock>
 template <typename I>
-result_code internal_database_basis<Clock>::insert_transactions_inputs_non_coinbase(I f, I l, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::insert_transactions_inputs_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn) {
     // precondition: [f, l) is a valid range and there are no coinbase transactions in it.
 
     while (f != l) {
         auto const& tx = *f;
-        auto res = insert_inputs(tx.inputs(), db_txn);
+        auto res = insert_inputs(tx.inputs(), spent, db_txn);
         if (res != result_code::success) {
             return res;
         }
@@ -1049,12 +2630,12 @@ result_code internal_database_basis<Clock>::insert_transactions_inputs_non_coinb
 
 template <typename Clock>
 template <typename I>
-result_code internal_database_basis<Clock>::remove_transactions_outputs_non_coinbase(I f, I l, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::remove_transactions_outputs_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn) {
     // precondition: [f, l) is a valid range and there are no coinbase transactions in it.
 
     while (f != l) {
         auto const& tx = *f;
-        auto res = remove_outputs(tx.hash(), tx.outputs(), db_txn);
+        auto res = remove_outputs(tx.hash(), tx.outputs(), spent, db_txn);
         if (res != result_code::success) {
             return res;
         }
@@ -1066,14 +2647,14 @@ result_code internal_database_basis<Clock>::remove_transactions_outputs_non_coin
 
 template <typename Clock>
 template <typename I>
-result_code internal_database_basis<Clock>::remove_transactions_non_coinbase(I f, I l, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::remove_transactions_non_coinbase(I f, I l, std::unordered_set<domain::chain::point> const& spent, KTH_DB_txn* db_txn) {
     // precondition: [f, l) is a valid range and there are no coinbase transactions in it.
 
-    auto res = insert_transactions_inputs_non_coinbase(f, l, db_txn);
+    auto res = insert_transactions_inputs_non_coinbase(f, l, spent, db_txn);
     if (res != result_code::success) {
         return res;
     }
-    return remove_transactions_outputs_non_coinbase(f, l, db_txn);
+    return remove_transactions_outputs_non_coinbase(f, l, spent, db_txn);
 }
 
 
@@ -1085,14 +2666,15 @@ result_code internal_database_basis<Clock>::remove_block(domain::chain::block co
     auto const& coinbase = txs.front();
 
     //UTXO
-    auto res = remove_transactions_non_coinbase(txs.begin() + 1, txs.end(), db_txn);
+    auto const spent = spent_in_block(block);
+    auto res = remove_transactions_non_coinbase(txs.begin() + 1, txs.end(), spent, db_txn);
     if (res != result_code::success) {
         return res;
     }
 
     //UTXO Coinbase
     //TODO(fernando): tx.hash() debe ser llamado fuera de la DBTx
-    res = remove_outputs(coinbase.hash(), coinbase.outputs(), db_txn);
+    res = remove_outputs(coinbase.hash(), coinbase.outputs(), spent, db_txn);
     if (res != result_code::success) {
         return res;
     }
@@ -1134,25 +2716,268 @@ result_code internal_database_basis<Clock>::remove_block(domain::chain::block co
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_block(domain::chain::block const& block, uint32_t height) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    KTH_DB_txn* db_txn;
+    auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+    if (res0 != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    // The outputs to remove and the inputs to restore are looked up in dbi_utxo_.
+    use_utxo_cache_ = false;
+    auto res = flush_utxo_cache(true, db_txn);
+    if (res == result_code::success) {
+        res = update_utxo_cache_property(db_txn);
+    }
+
+    if (res == result_code::success) {
+        res = remove_block(block, height, db_txn);
+    }
+
+    if (res == result_code::success) {
+        res = save_counters(db_txn);
+    }
+
+    if (res != result_code::success) {
+        kth_db_txn_abort(db_txn);
+        utxo_cache_.rollback();
+        counters_ = committed_counters_;
+        return res;
+    }
+
+    auto res2 = kth_db_txn_commit(db_txn);
+    if (res2 != KTH_DB_SUCCESS) {
+        utxo_cache_.rollback();
+        counters_ = committed_counters_;
+        return result_code::other;
+    }
+
+    utxo_cache_.commit();
+    utxo_cache_dirty_ = false;
+    committed_counters_ = counters_;
+    return result_code::success;
+}
+
+// The blocks are indexed in height order in a single write transaction, the
+// writers wait for it (LMDB has a single writer), max_blocks bounds the wait.
+// The map is grown for the blocks to index; if they still do not fit the
+// transaction is retried after growing the map, or with half the blocks.
+template <typename Clock>
+result_code internal_database_basis<Clock>::index_blocks(uint32_t max_blocks, uint32_t& out_blocks) {
+    out_blocks = 0;
+    if (db_mode_ != db_mode_type::full) {
+        return result_code::success;
+    }
+
+    std::lock_guard<std::mutex> lock(write_mutex_);
+
+    bool grown = false;
+    while (true) {
+        uint64_t bytes;
+        auto res = get_unindexed_size(max_blocks, bytes);
+        if (res != result_code::success) {
+            return res;
+        }
+
+        auto const needed = map_space_needed(bytes);
+        ensure_map_space(needed);
+
+        bool map_full;
+        res = index_blocks(max_blocks, needed, map_full, out_blocks);
+        if ( ! map_full) {
+            return res;
+        }
+
+        if ( ! grown && grow_map(needed)) {
+            grown = true;
+            continue;
+        }
+
+        if (max_blocks <= 1) {
+            return res;
+        }
+        max_blocks /= 2;
+        LOG_INFO(LOG_DATABASE, "The map is full, indexing ", max_blocks, " blocks per transaction [index_blocks]");
+    }
+}
+
+// Stored size of the transactions of the next max_blocks blocks to index.
+// Precondition: no write transaction is open.
+template <typename Clock>
+result_code internal_database_basis<Clock>::get_unindexed_size(uint32_t max_blocks, uint64_t& out_bytes) const {
+    out_bytes = 0;
+
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return result_code::other;
+    }
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_transaction_db_, &cursor) != KTH_DB_SUCCESS) {
+        read_txns_.release(db_txn);
+        return result_code::other;
+    }
+
+    auto height = uint32_t(counters_.indexed);
+    for (uint32_t i = 0; i < max_blocks; ++i, ++height) {
+        auto key_block = kth_db_make_value(sizeof(height), &height);
+        KTH_DB_val value_block;
+        if (kth_db_get(db_txn, dbi_block_db_, &key_block, &value_block) != KTH_DB_SUCCESS) {
+            break;
+        }
+        auto const range = block_tx_range::from_value(value_block);
+
+        auto id = range.first;
+        auto key = kth_db_make_value(sizeof(id), &id);
+        KTH_DB_val value;
+        auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET);
+        for (uint32_t tx = 0; tx < range.count && rc == KTH_DB_SUCCESS; ++tx) {
+            out_bytes += kth_db_get_size(value);
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+        }
+    }
+
+    kth_db_cursor_close(cursor);
+    read_txns_.release(db_txn);
+    return result_code::success;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::index_blocks(uint32_t max_blocks, uint64_t needed, bool& out_map_full, uint32_t& out_blocks) {
+    out_blocks = 0;
+    out_map_full = false;
+
     KTH_DB_txn* db_txn;
     auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
     if (res0 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [index_blocks] ", res0);
         return result_code::other;
     }
 
-    auto res = remove_block(block, height, db_txn);
+    uint32_t last_height;
+    auto res = get_last_height(last_height, db_txn);
+    if (res == result_code::db_empty) {
+        kth_db_txn_abort(db_txn);
+        return result_code::success;
+    }
+
+    while (res == result_code::success && out_blocks < max_blocks && counters_.indexed <= last_height) {
+        auto const height = uint32_t(counters_.indexed);
+        auto const block = get_block(height, db_txn);
+        if ( ! block.is_valid()) {
+            LOG_ERROR(LOG_DATABASE, "Error getting block ", height, " [index_blocks]");
+            res = result_code::other;
+            break;
+        }
+
+        res = index_block(block, height, db_txn);
+        if (res == result_code::success) {
+            ++counters_.indexed;
+            ++out_blocks;
+        }
+    }
+
+    if (res == result_code::success && out_blocks > 0) {
+        res = save_counters(db_txn);
+    }
+
     if (res != result_code::success) {
         kth_db_txn_abort(db_txn);
+        counters_ = committed_counters_;
+        out_blocks = 0;
+        out_map_full = res == result_code::other && map_nearly_full(needed);
         return res;
     }
 
     auto res2 = kth_db_txn_commit(db_txn);
     if (res2 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [index_blocks] ", res2);
+        counters_ = committed_counters_;
+        out_blocks = 0;
+        out_map_full = res2 == KTH_DB_MAP_FULL;
         return result_code::other;
     }
+
+    committed_counters_ = counters_;
     return result_code::success;
 }
 
+// Same rows push_block() writes, the addresses of the spent outputs are taken
+// from the stored transactions, the UTXOs could be already removed.
+template <typename Clock>
+result_code internal_database_basis<Clock>::index_block(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn) {
+    auto const history = has_index(db_index_history);
+    auto const spend = has_index(db_index_spend);
+    auto const& txs = block.transactions();
+
+    prepared_block prepared;
+    prepared.height = height;
+    prepared.transactions.resize(txs.size());
+
+    for (size_t position = 0; position < txs.size(); ++position) {
+        auto const& tx = txs[position];
+        auto& ptx = prepared.transactions[position];
+        ptx.hash = tx.hash();
+
+        if (history) {
+            uint32_t index = 0;
+            for (auto const& output : tx.outputs()) {
+                domain::chain::output_point const point {ptx.hash, index};
+                prepared_output pout;
+                pout.history.value = history_entry::factory_to_data(0, point, domain::chain::point_kind::output, height, index, output.value());
+                for (auto const& address : history_addresses(output)) {
+                    pout.history.keys.push_back(address.hash20());
+                }
+                ptx.outputs.push_back(std::move(pout));
+                ++index;
+            }
+        }
+
+        if (position == 0) {
+            continue;
+        }
+
+        uint32_t index = 0;
+        for (auto const& input : tx.inputs()) {
+            domain::chain::input_point const inpoint {ptx.hash, index};
+            auto const& prevout = input.previous_output();
+
+            if (spend) {
+                auto res = insert_spend(prevout.to_data(KTH_INTERNAL_DB_WIRE), inpoint.to_data(), db_txn);
+                if (res != result_code::success) {
+                    return res;
+                }
+            }
+
+            if (history) {
+                prepared_input pin;
+                pin.history.value = history_entry::factory_to_data(0, inpoint, domain::chain::point_kind::spend, height, index, prevout.checksum());
+                pin.history_resolved = true;
+
+                auto const entry = get_transaction(prevout.hash(), max_uint32, db_txn);
+                auto const& outputs = entry.transaction().outputs();
+                if (entry.is_valid() && prevout.index() < outputs.size()) {
+                    for (auto const& address : history_addresses(outputs[prevout.index()])) {
+                        pin.history.keys.push_back(address.hash20());
+                    }
+                } else {
+                    LOG_INFO(LOG_DATABASE, "Error finding the previous output for input history [index_block]");
+                }
+                ptx.inputs.push_back(std::move(pin));
+            }
+            ++index;
+        }
+    }
+
+    if ( ! history) {
+        return result_code::success;
+    }
+
+    assign_history_ids(prepared);
+    return insert_history(prepared, get_history_count(), {}, db_txn);
+}
+
 #endif // ! defined(KTH_DB_READONLY)
 
 } // namespace kth::database
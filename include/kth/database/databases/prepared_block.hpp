@@ -0,0 +1,76 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_PREPARED_BLOCK_HPP_
+#define KTH_DATABASE_PREPARED_BLOCK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <kth/domain.hpp>
+#include <kth/database/define.hpp>
+
+namespace kth::database {
+
+// Keys, values and hashes of a block, serialized before the LMDB write
+// transaction is started so the transaction only does puts and deletes.
+// Built by internal_database_basis::prepare_block(), it does not reference
+// the original block.
+
+// History rows are serialized with a zero id, the id is set when the row is
+// written because it depends on the number of rows already in the DB: the
+// rows of the block are numbered from 0 and the DB row count is added.
+struct prepared_history {
+    std::vector<short_hash> keys;               // one row per address
+    data_chunk value;                           // history_entry
+    uint64_t id = 0;                            // first row, relative to the block
+};
+
+struct prepared_output {
+    domain::chain::output_point point;
+    data_chunk key;                             // output_point
+    data_chunk value;                           // utxo_entry
+    prepared_history history;                   // full mode only
+
+    // Spent by a later transaction of the same block, it is not written to dbi_utxo_.
+    bool spent_in_block = false;
+};
+
+struct prepared_input {
+    domain::chain::output_point prevout;
+    data_chunk key;                             // output_point (previous output)
+    data_chunk spend;                           // input_point, full mode only
+    prepared_history history;                   // full mode only
+
+    // The previous output was not populated (i.e. IBD under checkpoints), the
+    // history addresses are taken from the UTXO set inside the transaction.
+    bool history_resolved = true;
+
+    // The previous output was created in the same block and never written.
+    bool created_in_block = false;
+};
+
+struct prepared_transaction {
+    hash_digest hash;
+    data_chunk entry;                           // transaction_entry, full mode only
+    std::vector<prepared_output> outputs;
+    std::vector<prepared_input> inputs;         // empty for the coinbase
+};
+
+struct prepared_block {
+    uint32_t height;
+    uint32_t median_time_past;
+    bool insert_reorg;
+    hash_digest hash;
+    data_chunk header;                          // header with ABLA state
+    data_chunk block;                           // blocks mode and reorg pool only
+    size_t serialized_size;
+    uint64_t history_rows = 0;                  // rows with a relative id, full mode only
+    std::vector<prepared_transaction> transactions;
+};
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_PREPARED_BLOCK_HPP_
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <istream>
 
 #include <boost/program_options.hpp>
@@ -17,8 +18,35 @@ namespace kth::database {
 
 enum class property_code {
     db_mode = 0,
+    utxo_cache_dirty = 1,
+    db_version = 2,
+    db_upgrade_progress = 3,
+    tx_count = 4,
+    history_count = 5,
+    db_indexes = 6,
+    indexed_height = 7,
+    utxo_cache_from = 8,
 };
 
+// Indexes built in full mode, a set of flags. DBs created before the
+// db_indexes property have all of them.
+using db_indexes_t = uint32_t;
+constexpr db_indexes_t db_index_history = 1u << 0;             // history_db
+constexpr db_indexes_t db_index_spend = 1u << 1;               // spend_db
+constexpr db_indexes_t db_index_transaction_hash = 1u << 2;    // transaction_hash_db
+constexpr db_indexes_t db_index_all = db_index_history | db_index_spend | db_index_transaction_hash;
+
+// history_db only has rows for the P2PKH and P2SH outputs (and their spends),
+// the other outputs with address data (P2PK, bare multisig) are not indexed.
+constexpr db_indexes_t db_index_history_standard = 1u << 4;
+
+// Flags stored in the db_indexes property.
+constexpr db_indexes_t db_index_stored = db_index_all | db_index_history_standard;
+
+// The history and spend rows are written by the background indexer instead of
+// push_block(), see internal_database::index_blocks(). Not stored in the DB.
+constexpr db_indexes_t db_index_deferred = 1u << 3;
+
 enum class db_mode_type {
     pruned,
     blocks,
@@ -0,0 +1,179 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_READ_SNAPSHOT_HPP_
+#define KTH_DATABASE_READ_SNAPSHOT_HPP_
+
+#include <kth/database/databases/internal_database.hpp>
+
+namespace kth::database {
+
+// Point-in-time view of the database over a single read-only transaction.
+// The reader slot is acquired once, in the constructor; release() gives up the
+// snapshot keeping the transaction handle and refresh() renews it on the latest
+// committed data, both are cheaper than beginning a new transaction.
+// A snapshot must not outlive its database, must not be used concurrently and
+// is released on the thread that created it.
+// An active snapshot holds off the growth of the map, release it before waiting
+// on the writer.
+// The UTXO cache (IBD) is not part of the snapshot, UTXO lookups see it as the
+// standalone getters do.
+template <typename Clock = std::chrono::system_clock>
+class read_snapshot_basis {
+public:
+    using database_t = internal_database_basis<Clock>;
+    using utxo_pool_t = typename database_t::utxo_pool_t;
+
+    explicit
+    read_snapshot_basis(database_t const& db)
+        : db_(db)
+    {
+        db_.read_txns_.enter();
+        auto res = kth_db_txn_begin(db_.env_, NULL, KTH_DB_RDONLY, &db_txn_);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [read_snapshot] ", res);
+            db_.read_txns_.leave();
+            db_txn_ = nullptr;
+            return;
+        }
+        active_ = true;
+    }
+
+    ~read_snapshot_basis() {
+        release();
+        if (db_txn_ != nullptr) {
+            kth_db_txn_abort(db_txn_);
+        }
+    }
+
+    // Non-copyable, non-movable
+    read_snapshot_basis(read_snapshot_basis const&) = delete;
+    read_snapshot_basis& operator=(read_snapshot_basis const&) = delete;
+
+    bool is_valid() const {
+        return active_;
+    }
+
+    // Releases the snapshot, the pages it pins can be reused by the writer.
+    void release() {
+        if (active_) {
+            kth_db_txn_reset(db_txn_);
+            db_.read_txns_.leave();
+            active_ = false;
+        }
+    }
+
+    // Moves the snapshot to the latest committed data.
+    bool refresh() {
+        if (db_txn_ == nullptr) {
+            return false;
+        }
+        release();
+        db_.read_txns_.enter();
+        auto res = kth_db_txn_renew(db_txn_);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error renewing LMDB Transaction [read_snapshot] ", res);
+            db_.read_txns_.leave();
+            return false;
+        }
+        active_ = true;
+        return true;
+    }
+
+    // Raw handle, for get_utxo_view() callers.
+    KTH_DB_txn* txn() const {
+        return active_ ? db_txn_ : nullptr;
+    }
+
+    utxo_entry get_utxo(domain::chain::output_point const& point) const {
+        return active_ ? db_.get_utxo(point, db_txn_) : utxo_entry{};
+    }
+
+    // The view is valid until the snapshot is released, refreshed or destroyed.
+    utxo_view get_utxo_view(domain::chain::output_point const& point) const {
+        return active_ ? db_.get_utxo_view(point, db_txn_) : utxo_view{};
+    }
+
+    result_code get_last_height(uint32_t& out_height) const {
+        return active_ ? db_.get_last_height(out_height, db_txn_) : result_code::other;
+    }
+
+    std::pair<domain::chain::header, uint32_t> get_header(hash_digest const& hash) const {
+        return active_ ? db_.get_header(hash, db_txn_) : std::pair<domain::chain::header, uint32_t>{};
+    }
+
+    domain::chain::header get_header(uint32_t height) const {
+        return active_ ? db_.get_header(height, db_txn_) : domain::chain::header{};
+    }
+
+    domain::chain::header::list get_headers(uint32_t from, uint32_t to) const {
+        return active_ ? db_.get_headers(from, to, db_txn_) : domain::chain::header::list{};
+    }
+
+    std::optional<header_with_abla_state_t> get_header_and_abla_state(uint32_t height) const {
+        return active_ ? db_.get_header_and_abla_state(height, db_txn_) : std::nullopt;
+    }
+
+    std::pair<result_code, utxo_pool_t> get_utxo_pool_from(uint32_t from, uint32_t to) const {
+        return active_ ? db_.get_utxo_pool_from(from, to, db_txn_) : std::pair<result_code, utxo_pool_t>{result_code::other, {}};
+    }
+
+    std::pair<domain::chain::block, uint32_t> get_block(hash_digest const& hash) const {
+        return active_ ? db_.get_block(hash, db_txn_) : std::pair<domain::chain::block, uint32_t>{};
+    }
+
+    domain::chain::block get_block(uint32_t height) const {
+        return active_ ? db_.get_block(height, db_txn_) : domain::chain::block{};
+    }
+
+    transaction_entry get_transaction(hash_digest const& hash, size_t fork_height) const {
+        return active_ ? db_.get_transaction(hash, fork_height, db_txn_) : transaction_entry{};
+    }
+
+    domain::chain::history_compact::list get_history(short_hash const& key, size_t limit, size_t from_height) const {
+        return active_ ? db_.get_history(key, limit, from_height, db_txn_) : domain::chain::history_compact::list{};
+    }
+
+    std::vector<hash_digest> get_history_txns(short_hash const& key, size_t limit, size_t from_height) const {
+        return active_ ? db_.get_history_txns(key, limit, from_height, db_txn_) : std::vector<hash_digest>{};
+    }
+
+    domain::chain::history_compact::list get_history_page(short_hash const& key, size_t limit, size_t from_height, bool newest_first, data_chunk const& token, data_chunk& next_token) const {
+        next_token.clear();
+        return active_ ? db_.get_history_page(key, limit, from_height, newest_first, token, next_token, db_txn_) : domain::chain::history_compact::list{};
+    }
+
+    domain::chain::input_point get_spend(domain::chain::output_point const& point) const {
+        return active_ ? db_.get_spend(point, db_txn_) : domain::chain::input_point{};
+    }
+
+    // The history and spend queries of the snapshot are complete up to its tip
+    // when the indexed height is above it.
+    result_code get_indexed_height(uint32_t& out_height) const {
+        return active_ ? db_.get_indexed_height(out_height, db_txn_) : result_code::other;
+    }
+
+    bool is_index_complete() const {
+        return active_ && db_.is_index_complete(db_txn_);
+    }
+
+    std::vector<transaction_unconfirmed_entry> get_all_transaction_unconfirmed() const {
+        return active_ ? db_.get_all_transaction_unconfirmed(db_txn_) : std::vector<transaction_unconfirmed_entry>{};
+    }
+
+    transaction_unconfirmed_entry get_transaction_unconfirmed(hash_digest const& hash) const {
+        return active_ ? db_.get_transaction_unconfirmed(hash, db_txn_) : transaction_unconfirmed_entry{};
+    }
+
+private:
+    database_t const& db_;
+    KTH_DB_txn* db_txn_ = nullptr;
+    bool active_ = false;
+};
+
+using read_snapshot = read_snapshot_basis<std::chrono::system_clock>;
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_READ_SNAPSHOT_HPP_
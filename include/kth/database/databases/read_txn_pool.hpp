@@ -0,0 +1,103 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_READ_TXN_POOL_HPP_
+#define KTH_DATABASE_READ_TXN_POOL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include <kth/database/databases/generic_db.hpp>
+#include <kth/database/define.hpp>
+
+namespace kth::database {
+
+// Lock-free pool of reset read-only transactions.
+// The environment is opened with KTH_DB_NOTLS, so a read transaction is not
+// bound to the thread that created it: acquire() renews a pooled transaction
+// (keeping its reader slot) instead of beginning a new one, and release()
+// resets it and puts it back. The pool grows with the number of concurrent
+// readers up to its capacity, transactions released into a full pool are
+// aborted so their reader slots are returned to the environment.
+//
+// The pool also gates the active read transactions of the process, the map
+// can only be resized while none of them is active (see resize_map()).
+// Transactions are released on the thread that acquired them.
+class KD_API read_txn_pool {
+public:
+    read_txn_pool() = default;
+    ~read_txn_pool();
+
+    // Non-copyable, non-movable
+    read_txn_pool(read_txn_pool const&) = delete;
+    read_txn_pool& operator=(read_txn_pool const&) = delete;
+
+    // Precondition: no transaction is pooled or borrowed.
+    void open(KTH_DB_env* env, size_t capacity, size_t max_readers);
+
+    // Aborts the pooled transactions, borrowed transactions must have been released.
+    void close();
+
+    size_t capacity() const;
+
+    // Returns nullptr on error.
+    KTH_DB_txn* acquire();
+    void release(KTH_DB_txn* db_txn);
+
+    // Acquisitions served by a pooled transaction and by a new one.
+    size_t reused() const;
+    size_t created() const;
+
+    // Reader slots held by the pool (pooled and borrowed transactions),
+    // currently and at most, and the size of the reader table.
+    size_t readers() const;
+    size_t peak_readers() const;
+    size_t max_readers() const;
+
+    // Read transactions not obtained from the pool (snapshots) are bracketed
+    // by enter() and leave(). enter() blocks while the map is being resized,
+    // unless the calling thread already holds a transaction (the resize waits
+    // for it anyway).
+    void enter();
+    void leave();
+
+    // Waits up to timeout for the active read transactions to finish, blocking
+    // new ones, and sets the map size (0 adopts the size set by another process).
+    // Returns nullopt if they did not finish, the map is left as it was.
+    // Precondition: the calling thread holds no transaction.
+    std::optional<int> resize_map(uint64_t size, std::chrono::milliseconds timeout = default_resize_timeout);
+
+    static constexpr std::chrono::milliseconds default_resize_timeout {500};
+
+private:
+    KTH_DB_env* env_ = nullptr;
+    size_t capacity_ = 0;
+    size_t max_readers_ = 0;
+    std::unique_ptr<std::atomic<KTH_DB_txn*>[]> slots_;
+    std::atomic<size_t> next_ {0};
+    std::atomic<size_t> reused_ {0};
+    std::atomic<size_t> created_ {0};
+    std::atomic<size_t> readers_ {0};
+    std::atomic<size_t> peak_readers_ {0};
+    std::atomic<bool> saturation_logged_ {false};
+    std::atomic<size_t> active_ {0};
+    std::atomic<bool> resizing_ {false};
+    std::mutex resize_mutex_;               // one resize at a time
+    std::mutex gate_mutex_;                 // resizing_ and active_ changes waited on
+    std::condition_variable gate_;
+
+    void abort(KTH_DB_txn* db_txn);
+    void on_reader_created();
+    size_t& held_by_thread() const;
+};
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_READ_TXN_POOL_HPP_
@@ -25,7 +25,12 @@ result_code internal_database_basis<Clock>::insert_reorg_pool(uint32_t height, K
         return result_code::other;
     }
 
-    res = kth_db_put(db_txn, dbi_reorg_pool_, &key, &value, KTH_DB_NOOVERWRITE);
+    return insert_reorg_pool(height, key, value, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_reorg_pool(uint32_t height, KTH_DB_val& key, KTH_DB_val& value, KTH_DB_txn* db_txn) {
+    auto res = kth_db_put(db_txn, dbi_reorg_pool_, &key, &value, KTH_DB_NOOVERWRITE);
     if (res == KTH_DB_KEYEXIST) {
         LOG_INFO(LOG_DATABASE, "Duplicate key inserting in reorg pool [insert_reorg_pool] ", res);
         return result_code::duplicated_key;
@@ -53,11 +58,11 @@ result_code internal_database_basis<Clock>::insert_reorg_pool(uint32_t height, K
 
 //TODO : remove this database in db_new_with_blocks and db_new_full
 template <typename Clock>
-result_code internal_database_basis<Clock>::push_block_reorg(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::push_block_reorg(prepared_block const& block, KTH_DB_txn* db_txn) {
 
-    auto valuearr = block.to_data(false);               //TODO(fernando): podría estar afuera de la DBTx
-    auto key = kth_db_make_value(sizeof(height), &height);              //TODO(fernando): podría estar afuera de la DBTx
-    auto value = kth_db_make_value(valuearr.size(), valuearr.data());   //TODO(fernando): podría estar afuera de la DBTx
+    auto height = block.height;
+    auto key = kth_db_make_value(sizeof(height), &height);
+    auto value = kth_db_make_value(block.block.size(), const_cast<uint8_t*>(block.block.data()));
 
     auto res = kth_db_put(db_txn, dbi_reorg_block_, &key, &value, KTH_DB_NOOVERWRITE);
     if (res == KTH_DB_KEYEXIST) {
@@ -126,10 +131,38 @@ result_code internal_database_basis<Clock>::remove_block_reorg(uint32_t height,
     return result_code::success;
 }
 
+// The outputs of the height left in the reorg pool are removed with the index.
+// Blocks pushed before the outputs created and spent in the same block were
+// skipped have them in the pool, pop_block() no longer restores them (see
+// spent_in_block()). The restored outputs were already removed from the pool.
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_reorg_index(uint32_t height, KTH_DB_txn* db_txn) {
 
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_reorg_index_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
     auto key = kth_db_make_value(sizeof(height), &height);
+    KTH_DB_val value;
+    auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET);
+    while (rc == KTH_DB_SUCCESS) {
+        auto res = kth_db_del(db_txn, dbi_reorg_pool_, &value, NULL);
+        if (res != KTH_DB_SUCCESS && res != KTH_DB_NOTFOUND) {
+            LOG_INFO(LOG_DATABASE, "Error deleting reorg pool in LMDB [remove_reorg_index] - height: ", height, " - kth_db_del: ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT_DUP);
+    }
+    kth_db_cursor_close(cursor);
+
+    if (rc != KTH_DB_NOTFOUND) {
+        LOG_INFO(LOG_DATABASE, "Error iterating reorg index in LMDB [remove_reorg_index] - height: ", height, " - kth_db_cursor_get: ", rc);
+        return result_code::other;
+    }
+
+    key = kth_db_make_value(sizeof(height), &height);
     auto res = kth_db_del(db_txn, dbi_reorg_index_, &key, NULL);
     if (res == KTH_DB_NOTFOUND) {
         LOG_DEBUG(LOG_DATABASE, "Key not found deleting reorg index in LMDB [remove_reorg_index] - height: ", height, " - kth_db_del: ", res);
@@ -160,17 +193,14 @@ domain::chain::block internal_database_basis<Clock>::get_block_reorg(uint32_t he
 
 template <typename Clock>
 domain::chain::block internal_database_basis<Clock>::get_block_reorg(uint32_t height) const {
-    KTH_DB_txn* db_txn;
-    auto zzz = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (zzz != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
     auto res = get_block_reorg(height, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
+    read_txns_.release(db_txn);
 
     return res;
 }
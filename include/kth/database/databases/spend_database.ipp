@@ -12,33 +12,29 @@ namespace kth::database {
 //public
 template <typename Clock>
 domain::chain::input_point internal_database_basis<Clock>::get_spend(domain::chain::output_point const& point) const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return domain::chain::input_point{};
+    }
+
+    auto res = get_spend(point, db_txn);
 
+    read_txns_.release(db_txn);
+
+    return res;
+}
+
+template <typename Clock>
+domain::chain::input_point internal_database_basis<Clock>::get_spend(domain::chain::output_point const& point, KTH_DB_txn* db_txn) const {
     auto keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);
     auto key = kth_db_make_value(keyarr.size(), keyarr.data());
     KTH_DB_val value;
 
-    KTH_DB_txn* db_txn;
-    auto res0 = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res0 != KTH_DB_SUCCESS) {
-        LOG_INFO(LOG_DATABASE, "Error begining LMDB Transaction [get_spend] ", res0);
-        return domain::chain::input_point{};
-    }
-
-    res0 = kth_db_get(db_txn, dbi_spend_db_, &key, &value);
-    if (res0 != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
-        // kth_db_txn_abort(db_txn);
+    if (kth_db_get(db_txn, dbi_spend_db_, &key, &value) != KTH_DB_SUCCESS) {
         return domain::chain::input_point{};
     }
 
     auto data = db_value_to_data_chunk(value);
-
-    res0 = kth_db_txn_commit(db_txn);
-    if (res0 != KTH_DB_SUCCESS) {
-        LOG_DEBUG(LOG_DATABASE, "Error commiting LMDB Transaction [get_spend] ", res0);
-        return domain::chain::input_point{};
-    }
-
     auto res = domain::create_old<domain::chain::input_point>(data);
     return res;
 }
@@ -47,13 +43,10 @@ domain::chain::input_point internal_database_basis<Clock>::get_spend(domain::cha
 
 //pivate
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_spend(domain::chain::output_point const& out_point, domain::chain::input_point const& in_point, KTH_DB_txn* db_txn) {
-
-    auto keyarr = out_point.to_data(KTH_INTERNAL_DB_WIRE);
-    auto key = kth_db_make_value(keyarr.size(), keyarr.data());
+result_code internal_database_basis<Clock>::insert_spend(data_chunk const& out_point, data_chunk const& in_point, KTH_DB_txn* db_txn) {
 
-    auto value_arr = in_point.to_data();
-    auto value = kth_db_make_value(value_arr.size(), value_arr.data());
+    auto key = kth_db_make_value(out_point.size(), const_cast<uint8_t*>(out_point.data()));
+    auto value = kth_db_make_value(in_point.size(), const_cast<uint8_t*>(in_point.data()));
 
     auto res = kth_db_put(db_txn, dbi_spend_db_, &key, &value, KTH_DB_NOOVERWRITE);
     if (res == KTH_DB_KEYEXIST) {
@@ -13,17 +13,14 @@ namespace kth::database {
 template <typename Clock>
 transaction_entry internal_database_basis<Clock>::get_transaction(hash_digest const& hash, size_t fork_height) const {
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return transaction_entry{};
     }
 
     auto entry = get_transaction(hash, fork_height, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return transaction_entry{};
-    }
+    read_txns_.release(db_txn);
 
     return entry;
 
@@ -32,30 +29,23 @@ transaction_entry internal_database_basis<Clock>::get_transaction(hash_digest co
 #if ! defined(KTH_DB_READONLY)
 
 template <typename Clock>
-template <typename I>
-result_code internal_database_basis<Clock>::insert_transactions(I f, I l, uint32_t height, uint32_t median_time_past, uint64_t tx_count, KTH_DB_txn* db_txn) {
+result_code internal_database_basis<Clock>::insert_transactions(prepared_block const& block, uint64_t tx_count, KTH_DB_txn* db_txn) {
 
-    auto id = tx_count;
-    uint32_t pos = 0;
-
-    while (f != l) {
-        auto const& tx = *f;
+    tx_id_t id = tx_count;
 
+    for (auto const& tx : block.transactions) {
         //TODO: (Mario) : Implement tx.Confirm to update existing transactions
-        auto res = insert_transaction(id, tx, height, median_time_past, pos, db_txn);
+        auto res = insert_transaction(id, tx.hash, tx.entry, db_txn);
         if (res != result_code::success && res != result_code::duplicated_key) {
             return res;
         }
 
         //remove unconfirmed transaction if exists
-        //TODO (Mario): don't recalculate tx.hash
-        res = remove_transaction_unconfirmed(tx.hash(), db_txn);
+        res = remove_transaction_unconfirmed(tx.hash, db_txn);
         if (res != result_code::success && res != result_code::key_not_found) {
             return res;
         }
 
-        ++f;
-        ++pos;
         ++id;
     }
 
@@ -64,7 +54,7 @@ result_code internal_database_basis<Clock>::insert_transactions(I f, I l, uint32
 #endif // ! defined(KTH_DB_READONLY)
 
 template <typename Clock>
-transaction_entry internal_database_basis<Clock>::get_transaction(uint64_t id, KTH_DB_txn* db_txn) const {
+transaction_entry internal_database_basis<Clock>::get_transaction(tx_id_t id, KTH_DB_txn* db_txn) const {
 
     auto key = kth_db_make_value(sizeof(id), &id);
     KTH_DB_val value;
@@ -81,19 +71,41 @@ transaction_entry internal_database_basis<Clock>::get_transaction(uint64_t id, K
     return entry;
 }
 
+// transaction_hash_db only keeps 16 bytes of the hash, the candidates
+// matching them are checked against the stored transactions. Collisions are
+// very rare, a lookup reads at most the transaction returned.
 template <typename Clock>
-transaction_entry internal_database_basis<Clock>::get_transaction(hash_digest const& hash, size_t fork_height, KTH_DB_txn* db_txn) const {
-    auto key  = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
-    KTH_DB_val value;
+transaction_entry internal_database_basis<Clock>::find_transaction(hash_digest const& hash, tx_id_t& out_id, KTH_DB_txn* db_txn) const {
+    auto prefix = tx_hash_prefix(hash);
+    auto key = kth_db_make_value(sizeof(prefix), &prefix);
+    auto bound = tx_hash_value::to_value(hash, 0);
+    auto value = kth_db_make_value(bound.size(), bound.data());
 
-    auto res = kth_db_get(db_txn, dbi_transaction_hash_db_, &key, &value);
-    if (res != KTH_DB_SUCCESS) {
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_transaction_hash_db_, &cursor) != KTH_DB_SUCCESS) {
         return {};
     }
 
-    auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));;
+    auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_GET_BOTH_RANGE);
+    while (rc == KTH_DB_SUCCESS && tx_hash_value::matches(value, hash)) {
+        auto const id = tx_hash_value::id(value);
+        auto entry = get_transaction(id, db_txn);
+        if (entry.is_valid() && entry.transaction().hash() == hash) {
+            kth_db_cursor_close(cursor);
+            out_id = id;
+            return entry;
+        }
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT_DUP);
+    }
+
+    kth_db_cursor_close(cursor);
+    return {};
+}
 
-    auto const entry = get_transaction(tx_id, db_txn);
+template <typename Clock>
+transaction_entry internal_database_basis<Clock>::get_transaction(hash_digest const& hash, size_t fork_height, KTH_DB_txn* db_txn) const {
+    tx_id_t tx_id;
+    auto const entry = find_transaction(hash, tx_id, db_txn);
 
     if (entry.height() > fork_height) {
         return {};
@@ -116,15 +128,16 @@ transaction_entry internal_database_basis<Clock>::get_transaction(hash_digest co
 #if ! defined(KTH_DB_READONLY)
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_transaction(uint64_t id, domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position, KTH_DB_txn* db_txn) {
-
-    auto key = kth_db_make_value(sizeof(id), &id);
+result_code internal_database_basis<Clock>::insert_transaction(tx_id_t id, domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position, KTH_DB_txn* db_txn) {
+    auto valuearr = transaction_entry::factory_to_data(tx, height, median_time_past, position);
+    return insert_transaction(id, tx.hash(), valuearr, db_txn);
+}
 
-    //auto key_arr = tx.hash();                                    //TODO(fernando): podría estar afuera de la DBTx
-    //auto key  = kth_db_make_value(key_arr.size(), key_arr.data());
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_transaction(tx_id_t id, hash_digest const& hash, data_chunk const& entry, KTH_DB_txn* db_txn) {
 
-    auto valuearr = transaction_entry::factory_to_data(tx, height, median_time_past, position);
-    auto value = kth_db_make_value(valuearr.size(), valuearr.data());
+    auto key = kth_db_make_value(sizeof(id), &id);
+    auto value = kth_db_make_value(entry.size(), const_cast<uint8_t*>(entry.data()));
 
     auto res = kth_db_put(db_txn, dbi_transaction_db_, &key, &value, KTH_DB_APPEND);
     if (res == KTH_DB_KEYEXIST) {
@@ -136,58 +149,142 @@ result_code internal_database_basis<Clock>::insert_transaction(uint64_t id, doma
         LOG_INFO(LOG_DATABASE, "Error saving in Transaction DB [insert_transaction] ", res);
         return result_code::other;
     }
+    ++counters_.txs;
 
+    if ( ! has_index(db_index_transaction_hash)) {
+        return result_code::success;
+    }
+    return insert_transaction_hash(hash, id, db_txn);
+}
 
-    auto key_arr = tx.hash();                                    //TODO(fernando): podría estar afuera de la DBTx
-    auto key_tx  = kth_db_make_value(key_arr.size(), key_arr.data());
+// A hash already indexed is reported as a duplicate, the first transaction
+// with that hash is kept.
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_transaction_hash(hash_digest const& hash, tx_id_t id, KTH_DB_txn* db_txn) {
+    auto prefix = tx_hash_prefix(hash);
+    auto key = kth_db_make_value(sizeof(prefix), &prefix);
+    KTH_DB_val value;
 
-    res = kth_db_put(db_txn, dbi_transaction_hash_db_, &key_tx, &key, KTH_DB_NOOVERWRITE);
-    if (res == KTH_DB_KEYEXIST) {
-        LOG_INFO(LOG_DATABASE, "Duplicate key in Transaction DB [insert_transaction] ", res);
-        return result_code::duplicated_key;
+    auto res = kth_db_get(db_txn, dbi_transaction_hash_db_, &key, &value);
+    if (res == KTH_DB_SUCCESS) {
+        tx_id_t existing;
+        if (find_transaction(hash, existing, db_txn).is_valid()) {
+            LOG_INFO(LOG_DATABASE, "Duplicate key in Transaction DB [insert_transaction_hash] ", KTH_DB_KEYEXIST);
+            return result_code::duplicated_key;
+        }
+    } else if (res != KTH_DB_NOTFOUND) {
+        LOG_INFO(LOG_DATABASE, "Error getting from Transaction DB [insert_transaction_hash] ", res);
+        return result_code::other;
     }
 
+    auto const hash_value = tx_hash_value::to_value(hash, id);
+    value = kth_db_make_value(hash_value.size(), const_cast<uint8_t*>(hash_value.data()));
+    res = kth_db_put(db_txn, dbi_transaction_hash_db_, &key, &value, 0);
     if (res != KTH_DB_SUCCESS) {
-        LOG_INFO(LOG_DATABASE, "Error saving in Transaction DB [insert_transaction] ", res);
+        LOG_INFO(LOG_DATABASE, "Error saving in Transaction DB [insert_transaction_hash] ", res);
         return result_code::other;
     }
 
     return result_code::success;
 }
 
+// Upgrade writer.
+template <typename Clock>
+result_code internal_database_basis<Clock>::index_transaction_hash(tx_id_t id, transaction_entry const& entry, KTH_DB_txn* db_txn) {
+    auto res = insert_transaction_hash(entry.transaction().hash(), id, db_txn);
+    return res == result_code::duplicated_key ? result_code::success : res;
+}
+
+// Fills a full mode index from transaction_db, at most max_entries transactions
+// starting at next_id.
+template <typename Clock>
+result_code internal_database_basis<Clock>::rebuild_tx_index(tx_id_t& next_id, size_t max_entries, bool& done, tx_index_writer write, KTH_DB_txn* db_txn) {
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_transaction_db_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    auto key = kth_db_make_value(sizeof(next_id), &next_id);
+    KTH_DB_val value;
+    size_t entries = 0;
+
+    auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET_RANGE);
+    while (rc == KTH_DB_SUCCESS && entries < max_entries) {
+        auto const id = tx_id_from_value(key);
+        auto data = db_value_to_data_chunk(value);
+        auto const entry = domain::create_old<transaction_entry>(data);
+        if ( ! entry.is_valid()) {
+            LOG_ERROR(LOG_DATABASE, "Invalid transaction in Transaction DB [rebuild_tx_index] - id: ", id);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+
+        auto const res = (this->*write)(id, entry, db_txn);
+        if (res != result_code::success) {
+            kth_db_cursor_close(cursor);
+            return res;
+        }
+
+        next_id = id + 1;
+        ++entries;
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+    }
+
+    kth_db_cursor_close(cursor);
+
+    if (rc != KTH_DB_SUCCESS && rc != KTH_DB_NOTFOUND) {
+        return result_code::other;
+    }
+
+    done = rc == KTH_DB_NOTFOUND;
+    return result_code::success;
+}
+
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_transactions(domain::chain::block const& block, uint32_t height, KTH_DB_txn* db_txn) {
 
     auto const& txs = block.transactions();
+
+    // The ids of the block transactions are contiguous, transaction_hash_db is
+    // not needed to find them.
+    auto key_block = kth_db_make_value(sizeof(height), &height);
+    KTH_DB_val value_block;
+    if (kth_db_get(db_txn, dbi_block_db_, &key_block, &value_block) != KTH_DB_SUCCESS) {
+        LOG_INFO(LOG_DATABASE, "Key not found getting block DB in LMDB [remove_transactions]");
+        return result_code::other;
+    }
+    auto const range = block_tx_range::from_value(value_block);
+    if (range.count != txs.size()) {
+        LOG_INFO(LOG_DATABASE, "Transaction count mismatch in block DB [remove_transactions]");
+        return result_code::other;
+    }
+
+    // The background indexer could have not reached the block yet.
+    auto const indexed = height < counters_.indexed;
+
     uint32_t pos = 0;
     for (auto const& tx : txs) {
 
         auto const& hash = tx.hash();
 
-        auto res0 = remove_transaction_history_db(tx, height, db_txn);
-        if (res0 != result_code::success) {
-            return res0;
+        if (indexed && has_index(db_index_history)) {
+            auto res0 = remove_transaction_history_db(tx, height, db_txn);
+            if (res0 != result_code::success) {
+                return res0;
+            }
         }
 
-        if (pos > 0) {
+        if (indexed && pos > 0 && has_index(db_index_spend)) {
             auto res0 = remove_transaction_spend_db(tx, db_txn);
             if (res0 != result_code::success && res0 != result_code::key_not_found) {
                 return res0;
             }
         }
 
-        auto key = kth_db_make_value(hash.size(), const_cast<hash_digest&>(hash).data());
-        KTH_DB_val value;
-
-        auto res = kth_db_get(db_txn, dbi_transaction_hash_db_, &key, &value);
-        if (res != KTH_DB_SUCCESS) {
-            return result_code::other;
-        }
-
-        auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));;
+        tx_id_t tx_id = range.first + pos;
         auto key_tx = kth_db_make_value(sizeof(tx_id), &tx_id);
 
-        res = kth_db_del(db_txn, dbi_transaction_db_, &key_tx, NULL);
+        auto res = kth_db_del(db_txn, dbi_transaction_db_, &key_tx, NULL);
         if (res == KTH_DB_NOTFOUND) {
             LOG_INFO(LOG_DATABASE, "Key not found deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
             return result_code::key_not_found;
@@ -196,20 +293,29 @@ result_code internal_database_basis<Clock>::remove_transactions(domain::chain::b
             LOG_INFO(LOG_DATABASE, "Error deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
             return result_code::other;
         }
-
-        res = kth_db_del(db_txn, dbi_transaction_hash_db_, &key, NULL);
-        if (res == KTH_DB_NOTFOUND) {
-            LOG_INFO(LOG_DATABASE, "Key not found deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
-            return result_code::key_not_found;
-        }
-        if (res != KTH_DB_SUCCESS) {
-            LOG_INFO(LOG_DATABASE, "Error deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
-            return result_code::other;
+        --counters_.txs;
+
+        if (has_index(db_index_transaction_hash)) {
+            auto prefix = tx_hash_prefix(hash);
+            auto key = kth_db_make_value(sizeof(prefix), &prefix);
+            auto hash_value = tx_hash_value::to_value(hash, tx_id);
+            auto value = kth_db_make_value(hash_value.size(), hash_value.data());
+            res = kth_db_del(db_txn, dbi_transaction_hash_db_, &key, &value);
+            if (res == KTH_DB_NOTFOUND) {
+                LOG_INFO(LOG_DATABASE, "Key not found deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
+                return result_code::key_not_found;
+            }
+            if (res != KTH_DB_SUCCESS) {
+                LOG_INFO(LOG_DATABASE, "Error deleting transaction DB in LMDB [remove_transactions] - kth_db_del: ", res);
+                return result_code::other;
+            }
         }
 
         ++pos;
     }
 
+    counters_.indexed = std::min<uint64_t>(counters_.indexed, height);
+
 
     /*auto key = kth_db_make_value(sizeof(height), &height);
     KTH_DB_val value;
@@ -361,8 +467,13 @@ result_code internal_database_basis<Clock>::remove_transactions(domain::chain::b
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::update_transaction(domain::chain::transaction const& tx, uint32_t height, uint32_t median_time_past, uint32_t position, KTH_DB_txn* db_txn) {
-    auto key_arr = tx.hash();                                    //TODO(fernando): podría estar afuera de la DBTx
-    auto key  = kth_db_make_value(key_arr.size(), key_arr.data());
+    // transaction_db is keyed by id, not by hash.
+    tx_id_t id;
+    if ( ! find_transaction(tx.hash(), id, db_txn).is_valid()) {
+        LOG_INFO(LOG_DATABASE, "Key not found in Transaction DB [update_transaction] ");
+        return result_code::key_not_found;
+    }
+    auto key = kth_db_make_value(sizeof(id), &id);
 
     auto valuearr = transaction_entry::factory_to_data(tx, height, median_time_past, position);
     auto value = kth_db_make_value(valuearr.size(), valuearr.data());
@@ -421,15 +532,12 @@ result_code internal_database_basis<Clock>::set_unspend(domain::chain::output_po
 }
 #endif // ! defined(KTH_DB_READONLY)
 
+#if ! defined(KTH_DB_READONLY)
 template <typename Clock>
-uint64_t internal_database_basis<Clock>::get_tx_count(KTH_DB_txn* db_txn) const {
-  MDB_stat db_stats;
-  auto ret = mdb_stat(db_txn, dbi_transaction_db_, &db_stats);
-  if (ret != KTH_DB_SUCCESS) {
-      return max_uint64;
-  }
-  return db_stats.ms_entries;
+uint64_t internal_database_basis<Clock>::get_tx_count() const {
+    return counters_.txs;
 }
+#endif // ! defined(KTH_DB_READONLY)
 
 
 
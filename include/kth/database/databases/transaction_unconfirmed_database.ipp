@@ -12,17 +12,14 @@ namespace kth::database {
 template <typename Clock>
 transaction_unconfirmed_entry internal_database_basis<Clock>::get_transaction_unconfirmed(hash_digest const& hash) const {
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
         return {};
     }
 
     auto const& ret = get_transaction_unconfirmed(hash, db_txn);
 
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return {};
-    }
+    read_txns_.release(db_txn);
 
     return ret;
 }
@@ -44,19 +41,24 @@ transaction_unconfirmed_entry internal_database_basis<Clock>::get_transaction_un
 
 template <typename Clock>
 std::vector<transaction_unconfirmed_entry> internal_database_basis<Clock>::get_all_transaction_unconfirmed() const {
+    auto db_txn = read_txns_.acquire();
+    if (db_txn == nullptr) {
+        return {};
+    }
 
-    std::vector<transaction_unconfirmed_entry> result;
+    auto result = get_all_transaction_unconfirmed(db_txn);
+    read_txns_.release(db_txn);
+    return result;
+}
 
-    KTH_DB_txn* db_txn;
-    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
-    if (res != KTH_DB_SUCCESS) {
-        return result;
-    }
+template <typename Clock>
+std::vector<transaction_unconfirmed_entry> internal_database_basis<Clock>::get_all_transaction_unconfirmed(KTH_DB_txn* db_txn) const {
+
+    std::vector<transaction_unconfirmed_entry> result;
 
     KTH_DB_cursor* cursor;
 
     if (kth_db_cursor_open(db_txn, dbi_transaction_unconfirmed_db_, &cursor) != KTH_DB_SUCCESS) {
-        kth_db_txn_commit(db_txn);
         return result;
     }
 
@@ -79,11 +81,6 @@ std::vector<transaction_unconfirmed_entry> internal_database_basis<Clock>::get_a
     }
 
     kth_db_cursor_close(cursor);
-
-    if (kth_db_txn_commit(db_txn) != KTH_DB_SUCCESS) {
-        return result;
-    }
-
     return result;
 }
 
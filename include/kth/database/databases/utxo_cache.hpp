@@ -0,0 +1,108 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_UTXO_CACHE_HPP_
+#define KTH_DATABASE_UTXO_CACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <kth/domain.hpp>
+#include <kth/database/define.hpp>
+
+namespace kth::database {
+
+// In-memory write-back cache for dbi_utxo_.
+// Outputs created by a block are kept here (already serialized) instead of
+// being written to LMDB. If they are spent while they are still cached they
+// never reach the database. The survivors are flushed in batches, oldest
+// heights first, when the cache reaches its capacity.
+//
+// Every mutation is recorded in a journal so the changes made during an LMDB
+// write transaction can be undone if the transaction is aborted. Savepoints
+// allow undoing only the changes made by a nested transaction.
+// Readers are allowed from any thread; mutations are expected from the
+// single writer thread only.
+class KD_API utxo_cache {
+public:
+    struct entry {
+        data_chunk value;
+        uint32_t height;
+    };
+
+    using point_t = domain::chain::point;
+    using flush_list = std::vector<std::pair<data_chunk, data_chunk>>;   // (key, value) sorted by key
+
+    explicit
+    utxo_cache(size_t capacity);
+
+    // Non-copyable, non-movable
+    utxo_cache(utxo_cache const&) = delete;
+    utxo_cache& operator=(utxo_cache const&) = delete;
+
+    bool enabled() const;
+    size_t capacity() const;
+    size_t size() const;
+    bool empty() const;
+    bool full() const;
+
+    // Every cached entry was created at or above this height, max_uint32 if
+    // there are none. The outputs of the blocks below it are all in the DB.
+    uint32_t lowest_height() const;
+
+    std::optional<data_chunk> find(point_t const& point) const;
+
+    // Returns false if the point is already cached.
+    bool insert(point_t const& point, data_chunk value, uint32_t height);
+
+    // Returns the cached entry if the point was cached (spent before flush).
+    std::optional<entry> remove(point_t const& point);
+
+    // Moves the entries to be written to LMDB out of the cache.
+    // When `all` is false only the oldest entries are taken, enough to bring
+    // the cache down to 3/4 of its capacity.
+    flush_list take_flush_batch(bool all);
+
+    // Accept or undo the mutations made since the last commit.
+    size_t savepoint() const;
+    void commit();
+    void rollback(size_t savepoint = 0);
+
+private:
+    enum class operation {
+        inserted,
+        removed,
+        flushed
+    };
+
+    struct journal_entry {
+        operation op;
+        point_t point;
+        entry removed;
+    };
+
+    uint32_t flush_cutoff_height(size_t to_evict) const;
+
+    size_t const capacity_;
+    std::unordered_map<point_t, entry> entries_;
+
+    // Taken by take_flush_batch() and written to the open write transaction,
+    // still visible to readers until that transaction is committed.
+    std::unordered_map<point_t, entry> flushing_;
+
+    std::vector<journal_entry> journal_;
+
+    uint32_t lowest_height_ = max_uint32;
+
+    mutable std::shared_mutex mutex_;
+};
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_UTXO_CACHE_HPP_
@@ -13,8 +13,18 @@ namespace kth::database {
 
 template <typename Clock>
 result_code internal_database_basis<Clock>::remove_utxo(uint32_t height, domain::chain::output_point const& point, bool insert_reorg, KTH_DB_txn* db_txn) {
-    auto keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);      //TODO(fernando): podría estar afuera de la DBTx
-    auto key = kth_db_make_value(keyarr.size(), keyarr.data());                 //TODO(fernando): podría estar afuera de la DBTx
+    auto keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);
+    return remove_utxo(height, point, keyarr, insert_reorg, db_txn);
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::remove_utxo(uint32_t height, domain::chain::output_point const& point, data_chunk const& keyarr, bool insert_reorg, KTH_DB_txn* db_txn) {
+    if (use_utxo_cache_ && utxo_cache_.remove(point)) {
+        // Created and spent while cached, it never reaches the DB.
+        return result_code::success;
+    }
+
+    auto key = kth_db_make_value(keyarr.size(), const_cast<uint8_t*>(keyarr.data()));
 
     if (insert_reorg) {
         auto res0 = insert_reorg_pool(height, key, db_txn);
@@ -34,12 +44,19 @@ result_code internal_database_basis<Clock>::remove_utxo(uint32_t height, domain:
 }
 
 template <typename Clock>
-result_code internal_database_basis<Clock>::insert_utxo(domain::chain::output_point const& point, domain::chain::output const& output, data_chunk const& fixed_data, KTH_DB_txn* db_txn) {
-    auto keyarr = point.to_data(KTH_INTERNAL_DB_WIRE);                  //TODO(fernando): podría estar afuera de la DBTx
-    auto valuearr = utxo_entry::to_data_with_fixed(output, fixed_data);     //TODO(fernando): podría estar afuera de la DBTx
+result_code internal_database_basis<Clock>::insert_utxo(domain::chain::output_point const& point, data_chunk const& keyarr, data_chunk const& valuearr, uint32_t height, KTH_DB_txn* db_txn) {
+    if (use_utxo_cache_) {
+        // Note: only duplicates against the cache are detected here, duplicates against
+        //       the DB are detected (and ignored) when the cache is flushed.
+        if ( ! utxo_cache_.insert(point, valuearr, height)) {
+            LOG_DEBUG(LOG_DATABASE, "Duplicate Key inserting UTXO in cache [insert_utxo]");
+            return result_code::duplicated_key;
+        }
+        return result_code::success;
+    }
 
-    auto key = kth_db_make_value(keyarr.size(), keyarr.data());                           //TODO(fernando): podría estar afuera de la DBTx
-    auto value = kth_db_make_value(valuearr.size(), valuearr.data());                       //TODO(fernando): podría estar afuera de la DBTx
+    auto key = kth_db_make_value(keyarr.size(), const_cast<uint8_t*>(keyarr.data()));
+    auto value = kth_db_make_value(valuearr.size(), const_cast<uint8_t*>(valuearr.data()));
     auto res = kth_db_put(db_txn, dbi_utxo_, &key, &value, KTH_DB_NOOVERWRITE);
 
     if (res == KTH_DB_KEYEXIST) {
@@ -53,6 +70,264 @@ result_code internal_database_basis<Clock>::insert_utxo(domain::chain::output_po
     return result_code::success;
 }
 
+// The UTXO keys of a block are random outpoints, they are applied in key order
+// through a single cursor so each B-tree page is visited once.
+template <typename Clock>
+result_code internal_database_basis<Clock>::insert_utxos(std::vector<prepared_output const*>& outputs, KTH_DB_txn* db_txn) {
+    if (outputs.empty()) {
+        return result_code::success;
+    }
+
+    std::sort(outputs.begin(), outputs.end(), [](auto a, auto b) {
+        return a->key < b->key;
+    });
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_utxo_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    for (auto const* output : outputs) {
+        auto key = kth_db_make_value(output->key.size(), const_cast<uint8_t*>(output->key.data()));
+        auto value = kth_db_make_value(output->value.size(), const_cast<uint8_t*>(output->value.data()));
+
+        auto res = kth_db_cursor_put(cursor, &key, &value, KTH_DB_NOOVERWRITE);
+        if (res == KTH_DB_KEYEXIST) {
+            LOG_DEBUG(LOG_DATABASE, "Duplicate Key inserting UTXO [insert_utxos] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::duplicated_key;
+        }
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error inserting UTXO [insert_utxos] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+    }
+
+    kth_db_cursor_close(cursor);
+    return result_code::success;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::remove_utxos(std::vector<prepared_input const*>& inputs, uint32_t height, bool insert_reorg, KTH_DB_txn* db_txn) {
+    if (inputs.empty()) {
+        return result_code::success;
+    }
+
+    std::sort(inputs.begin(), inputs.end(), [](auto a, auto b) {
+        return a->key < b->key;
+    });
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_utxo_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    for (auto const* input : inputs) {
+        auto key = kth_db_make_value(input->key.size(), const_cast<uint8_t*>(input->key.data()));
+        KTH_DB_val value;
+
+        auto res = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET);
+        if (res == KTH_DB_NOTFOUND) {
+            LOG_INFO(LOG_DATABASE, "Key not found deleting UTXO [remove_utxos] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::key_not_found;
+        }
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error getting UTXO [remove_utxos] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+
+        if (insert_reorg) {
+            auto res0 = insert_reorg_pool(height, key, value, db_txn);
+            if (res0 != result_code::success) {
+                kth_db_cursor_close(cursor);
+                return res0;
+            }
+        }
+
+        res = kth_db_cursor_del(cursor, 0);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error deleting UTXO [remove_utxos] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+    }
+
+    kth_db_cursor_close(cursor);
+    return result_code::success;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::flush_utxo_cache(bool all, KTH_DB_txn* db_txn) {
+    if (utxo_cache_.empty()) {
+        return result_code::success;
+    }
+
+    auto const batch = utxo_cache_.take_flush_batch(all);
+    if (batch.empty()) {
+        return result_code::success;
+    }
+
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi_utxo_, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    // Keys are sorted, the cursor keeps its position between inserts.
+    for (auto const& x : batch) {
+        auto key = kth_db_make_value(x.first.size(), const_cast<uint8_t*>(x.first.data()));
+        auto value = kth_db_make_value(x.second.size(), const_cast<uint8_t*>(x.second.data()));
+
+        auto res = kth_db_cursor_put(cursor, &key, &value, KTH_DB_NOOVERWRITE);
+        if (res == KTH_DB_KEYEXIST) {
+            LOG_DEBUG(LOG_DATABASE, "Duplicate Key flushing UTXO cache [flush_utxo_cache] ", res);
+            continue;
+        }
+        if (res != KTH_DB_SUCCESS) {
+            LOG_INFO(LOG_DATABASE, "Error flushing UTXO cache [flush_utxo_cache] ", res);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+    }
+
+    kth_db_cursor_close(cursor);
+    LOG_DEBUG(LOG_DATABASE, "UTXO cache flushed: ", batch.size(), " entries, ", utxo_cache_.size(), " remaining [flush_utxo_cache]");
+    return result_code::success;
+}
+
+// Rewrites the legacy encoded values of dbi (UTXO set or reorg pool) with the
+// compact encoding, starting after last_key (from the beginning if empty).
+// At most max_entries values are rewritten, last_key is updated to the last one.
+template <typename Clock>
+result_code internal_database_basis<Clock>::upgrade_utxo_values(KTH_DB_dbi dbi, data_chunk& last_key, size_t max_entries, bool& done, KTH_DB_txn* db_txn) {
+    KTH_DB_cursor* cursor;
+    if (kth_db_cursor_open(db_txn, dbi, &cursor) != KTH_DB_SUCCESS) {
+        return result_code::other;
+    }
+
+    KTH_DB_val key;
+    KTH_DB_val value;
+    int rc;
+    if (last_key.empty()) {
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_FIRST);
+    } else {
+        key = kth_db_make_value(last_key.size(), last_key.data());
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_SET_RANGE);
+        if (rc == KTH_DB_SUCCESS && db_value_to_data_chunk(key) == last_key) {
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+        }
+    }
+
+    size_t count = 0;
+    while (rc == KTH_DB_SUCCESS && count < max_entries) {
+        auto const data = db_value_to_data_chunk(value);
+        byte_reader reader(data);
+        auto const entry = utxo_entry::from_data_legacy(reader);
+        if ( ! entry) {
+            LOG_ERROR(LOG_DATABASE, "Error decoding legacy UTXO entry [upgrade_utxo_values]");
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+
+        // The key memory could be reused by the put.
+        last_key = db_value_to_data_chunk(key);
+
+        auto new_data = entry->to_data();
+        auto new_value = kth_db_make_value(new_data.size(), new_data.data());
+        rc = kth_db_cursor_put(cursor, &key, &new_value, KTH_DB_CURRENT);
+        if (rc != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Error rewriting UTXO entry [upgrade_utxo_values] ", rc);
+            kth_db_cursor_close(cursor);
+            return result_code::other;
+        }
+
+        ++count;
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+    }
+
+    kth_db_cursor_close(cursor);
+
+    if (rc != KTH_DB_SUCCESS && rc != KTH_DB_NOTFOUND) {
+        LOG_ERROR(LOG_DATABASE, "Error iterating UTXO entries [upgrade_utxo_values] ", rc);
+        return result_code::other;
+    }
+
+    done = rc == KTH_DB_NOTFOUND;
+    return result_code::success;
+}
+
+template <typename Clock>
+result_code internal_database_basis<Clock>::update_utxo_cache_property(KTH_DB_txn* db_txn) {
+    uint8_t dirty = utxo_cache_.size() != 0 ? 1 : 0;
+
+    // Written in the transaction that flushes or fills the cache, the blocks
+    // to replay if the cache is lost (see recover_utxo_set()).
+    if (dirty != 0) {
+        uint32_t from = utxo_cache_.lowest_height();
+        property_code from_code = property_code::utxo_cache_from;
+        auto key = kth_db_make_value(sizeof(from_code), &from_code);
+        auto value = kth_db_make_value(sizeof(from), &from);
+        auto res = kth_db_put(db_txn, dbi_properties_, &key, &value, 0);
+        if (res != KTH_DB_SUCCESS) {
+            LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [update_utxo_cache_property] ", static_cast<int32_t>(res));
+            return result_code::other;
+        }
+    }
+
+    if ((dirty != 0) == utxo_cache_dirty_) {
+        return result_code::success;
+    }
+
+    property_code property_code_ = property_code::utxo_cache_dirty;
+    auto key = kth_db_make_value(sizeof(property_code_), &property_code_);
+    auto value = kth_db_make_value(sizeof(dirty), &dirty);
+
+    auto res = kth_db_put(db_txn, dbi_properties_, &key, &value, 0);
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Failed saving in DB Properties [update_utxo_cache_property] ", static_cast<int32_t>(res));
+        return result_code::other;
+    }
+    return result_code::success;
+}
+
+template <typename Clock>
+bool internal_database_basis<Clock>::flush_utxo_cache() {
+    if (utxo_cache_.empty() && ! utxo_cache_dirty_) {
+        return true;
+    }
+
+    KTH_DB_txn* db_txn;
+    auto res0 = kth_db_txn_begin(env_, NULL, 0, &db_txn);
+    if (res0 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [flush_utxo_cache] ", res0);
+        return false;
+    }
+
+    auto res = flush_utxo_cache(true, db_txn);
+    if (res == result_code::success) {
+        res = update_utxo_cache_property(db_txn);
+    }
+
+    if (res != result_code::success) {
+        kth_db_txn_abort(db_txn);
+        utxo_cache_.rollback();
+        return false;
+    }
+
+    auto res2 = kth_db_txn_commit(db_txn);
+    if (res2 != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error commiting LMDB Transaction [flush_utxo_cache] ", res2);
+        utxo_cache_.rollback();
+        return false;
+    }
+
+    utxo_cache_.commit();
+    utxo_cache_dirty_ = false;
+    return true;
+}
+
 #endif // ! defined(KTH_DB_READONLY)
 
 } // namespace kth::database
@@ -10,8 +10,29 @@
 
 namespace kth::database {
 
+// Compact encoding (db_version 1):
+//
+//   varint(height * 2 + coinbase) | median_time_past (4 bytes) | script tag (1 byte) | ...
+//
+// Standard scripts are stored as a template tag followed by the compressed
+// amount (varint) and the script hash or public key, the rest of the outputs
+// (and the ones carrying tokens) are stored in wire format after the raw tag.
+// Varints use the Bitcoin Core MSB base-128 encoding, amounts are compressed
+// as in Bitcoin Core (CompressAmount).
 class KD_API utxo_entry {
 public:
+    // Script templates of the compact encoding.
+    enum class script_tag : uint8_t {
+        p2pkh = 0,              // hash160
+        p2sh = 1,               // hash160
+        p2pk_even = 2,          // compressed public key (x coordinate)
+        p2pk_odd = 3,           // compressed public key (x coordinate)
+        p2sh32 = 4,             // hash256
+        raw = 5                 // wire output
+    };
+
+    constexpr static
+    size_t max_template_script_size = 35;
 
     utxo_entry() = default;
 
@@ -32,13 +53,17 @@ public:
 
     template <typename W, KTH_IS_WRITER(W)>
     void to_data(W& sink) const {
-        output_.to_data(sink, false);
         to_data_fixed(sink, height_, median_time_past_, coinbase_);
+        sink.write_bytes(to_data_output(output_));
     }
 
     static
     expect<utxo_entry> from_data(byte_reader& reader);
 
+    // Format used before db_version 1: wire output | height | median_time_past | coinbase.
+    static
+    expect<utxo_entry> from_data_legacy(byte_reader& reader);
+
     static
     data_chunk to_data_fixed(uint32_t height, uint32_t median_time_past, bool coinbase);
 
@@ -48,9 +73,8 @@ public:
     template <typename W, KTH_IS_WRITER(W)>
     static
     void to_data_fixed(W& sink, uint32_t height, uint32_t median_time_past, bool coinbase) {
-        sink.write_4_bytes_little_endian(height);
+        write_varint(sink, (uint64_t(height) << 1) | (coinbase ? 1 : 0));
         sink.write_4_bytes_little_endian(median_time_past);
-        sink.write_byte(coinbase);
     }
 
     static
@@ -62,15 +86,57 @@ public:
     template <typename W, KTH_IS_WRITER(W)>
     static
     void to_data_with_fixed(W& sink, domain::chain::output const& output, data_chunk const& fixed) {
-        output.to_data(sink, false);
         sink.write_bytes(fixed);
+        sink.write_bytes(to_data_output(output));
     }
 
+    // Size of the hash or public key stored for a template, 0 for raw or unknown tags.
+    static
+    size_t script_payload_size(script_tag tag);
+
+    // Writes the script of a template into out (max_template_script_size bytes), returns its size.
+    static
+    size_t script_from_template(script_tag tag, uint8_t const* payload, uint8_t* out);
+
+    static
+    uint64_t compress_amount(uint64_t amount);
+
+    static
+    uint64_t decompress_amount(uint64_t compressed);
+
 private:
     void reset();
 
-    constexpr static
-    size_t serialized_size_fixed();
+    static
+    size_t serialized_size_fixed(uint32_t height);
+
+    static
+    size_t varint_size(uint64_t n);
+
+    static
+    data_chunk to_data_output(domain::chain::output const& output);
+
+    static
+    expect<domain::chain::output> output_from_data(byte_reader& reader);
+
+    static
+    expect<uint64_t> read_varint(byte_reader& reader);
+
+    template <typename W, KTH_IS_WRITER(W)>
+    static
+    void write_varint(W& sink, uint64_t n) {
+        uint8_t tmp[10];
+        size_t len = 0;
+        while (true) {
+            tmp[len] = (n & 0x7f) | (len != 0 ? 0x80 : 0x00);
+            if (n <= 0x7f) break;
+            n = (n >> 7) - 1;
+            ++len;
+        }
+        do {
+            sink.write_byte(tmp[len]);
+        } while (len-- != 0);
+    }
 
     domain::chain::output output_;
     uint32_t height_ = max_uint32;
@@ -0,0 +1,74 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_UTXO_VIEW_HPP_
+#define KTH_DATABASE_UTXO_VIEW_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+#include <kth/domain.hpp>
+#include <kth/database/define.hpp>
+#include <kth/database/databases/utxo_entry.hpp>
+
+namespace kth::database {
+
+// Non-owning view of a compact encoded utxo_entry (see utxo_entry.hpp).
+// The fields are read in place from the LMDB value, the view is valid only
+// while the read transaction it was obtained from is alive.
+// Template scripts are rebuilt into an inline buffer, nothing is allocated
+// unless the caller asks for an owned utxo_entry (to_entry()).
+class KD_API utxo_view {
+public:
+    using bytes_t = std::span<uint8_t const>;
+
+    utxo_view() = default;
+
+    // Returns an invalid view if data is not a well formed entry.
+    static
+    utxo_view from_data(bytes_t data);
+
+    // The view keeps the buffer alive, used for entries not backed by the map (UTXO cache).
+    static
+    utxo_view from_data(data_chunk data);
+
+    bool is_valid() const;
+
+    uint64_t value() const;
+    uint32_t height() const;
+    uint32_t median_time_past() const;
+    bool coinbase() const;
+
+    // The script field carries a token prefix (CashTokens), script() returns
+    // the whole field, use to_entry() to get the token data.
+    bool tokens() const;
+
+    bytes_t script() const;
+
+    // Owned copy.
+    utxo_entry to_entry() const;
+
+private:
+    bytes_t data_;
+    std::shared_ptr<data_chunk const> owned_;
+    bool valid_ = false;
+    uint64_t value_ = 0;
+    uint32_t height_ = max_uint32;
+    uint32_t median_time_past_ = max_uint32;
+    bool coinbase_ = false;
+    bool tokens_ = false;
+
+    // Raw scripts point into data_, template scripts are rebuilt in script_buffer_.
+    bool inline_script_ = false;
+    size_t script_offset_ = 0;
+    size_t script_size_ = 0;
+    std::array<uint8_t, utxo_entry::max_template_script_size> script_buffer_;
+};
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_UTXO_VIEW_HPP_
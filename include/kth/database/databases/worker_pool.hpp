@@ -0,0 +1,64 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef KTH_DATABASE_WORKER_POOL_HPP_
+#define KTH_DATABASE_WORKER_POOL_HPP_
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <kth/database/define.hpp>
+
+namespace kth::database {
+
+// Fixed number of threads running the submitted tasks in submission order.
+// The threads are started by the first submit(), the destructor runs the
+// queued tasks and joins them.
+// A task must not wait for another task of the same pool.
+class KD_API worker_pool {
+public:
+    explicit worker_pool(size_t threads);
+    ~worker_pool();
+
+    // Non-copyable, non-movable
+    worker_pool(worker_pool const&) = delete;
+    worker_pool& operator=(worker_pool const&) = delete;
+
+    size_t size() const;
+
+    // Precondition: size() != 0.
+    template <typename F>
+    std::future<std::invoke_result_t<F>> submit(F&& f) {
+        using result_t = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(f));
+        auto res = task->get_future();
+        post([task = std::move(task)] { (*task)(); });
+        return res;
+    }
+
+private:
+    size_t const size_;
+    std::once_flag started_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::function<void()>> tasks_;
+    bool stopped_ = false;
+
+    void post(std::function<void()> task);
+    void run();
+};
+
+} // namespace kth::database
+
+#endif // KTH_DATABASE_WORKER_POOL_HPP_
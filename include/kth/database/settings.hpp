@@ -23,9 +23,23 @@ public:
     kth::path directory;
     db_mode_type db_mode;
     uint32_t reorg_pool_limit;
-    uint64_t db_max_size;
+    uint64_t db_max_size;           // Initial map size, existing DBs keep their stored size if it is larger (i.e. grown or created with the old defaults)
+    uint64_t db_growth_step;        // Bytes added to the map when it is almost full, 0 disables the growth
     bool safe_mode;
-    uint32_t cache_capacity;
+    uint32_t cache_capacity;        // UTXO cache entries used during IBD, 0 disables the cache (not used in pruned mode, a lost cache could not be restored)
+    uint32_t batch_max_blocks;      // Blocks per write transaction in push_all, 0 or 1 disables batching
+    uint64_t batch_max_bytes;       // Serialized block bytes per write transaction in push_all, 0 means unbounded
+    uint32_t pipeline_depth;        // Blocks prepared ahead of the writer in push_all, 0 disables the pipeline
+    uint32_t max_readers;           // LMDB reader slots (concurrent read transactions), 0 sizes it from the hardware concurrency
+    uint32_t worker_threads;        // Threads helping the bulk UTXO lookups and the preparation of large blocks, 0 sizes it from the hardware concurrency
+    bool index_history;             // Full mode, address history
+    bool index_history_standard;    // Full mode, address history of the P2PKH and P2SH outputs only
+    bool index_spend;               // Full mode, spender of each output
+    bool index_transaction_hash;    // Full mode, transaction lookup by hash
+    bool index_in_background;       // Full mode, history and spend are built by a background thread
+
+    // The full mode indexes enabled, they can not be changed once the DB is created.
+    db_indexes_t indexes() const;
 };
 
 } // namespace kth::database
@@ -6,9 +6,12 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <future>
 #include <memory>
 #include <type_traits>
 #include <utility>
@@ -43,6 +46,7 @@ using namespace std::placeholders;
 data_base::data_base(settings const& settings)
     : closed_(true)
     , settings_(settings)
+    , pipeline_workers_(settings.pipeline_depth)
     , store(settings.directory)
 {}
 
@@ -74,6 +78,7 @@ bool data_base::create(block const& genesis) {
     push_genesis(genesis);
 
     closed_ = false;
+    start_indexer();
     return true;
 }
 #endif // ! defined(KTH_DB_READONLY)
@@ -84,6 +89,11 @@ bool data_base::open() {
     start();
     auto const opened = internal_db_->open();
     closed_ = false;
+#if ! defined(KTH_DB_READONLY)
+    if (opened) {
+        start_indexer();
+    }
+#endif
     return opened;
 }
 
@@ -95,6 +105,9 @@ bool data_base::close() {
     }
 
     closed_ = true;
+#if ! defined(KTH_DB_READONLY)
+    stop_indexer();
+#endif
     auto const closed = internal_db_->close();
     return closed;
 }
@@ -105,7 +118,23 @@ void data_base::start() {
         internal_db_dir,
         settings_.db_mode,
         settings_.reorg_pool_limit,
-        settings_.db_max_size, settings_.safe_mode);
+        settings_.db_max_size, settings_.safe_mode,
+        settings_.cache_capacity,
+        settings_.batch_max_blocks,
+        settings_.batch_max_bytes,
+        settings_.max_readers,
+        settings_.db_growth_step,
+        settings_.indexes(),
+        get_worker_threads());
+}
+
+// protected
+// The calling thread takes its share of the work, so one less worker is needed.
+uint32_t data_base::get_worker_threads() const {
+    if (settings_.worker_threads != 0) {
+        return settings_.worker_threads;
+    }
+    return std::max(1u, std::thread::hardware_concurrency()) - 1;
 }
 
 // Readers.
@@ -115,6 +144,15 @@ internal_database const& data_base::internal_db() const {
     return *internal_db_;
 }
 
+data_base::push_statistics data_base::push_stats() const {
+    return {
+        size_t(pushed_blocks_.load()),
+        std::chrono::nanoseconds(prepare_ns_.load()),
+        std::chrono::nanoseconds(wait_ns_.load()),
+        std::chrono::nanoseconds(write_ns_.load())
+    };
+}
+
 // Synchronous writers.
 // ----------------------------------------------------------------------------
 
@@ -229,6 +267,72 @@ code data_base::push_genesis(block const& block) {
 
     return error::success;
 }
+
+// Without index_in_background the indexer only catches up the blocks left
+// behind by an earlier run in the background, then push indexes the blocks.
+void data_base::start_indexer() {
+    auto const indexes = settings_.indexes();
+    if (indexer_.joinable() || settings_.db_mode != db_mode_type::full || (indexes & (db_index_history | db_index_spend)) == 0) {
+        return;
+    }
+
+    if ((indexes & db_index_deferred) == 0 && internal_db_->is_index_complete()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(indexer_mutex_);
+        indexer_stopped_ = false;
+    }
+    indexer_ = std::thread(&data_base::run_indexer, this);
+}
+
+void data_base::stop_indexer() {
+    if ( ! indexer_.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(indexer_mutex_);
+        indexer_stopped_ = true;
+    }
+    indexer_condition_.notify_all();
+    indexer_.join();
+}
+
+void data_base::run_indexer() {
+    // Blocks per write transaction, the writers wait for it.
+    constexpr uint32_t max_blocks = 100;
+    constexpr auto idle_wait = std::chrono::seconds(1);
+
+    auto const deferred = (settings_.indexes() & db_index_deferred) != 0;
+
+    std::unique_lock<std::mutex> lock(indexer_mutex_);
+    while ( ! indexer_stopped_) {
+        lock.unlock();
+
+        // Checked on a read transaction, the writers are not held for nothing.
+        auto const complete = internal_db_->is_index_complete();
+        if (complete && ! deferred) {
+            return;
+        }
+
+        uint32_t indexed = 0;
+        auto res = result_code::success;
+        if ( ! complete) {
+            res = internal_db_->index_blocks(max_blocks, indexed);
+            if (res != result_code::success) {
+                LOG_ERROR(LOG_DATABASE, "Error building the history and spend indexes [run_indexer] ", static_cast<int32_t>(res));
+            }
+        }
+        lock.lock();
+
+        // Caught up with the tip or failed, retried when more blocks are pushed.
+        if (res != result_code::success || indexed < max_blocks) {
+            indexer_condition_.wait_for(lock, idle_wait, [this] { return indexer_stopped_; });
+        }
+    }
+}
 #endif // ! defined(KTH_DB_READONLY)
 
 
@@ -288,16 +392,124 @@ bool data_base::pop_outputs(const output::list& outputs, size_t height) {
 // ----------------------------------------------------------------------------
 
 #if ! defined(KTH_DB_READONLY)
+
+static inline
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
 // Add a list of blocks in order.
 // If the dispatch threadpool is shut down when this is running the handler
 // will never be invoked, resulting in a threadpool.join indefinite hang.
 void data_base::push_all(block_const_ptr_list_const_ptr in_blocks, size_t first_height, dispatcher& dispatch, result_handler handler) {
     DEBUG_ONLY(*safe_add(in_blocks->size(), first_height));
 
+    auto const single_writer = settings_.batch_max_blocks > 1 || settings_.batch_max_bytes != 0 || settings_.pipeline_depth > 0;
+    if (single_writer && in_blocks->size() > 1) {
+        // LMDB write transactions are bound to a thread, the whole batch is pushed from one.
+        dispatch.concurrent(&data_base::do_push_all, this, in_blocks, first_height, handler);
+        return;
+    }
+
     // This is the beginning of the push_all sequence.
     push_next(error::success, in_blocks, 0, first_height, dispatch, handler);
 }
 
+// Blocks are prepared (hashed and serialized) by the pipeline_depth workers,
+// up to pipeline_depth blocks ahead of the writer, the writer applies them in
+// height order.
+void data_base::do_push_all(block_const_ptr_list_const_ptr blocks, size_t first_height, result_handler handler) {
+    using clock = std::chrono::steady_clock;
+    auto const depth = size_t(settings_.pipeline_depth);
+    // Pipelined blocks are prepared on one thread each, the pipeline is the parallelism.
+    auto const prepare_threads = depth == 0 ? size_t(get_worker_threads()) + 1 : 1;
+
+    auto prepare = [this, blocks, first_height, prepare_threads](size_t index) {
+        auto const start = clock::now();
+        auto const& block = *(*blocks)[index];
+        auto const median_time_past = block.header().validation.median_time_past;
+        auto res = internal_db_->prepare_block(block, uint32_t(first_height + index), median_time_past, prepare_threads);
+        prepare_ns_ += elapsed_ns(start);
+        return res;
+    };
+
+    // Pending preparations must be waited for before returning, they capture prepare.
+    std::deque<std::future<prepared_block>> pending;
+    size_t next = 0;
+    auto const fill = [&]() {
+        while (next < blocks->size() && pending.size() < depth) {
+            pending.push_back(pipeline_workers_.submit([&prepare, index = next] { return prepare(index); }));
+            ++next;
+        }
+    };
+
+    auto const batch_start = clock::now();
+    auto const stats_before = push_stats();
+
+    internal_db_->begin_batch();
+    fill();
+
+    for (size_t index = 0; index < blocks->size(); ++index) {
+        auto const& block = (*blocks)[index];
+
+        auto start = clock::now();
+        auto prepared = [&]() {
+            if (depth == 0) {
+                return prepare(index);
+            }
+            auto res = pending.front().get();
+            pending.pop_front();
+            wait_ns_ += elapsed_ns(start);
+            return res;
+        }();
+        fill();
+
+        block->validation.start_push = asio::steady_clock::now();
+        start = clock::now();
+
+        auto res = internal_db_->push_block(prepared);
+        if ( ! succeed(res)) {
+            // With safe_mode the blocks pushed before the failing one are kept,
+            // otherwise only the ones of the committed batches.
+            auto const uncommitted = internal_db_->discarded_blocks();
+            if (uncommitted != 0) {
+                auto const failed = first_height + index;
+                LOG_ERROR(LOG_DATABASE, "push_all: block ", failed, " failed, blocks ", failed - uncommitted, " to ", failed - 1, " discarded with the batch");
+                pushed_blocks_ -= uncommitted;
+                for (auto it = blocks->begin() + (index - uncommitted); it != blocks->begin() + index; ++it) {
+                    (*it)->validation.end_push = {};
+                }
+            }
+            internal_db_->end_batch();
+            for (auto& preparation : pending) {
+                preparation.wait();
+            }
+            handler(error::operation_failed_7); //TODO(fernando): create a new operation_failed
+            return;
+        }
+
+        write_ns_ += elapsed_ns(start);
+        ++pushed_blocks_;
+        block->validation.end_push = asio::steady_clock::now();
+    }
+
+    auto const commit_start = clock::now();
+    if (internal_db_->end_batch() != result_code::success) {
+        handler(error::operation_failed_7); //TODO(fernando): create a new operation_failed
+        return;
+    }
+    write_ns_ += elapsed_ns(commit_start);
+
+    auto const stats = push_stats();
+    LOG_DEBUG(LOG_DATABASE, "push_all: ", blocks->size(), " blocks in "
+        , std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - batch_start).count(), " ms (prepare: "
+        , std::chrono::duration_cast<std::chrono::milliseconds>(stats.prepare - stats_before.prepare).count(), " ms, wait: "
+        , std::chrono::duration_cast<std::chrono::milliseconds>(stats.wait - stats_before.wait).count(), " ms, write: "
+        , std::chrono::duration_cast<std::chrono::milliseconds>(stats.write - stats_before.write).count(), " ms)");
+
+    handler(error::success);
+}
+
 // TODO(legacy): resolve inconsistency with height and median_time_past passing.
 void data_base::push_next(code const& ec, block_const_ptr_list_const_ptr blocks, size_t index, size_t height, dispatcher& dispatch, result_handler handler) {
     if (ec || index >= blocks->size()) {
@@ -320,11 +532,14 @@ void data_base::push_next(code const& ec, block_const_ptr_list_const_ptr blocks,
 
 void data_base::do_push(block_const_ptr block, size_t height, uint32_t median_time_past, dispatcher& dispatch, result_handler handler) {
     // LOG_DEBUG(LOG_DATABASE, "Write flushed to disk: ", ec.message());
+    auto const start = std::chrono::steady_clock::now();
     auto res = internal_db_->push_block(*block, height, median_time_past);
     if ( ! succeed(res)) {
         handler(error::operation_failed_7); //TODO(fernando): create a new operation_failed
         return;
     }
+    write_ns_ += elapsed_ns(start);
+    ++pushed_blocks_;
     block->validation.end_push = asio::steady_clock::now();
     // This is the end of the block sub-sequence.
     handler(error::success);
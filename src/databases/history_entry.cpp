@@ -4,6 +4,7 @@
 
 #include <kth/database/databases/history_entry.hpp>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 
@@ -55,19 +56,28 @@ bool history_entry::is_valid() const {
     return id_ != max_uint64 && point_.is_valid() && height_ != kth::max_uint32 && index_ != max_uint32 && value_or_checksum_ != max_uint64;
 }
 
-// Size.
-//-----------------------------------------------------------------------------
-// constexpr
-//TODO(fernando): make domain::chain::point::serialized_size() static and constexpr to make this constexpr too
-size_t history_entry::serialized_size(domain::chain::point const& point) {
-    return sizeof(uint64_t) + point.serialized_size(false) + sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t);
-}
-
 // Deserialization.
 //-----------------------------------------------------------------------------
 
+// static
+history_entry history_entry::from_row(history_row const& row) {
+    return history_entry(row.id(), row.point(), row.point_kind(), row.height(), row.index(), row.value_or_checksum());
+}
+
 // static
 expect<history_entry> history_entry::from_data(byte_reader& reader) {
+    auto const bytes = reader.read_bytes(sizeof(history_row));
+    if ( ! bytes) {
+        return make_unexpected(bytes.error());
+    }
+
+    history_row row;
+    std::copy(bytes->begin(), bytes->end(), reinterpret_cast<uint8_t*>(&row));
+    return from_row(row);
+}
+
+// static
+expect<history_entry> history_entry::from_data_legacy(byte_reader& reader) {
     auto const id = reader.read_little_endian<uint64_t>();
     if ( ! id) {
         return make_unexpected(id.error());
@@ -114,7 +124,7 @@ expect<history_entry> history_entry::from_data(byte_reader& reader) {
 // static
 data_chunk history_entry::factory_to_data(uint64_t id, domain::chain::point const& point, domain::chain::point_kind kind, uint32_t height, uint32_t index, uint64_t value_or_checksum) {
     data_chunk data;
-    auto const size = serialized_size(point);
+    auto const size = serialized_size();
     data.reserve(size);
     data_sink ostream(data);
     factory_to_data(ostream, id, point, kind, height, index, value_or_checksum);
@@ -134,7 +144,7 @@ void history_entry::factory_to_data(std::ostream& stream, uint64_t id, domain::c
 
 data_chunk history_entry::to_data() const {
     data_chunk data;
-    auto const size = serialized_size(point_);
+    auto const size = serialized_size();
     data.reserve(size);
     data_sink ostream(data);
     to_data(ostream);
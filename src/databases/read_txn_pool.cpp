@@ -0,0 +1,209 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <kth/database/databases/read_txn_pool.hpp>
+
+#include <utility>
+#include <vector>
+
+#include <kth/infrastructure/log/source.hpp>
+
+namespace kth::database {
+
+read_txn_pool::~read_txn_pool() {
+    close();
+}
+
+void read_txn_pool::open(KTH_DB_env* env, size_t capacity, size_t max_readers) {
+    env_ = env;
+    capacity_ = capacity;
+    max_readers_ = max_readers;
+    saturation_logged_ = false;
+    slots_ = std::make_unique<std::atomic<KTH_DB_txn*>[]>(capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        slots_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+void read_txn_pool::close() {
+    for (size_t i = 0; i < capacity_; ++i) {
+        auto db_txn = slots_[i].exchange(nullptr, std::memory_order_acquire);
+        if (db_txn != nullptr) {
+            abort(db_txn);
+        }
+    }
+    slots_.reset();
+    capacity_ = 0;
+    env_ = nullptr;
+}
+
+size_t read_txn_pool::capacity() const {
+    return capacity_;
+}
+
+KTH_DB_txn* read_txn_pool::acquire() {
+    enter();
+    // Threads start scanning at different slots to avoid contending on the first ones.
+    auto const start = capacity_ != 0 ? next_.fetch_add(1, std::memory_order_relaxed) % capacity_ : 0;
+    for (size_t i = 0; i < capacity_; ++i) {
+        auto& slot = slots_[(start + i) % capacity_];
+        if (slot.load(std::memory_order_relaxed) == nullptr) {
+            continue;
+        }
+        auto db_txn = slot.exchange(nullptr, std::memory_order_acquire);
+        if (db_txn == nullptr) {
+            continue;
+        }
+        if (kth_db_txn_renew(db_txn) == KTH_DB_SUCCESS) {
+            ++reused_;
+            return db_txn;
+        }
+        abort(db_txn);
+    }
+
+    KTH_DB_txn* db_txn;
+    auto res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
+
+#if ! defined(KTH_USE_LIBMDBX)
+    // The map was grown by another process.
+    if (res == KTH_DB_MAP_RESIZED) {
+        leave();
+        resize_map(0, default_resize_timeout);
+        enter();
+        res = kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn);
+    }
+#endif
+
+    if (res == KTH_DB_READERS_FULL) {
+        LOG_ERROR(LOG_DATABASE, "Reader table full, increase max_readers (", max_readers_, " slots, ", readers(), " held by the pool) [read_txn_pool::acquire]");
+        leave();
+        return nullptr;
+    }
+    if (res != KTH_DB_SUCCESS) {
+        LOG_ERROR(LOG_DATABASE, "Error begining LMDB Transaction [read_txn_pool::acquire] ", res);
+        leave();
+        return nullptr;
+    }
+    ++created_;
+    on_reader_created();
+    return db_txn;
+}
+
+void read_txn_pool::release(KTH_DB_txn* db_txn) {
+    if (db_txn == nullptr) {
+        return;
+    }
+
+    kth_db_txn_reset(db_txn);
+    leave();
+
+    auto const start = capacity_ != 0 ? next_.load(std::memory_order_relaxed) % capacity_ : 0;
+    for (size_t i = 0; i < capacity_; ++i) {
+        auto& slot = slots_[(start + i) % capacity_];
+        KTH_DB_txn* expected = nullptr;
+        if (slot.compare_exchange_strong(expected, db_txn, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+    abort(db_txn);
+}
+
+size_t read_txn_pool::reused() const {
+    return reused_.load(std::memory_order_relaxed);
+}
+
+size_t read_txn_pool::created() const {
+    return created_.load(std::memory_order_relaxed);
+}
+
+size_t read_txn_pool::readers() const {
+    return readers_.load(std::memory_order_relaxed);
+}
+
+size_t read_txn_pool::peak_readers() const {
+    return peak_readers_.load(std::memory_order_relaxed);
+}
+
+size_t read_txn_pool::max_readers() const {
+    return max_readers_;
+}
+
+// A thread holding a transaction is not blocked: it could be waiting on
+// another reader (a snapshot holder calling a getter, get_utxos() waiting on
+// its workers) and the resize waits for its transaction in any case.
+void read_txn_pool::enter() {
+    auto& held = held_by_thread();
+    while (true) {
+        ++active_;
+        if (held != 0 || ! resizing_) {
+            break;
+        }
+        if (--active_ == 0) {
+            std::lock_guard lock(gate_mutex_);
+            gate_.notify_all();
+        }
+        std::unique_lock lock(gate_mutex_);
+        gate_.wait(lock, [this] { return ! resizing_; });
+    }
+    ++held;
+}
+
+void read_txn_pool::leave() {
+    auto& held = held_by_thread();
+    if (held != 0) {
+        --held;
+    }
+    if (--active_ == 0 && resizing_) {
+        std::lock_guard lock(gate_mutex_);
+        gate_.notify_all();
+    }
+}
+
+std::optional<int> read_txn_pool::resize_map(uint64_t size, std::chrono::milliseconds timeout) {
+    std::lock_guard resize_lock(resize_mutex_);
+    std::unique_lock lock(gate_mutex_);
+    resizing_ = true;
+    auto const idle = gate_.wait_for(lock, timeout, [this] { return active_ == 0; });
+
+    std::optional<int> res;
+    if (idle) {
+        res = kth_db_env_set_mapsize(env_, size);
+    }
+    resizing_ = false;
+    lock.unlock();
+    gate_.notify_all();
+    return res;
+}
+
+// private
+void read_txn_pool::abort(KTH_DB_txn* db_txn) {
+    kth_db_txn_abort(db_txn);
+    --readers_;
+}
+
+// private
+// Transactions entered by the calling thread, per pool.
+size_t& read_txn_pool::held_by_thread() const {
+    thread_local std::vector<std::pair<read_txn_pool const*, size_t>> held;
+    for (auto& entry : held) {
+        if (entry.first == this) {
+            return entry.second;
+        }
+    }
+    return held.emplace_back(this, 0).second;
+}
+
+// private
+void read_txn_pool::on_reader_created() {
+    auto const readers = ++readers_;
+    auto peak = peak_readers_.load(std::memory_order_relaxed);
+    while (readers > peak && ! peak_readers_.compare_exchange_weak(peak, readers, std::memory_order_relaxed)) {}
+
+    // Logged once, the pool alone is using 90% of the reader table.
+    if (readers * 10 >= max_readers_ * 9 && ! saturation_logged_.exchange(true)) {
+        LOG_INFO(LOG_DATABASE, "Reader table almost full: ", readers, " of ", max_readers_, " slots held by the read transaction pool, consider increasing max_readers.");
+    }
+}
+
+} // namespace kth::database
@@ -0,0 +1,192 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <kth/database/databases/utxo_cache.hpp>
+
+#include <algorithm>
+#include <mutex>
+
+#include <kth/database/databases/internal_database.hpp>     // KTH_INTERNAL_DB_WIRE
+
+namespace kth::database {
+
+utxo_cache::utxo_cache(size_t capacity)
+    : capacity_(capacity)
+{}
+
+bool utxo_cache::enabled() const {
+    return capacity_ > 0;
+}
+
+size_t utxo_cache::capacity() const {
+    return capacity_;
+}
+
+size_t utxo_cache::size() const {
+    std::shared_lock lock(mutex_);
+    return entries_.size();
+}
+
+bool utxo_cache::empty() const {
+    std::shared_lock lock(mutex_);
+    return entries_.empty() && flushing_.empty();
+}
+
+bool utxo_cache::full() const {
+    std::shared_lock lock(mutex_);
+    return entries_.size() >= capacity_;
+}
+
+uint32_t utxo_cache::lowest_height() const {
+    std::shared_lock lock(mutex_);
+    return lowest_height_;
+}
+
+std::optional<data_chunk> utxo_cache::find(point_t const& point) const {
+    std::shared_lock lock(mutex_);
+
+    auto it = entries_.find(point);
+    if (it != entries_.end()) {
+        return it->second.value;
+    }
+
+    it = flushing_.find(point);
+    if (it != flushing_.end()) {
+        return it->second.value;
+    }
+
+    return std::nullopt;
+}
+
+bool utxo_cache::insert(point_t const& point, data_chunk value, uint32_t height) {
+    std::unique_lock lock(mutex_);
+
+    if (flushing_.count(point) != 0) {
+        return false;
+    }
+
+    auto const was_empty = entries_.empty();
+    auto const res = entries_.emplace(point, entry{std::move(value), height});
+    if ( ! res.second) {
+        return false;
+    }
+    lowest_height_ = was_empty ? height : std::min(lowest_height_, height);
+
+    journal_.push_back(journal_entry{operation::inserted, point, {}});
+    return true;
+}
+
+std::optional<utxo_cache::entry> utxo_cache::remove(point_t const& point) {
+    std::unique_lock lock(mutex_);
+
+    auto it = entries_.find(point);
+    if (it == entries_.end()) {
+        return std::nullopt;
+    }
+
+    entry removed = std::move(it->second);
+    entries_.erase(it);
+    journal_.push_back(journal_entry{operation::removed, point, removed});
+    return removed;
+}
+
+// private
+uint32_t utxo_cache::flush_cutoff_height(size_t to_evict) const {
+    std::vector<uint32_t> heights;
+    heights.reserve(entries_.size());
+    for (auto const& x : entries_) {
+        heights.push_back(x.second.height);
+    }
+
+    auto const nth = heights.begin() + (to_evict - 1);
+    std::nth_element(heights.begin(), nth, heights.end());
+    return *nth;
+}
+
+utxo_cache::flush_list utxo_cache::take_flush_batch(bool all) {
+    std::unique_lock lock(mutex_);
+
+    flush_list res;
+    if (entries_.empty()) {
+        return res;
+    }
+
+    auto const target = all ? 0 : (capacity_ / 4) * 3;
+    if (entries_.size() <= target) {
+        return res;
+    }
+
+    auto const cutoff = all ? max_uint32 : flush_cutoff_height(entries_.size() - target);
+
+    res.reserve(all ? entries_.size() : entries_.size() - target);
+    for (auto it = entries_.begin(); it != entries_.end(); ) {
+        if (it->second.height > cutoff) {
+            ++it;
+            continue;
+        }
+
+        res.emplace_back(it->first.to_data(KTH_INTERNAL_DB_WIRE), it->second.value);
+        journal_.push_back(journal_entry{operation::flushed, it->first, {}});
+        flushing_.emplace(it->first, std::move(it->second));
+        it = entries_.erase(it);
+    }
+
+    // The entries left are above the cutoff.
+    lowest_height_ = entries_.empty() ? max_uint32 : cutoff + 1;
+
+    // Sorted keys make the LMDB inserts append-like, touching each page once.
+    std::sort(res.begin(), res.end(), [](auto const& a, auto const& b) {
+        return a.first < b.first;
+    });
+
+    return res;
+}
+
+size_t utxo_cache::savepoint() const {
+    std::shared_lock lock(mutex_);
+    return journal_.size();
+}
+
+void utxo_cache::commit() {
+    std::unique_lock lock(mutex_);
+    flushing_.clear();
+    journal_.clear();
+}
+
+void utxo_cache::rollback(size_t savepoint) {
+    std::unique_lock lock(mutex_);
+
+    // Undo in reverse order, the same point could be inserted, flushed and removed.
+    while (journal_.size() > savepoint) {
+        auto& x = journal_.back();
+        switch (x.op) {
+            case operation::inserted: {
+                entries_.erase(x.point);
+                break;
+            }
+            case operation::removed: {
+                entries_.emplace(x.point, std::move(x.removed));
+                break;
+            }
+            case operation::flushed: {
+                // Not written, put it back.
+                auto it = flushing_.find(x.point);
+                if (it != flushing_.end()) {
+                    entries_.emplace(x.point, std::move(it->second));
+                    flushing_.erase(it);
+                }
+                break;
+            }
+        }
+        journal_.pop_back();
+    }
+
+    // Flushed entries could be back.
+    lowest_height_ = max_uint32;
+    for (auto const& x : entries_) {
+        lowest_height_ = std::min(lowest_height_, x.second.height);
+    }
+}
+
+} // namespace kth::database
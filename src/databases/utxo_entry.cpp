@@ -4,14 +4,47 @@
 
 #include <kth/database/databases/utxo_entry.hpp>
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 
 // #include <kth/infrastructure.hpp>
 #include <kth/infrastructure/utility/ostream_writer.hpp>
 
 namespace kth::database {
 
+namespace {
+
+constexpr size_t amount_size = sizeof(uint64_t);
+
+using script_tag = utxo_entry::script_tag;
+
+// script points to the script (without the size prefix) of a wire output.
+// Outputs with tokens never match, their script field starts with the token prefix.
+std::optional<script_tag> match_template(uint8_t const* script, size_t size) {
+    if (size == 25 && script[0] == 0x76 && script[1] == 0xa9 && script[2] == 0x14 && script[23] == 0x88 && script[24] == 0xac) {
+        return script_tag::p2pkh;
+    }
+    if (size == 23 && script[0] == 0xa9 && script[1] == 0x14 && script[22] == 0x87) {
+        return script_tag::p2sh;
+    }
+    if (size == 35 && script[0] == 0x21 && (script[1] == 0x02 || script[1] == 0x03) && script[34] == 0xac) {
+        return script[1] == 0x02 ? script_tag::p2pk_even : script_tag::p2pk_odd;
+    }
+    if (size == 35 && script[0] == 0xaa && script[1] == 0x20 && script[34] == 0x87) {
+        return script_tag::p2sh32;
+    }
+    return std::nullopt;
+}
+
+// Offset of the payload inside the script.
+size_t payload_offset(script_tag tag) {
+    return tag == script_tag::p2pkh ? 3 : 2;
+}
+
+} // namespace
+
 utxo_entry::utxo_entry(domain::chain::output output, uint32_t height, uint32_t median_time_past, bool coinbase)
     : output_(std::move(output)), height_(height), median_time_past_(median_time_past), coinbase_(coinbase)
 {}
@@ -50,22 +83,165 @@ bool utxo_entry::is_valid() const {
 //-----------------------------------------------------------------------------
 
 // private static
-constexpr
-size_t utxo_entry::serialized_size_fixed() {
-    return sizeof(uint32_t) + sizeof(uint32_t) + sizeof(bool);
+size_t utxo_entry::varint_size(uint64_t n) {
+    size_t res = 1;
+    while (n > 0x7f) {
+        n = (n >> 7) - 1;
+        ++res;
+    }
+    return res;
+}
+
+// private static
+size_t utxo_entry::serialized_size_fixed(uint32_t height) {
+    return varint_size(uint64_t(height) << 1) + sizeof(uint32_t);
 }
 
 size_t utxo_entry::serialized_size() const {
-    return output_.serialized_size(false) + serialized_size_fixed();
+    return serialized_size_fixed(height_) + to_data_output(output_).size();
+}
+
+// Script templates.
+//-----------------------------------------------------------------------------
+
+// static
+size_t utxo_entry::script_payload_size(script_tag tag) {
+    switch (tag) {
+        case script_tag::p2pkh:
+        case script_tag::p2sh:
+            return short_hash_size;
+        case script_tag::p2pk_even:
+        case script_tag::p2pk_odd:
+        case script_tag::p2sh32:
+            return hash_size;
+        default:
+            return 0;
+    }
+}
+
+// static
+size_t utxo_entry::script_from_template(script_tag tag, uint8_t const* payload, uint8_t* out) {
+    auto const size = script_payload_size(tag);
+    auto it = out;
+
+    switch (tag) {
+        case script_tag::p2pkh:
+            *it++ = 0x76;
+            *it++ = 0xa9;
+            *it++ = 0x14;
+            it = std::copy(payload, payload + size, it);
+            *it++ = 0x88;
+            *it++ = 0xac;
+            break;
+        case script_tag::p2sh:
+            *it++ = 0xa9;
+            *it++ = 0x14;
+            it = std::copy(payload, payload + size, it);
+            *it++ = 0x87;
+            break;
+        case script_tag::p2pk_even:
+        case script_tag::p2pk_odd:
+            *it++ = 0x21;
+            *it++ = tag == script_tag::p2pk_even ? 0x02 : 0x03;
+            it = std::copy(payload, payload + size, it);
+            *it++ = 0xac;
+            break;
+        case script_tag::p2sh32:
+            *it++ = 0xaa;
+            *it++ = 0x20;
+            it = std::copy(payload, payload + size, it);
+            *it++ = 0x87;
+            break;
+        default:
+            break;
+    }
+    return size_t(it - out);
+}
+
+// Amount compression.
+//-----------------------------------------------------------------------------
+
+// static
+uint64_t utxo_entry::compress_amount(uint64_t amount) {
+    if (amount == 0) {
+        return 0;
+    }
+
+    uint64_t exponent = 0;
+    while ((amount % 10) == 0 && exponent < 9) {
+        amount /= 10;
+        ++exponent;
+    }
+
+    if (exponent < 9) {
+        auto const digit = amount % 10;
+        amount /= 10;
+        return 1 + (amount * 9 + digit - 1) * 10 + exponent;
+    }
+    return 1 + (amount - 1) * 10 + 9;
+}
+
+// static
+uint64_t utxo_entry::decompress_amount(uint64_t compressed) {
+    if (compressed == 0) {
+        return 0;
+    }
+
+    --compressed;
+    auto exponent = compressed % 10;
+    compressed /= 10;
+
+    uint64_t amount;
+    if (exponent < 9) {
+        auto const digit = (compressed % 9) + 1;
+        compressed /= 9;
+        amount = compressed * 10 + digit;
+    } else {
+        amount = compressed + 1;
+    }
+
+    while (exponent != 0) {
+        amount *= 10;
+        --exponent;
+    }
+    return amount;
 }
 
 // Serialization.
 //-----------------------------------------------------------------------------
 
+// private static
+data_chunk utxo_entry::to_data_output(domain::chain::output const& output) {
+    auto wire = output.to_data(false);
+
+    // wire: amount (8 bytes) | script size | script
+    if (wire.size() > amount_size + 1 && wire[amount_size] < 0xfd && wire.size() == amount_size + 1 + wire[amount_size]) {
+        auto const script = wire.data() + amount_size + 1;
+        auto const tag = match_template(script, wire[amount_size]);
+        if (tag) {
+            data_chunk data;
+            data.reserve(1 + 9 + hash_size);
+            data_sink ostream(data);
+            ostream_writer sink(ostream);
+            sink.write_byte(uint8_t(*tag));
+            write_varint(sink, compress_amount(output.value()));
+            sink.write_bytes(script + payload_offset(*tag), script_payload_size(*tag));
+            ostream.flush();
+            return data;
+        }
+    }
+
+    data_chunk data;
+    data.reserve(1 + wire.size());
+    data.push_back(uint8_t(script_tag::raw));
+    extend_data(data, wire);
+    return data;
+}
+
 // static
 data_chunk utxo_entry::to_data_fixed(uint32_t height, uint32_t median_time_past, bool coinbase) {
     data_chunk data;
-    auto const size = serialized_size_fixed();
+    auto const size = serialized_size_fixed(height);
     data.reserve(size);
     data_sink ostream(data);
     to_data_fixed(ostream, height, median_time_past, coinbase);
@@ -83,13 +259,8 @@ void utxo_entry::to_data_fixed(std::ostream& stream, uint32_t height, uint32_t m
 // static
 data_chunk utxo_entry::to_data_with_fixed(domain::chain::output const& output, data_chunk const& fixed) {
     //TODO(fernando):  reuse fixed vector (do not create a new one)
-    data_chunk data;
-    auto const size = output.serialized_size(false) + fixed.size();
-    data.reserve(size);
-    data_sink ostream(data);
-    to_data_with_fixed(ostream, output, fixed);
-    ostream.flush();
-    KTH_ASSERT(data.size() == size);
+    auto data = fixed;
+    extend_data(data, to_data_output(output));
     return data;
 }
 
@@ -103,8 +274,97 @@ void utxo_entry::to_data_with_fixed(std::ostream& stream, domain::chain::output
 // Deserialization.
 //-----------------------------------------------------------------------------
 
+// private static
+expect<uint64_t> utxo_entry::read_varint(byte_reader& reader) {
+    uint64_t res = 0;
+    while (true) {
+        auto const byte = reader.read_byte();
+        if ( ! byte) {
+            return make_unexpected(byte.error());
+        }
+        if (res > (max_uint64 >> 7)) {
+            return make_unexpected(error::bad_stream);
+        }
+        res = (res << 7) | (*byte & 0x7f);
+        if ((*byte & 0x80) == 0) {
+            return res;
+        }
+        ++res;
+    }
+}
+
+// private static
+expect<domain::chain::output> utxo_entry::output_from_data(byte_reader& reader) {
+    auto const tag_byte = reader.read_byte();
+    if ( ! tag_byte) {
+        return make_unexpected(tag_byte.error());
+    }
+
+    auto const tag = script_tag(*tag_byte);
+    if (tag == script_tag::raw) {
+        return domain::chain::output::from_data(reader, false);
+    }
+
+    auto const size = script_payload_size(tag);
+    if (size == 0) {
+        return make_unexpected(error::bad_stream);
+    }
+
+    auto const amount = read_varint(reader);
+    if ( ! amount) {
+        return make_unexpected(amount.error());
+    }
+
+    auto const payload = reader.read_bytes(size);
+    if ( ! payload) {
+        return make_unexpected(payload.error());
+    }
+
+    data_chunk const payload_data(payload->begin(), payload->end());
+    uint8_t script[max_template_script_size];
+    auto const script_size = script_from_template(tag, payload_data.data(), script);
+
+    // Rebuild the wire output, the script is shorter than 0xfd bytes.
+    data_chunk wire;
+    wire.reserve(amount_size + 1 + script_size);
+    auto value = decompress_amount(*amount);
+    for (size_t i = 0; i < amount_size; ++i) {
+        wire.push_back(uint8_t(value & 0xff));
+        value >>= 8;
+    }
+    wire.push_back(uint8_t(script_size));
+    wire.insert(wire.end(), script, script + script_size);
+
+    byte_reader wire_reader(wire);
+    return domain::chain::output::from_data(wire_reader, false);
+}
+
 // static
 expect<utxo_entry> utxo_entry::from_data(byte_reader& reader) {
+    auto const code = read_varint(reader);
+    if ( ! code) {
+        return make_unexpected(code.error());
+    }
+
+    auto const median_time_past = reader.read_little_endian<uint32_t>();
+    if ( ! median_time_past) {
+        return make_unexpected(median_time_past.error());
+    }
+
+    auto output = output_from_data(reader);
+    if ( ! output) {
+        return make_unexpected(output.error());
+    }
+
+    if ((*code >> 1) > max_uint32) {
+        return make_unexpected(error::bad_stream);
+    }
+
+    return utxo_entry(std::move(*output), uint32_t(*code >> 1), *median_time_past, (*code & 1) != 0);
+}
+
+// static
+expect<utxo_entry> utxo_entry::from_data_legacy(byte_reader& reader) {
     auto output = domain::chain::output::from_data(reader, false);
     if ( ! output) {
         return make_unexpected(output.error());
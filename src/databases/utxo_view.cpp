@@ -0,0 +1,158 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <kth/database/databases/utxo_view.hpp>
+
+namespace kth::database {
+
+namespace {
+
+constexpr uint8_t token_prefix = 0xef;
+
+using cursor_t = uint8_t const*;
+
+bool read_varint(cursor_t& it, cursor_t end, uint64_t& out) {
+    uint64_t res = 0;
+    while (it != end) {
+        auto const byte = *it++;
+        if (res > (max_uint64 >> 7)) {
+            return false;
+        }
+        res = (res << 7) | (byte & 0x7f);
+        if ((byte & 0x80) == 0) {
+            out = res;
+            return true;
+        }
+        ++res;
+    }
+    return false;
+}
+
+bool read_little_endian(cursor_t& it, cursor_t end, size_t size, uint64_t& out) {
+    if (size_t(end - it) < size) {
+        return false;
+    }
+    out = 0;
+    for (size_t i = 0; i < size; ++i) {
+        out |= uint64_t(it[i]) << (8 * i);
+    }
+    it += size;
+    return true;
+}
+
+// Bitcoin variable length integer (script size prefix).
+bool read_compact_size(cursor_t& it, cursor_t end, uint64_t& out) {
+    if (it == end) {
+        return false;
+    }
+    auto const prefix = *it++;
+    switch (prefix) {
+        case 0xfd: return read_little_endian(it, end, 2, out);
+        case 0xfe: return read_little_endian(it, end, 4, out);
+        case 0xff: return read_little_endian(it, end, 8, out);
+        default:
+            out = prefix;
+            return true;
+    }
+}
+
+} // namespace
+
+// static
+utxo_view utxo_view::from_data(bytes_t data) {
+    using script_tag = utxo_entry::script_tag;
+
+    utxo_view res;
+    res.data_ = data;
+
+    auto const begin = data.data();
+    auto const end = begin + data.size();
+    auto it = begin;
+
+    uint64_t code;
+    uint64_t median_time_past;
+    if ( ! read_varint(it, end, code) || (code >> 1) > max_uint32 || ! read_little_endian(it, end, 4, median_time_past)) {
+        return {};
+    }
+    if (it == end) {
+        return {};
+    }
+
+    auto const tag = script_tag(*it++);
+    if (tag == script_tag::raw) {
+        uint64_t size;
+        if ( ! read_little_endian(it, end, 8, res.value_) || ! read_compact_size(it, end, size) || uint64_t(end - it) < size) {
+            return {};
+        }
+        res.script_offset_ = size_t(it - begin);
+        res.script_size_ = size_t(size);
+        res.tokens_ = size != 0 && *it == token_prefix;
+    } else {
+        auto const size = utxo_entry::script_payload_size(tag);
+        uint64_t amount;
+        if (size == 0 || ! read_varint(it, end, amount) || size_t(end - it) < size) {
+            return {};
+        }
+        res.value_ = utxo_entry::decompress_amount(amount);
+        res.inline_script_ = true;
+        res.script_size_ = utxo_entry::script_from_template(tag, it, res.script_buffer_.data());
+    }
+
+    res.height_ = uint32_t(code >> 1);
+    res.coinbase_ = (code & 1) != 0;
+    res.median_time_past_ = uint32_t(median_time_past);
+    res.valid_ = true;
+    return res;
+}
+
+// static
+utxo_view utxo_view::from_data(data_chunk data) {
+    auto owned = std::make_shared<data_chunk const>(std::move(data));
+    auto res = from_data(bytes_t{owned->data(), owned->size()});
+    if (res.valid_) {
+        res.owned_ = std::move(owned);
+    }
+    return res;
+}
+
+bool utxo_view::is_valid() const {
+    return valid_;
+}
+
+uint64_t utxo_view::value() const {
+    return value_;
+}
+
+uint32_t utxo_view::height() const {
+    return height_;
+}
+
+uint32_t utxo_view::median_time_past() const {
+    return median_time_past_;
+}
+
+bool utxo_view::coinbase() const {
+    return coinbase_;
+}
+
+bool utxo_view::tokens() const {
+    return tokens_;
+}
+
+utxo_view::bytes_t utxo_view::script() const {
+    if (inline_script_) {
+        return {script_buffer_.data(), script_size_};
+    }
+    return data_.subspan(script_offset_, script_size_);
+}
+
+utxo_entry utxo_view::to_entry() const {
+    if ( ! valid_) {
+        return {};
+    }
+    data_chunk const data(data_.begin(), data_.end());
+    return domain::create_old<utxo_entry>(data);
+}
+
+} // namespace kth::database
@@ -0,0 +1,62 @@
+// Copyright (c) 2016-2024 Knuth Project developers.
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <kth/database/databases/worker_pool.hpp>
+
+namespace kth::database {
+
+worker_pool::worker_pool(size_t threads)
+    : size_(threads)
+{}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard lock(mutex_);
+        stopped_ = true;
+    }
+    condition_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t worker_pool::size() const {
+    return size_;
+}
+
+// private
+void worker_pool::post(std::function<void()> task) {
+    std::call_once(started_, [this] {
+        threads_.reserve(size_);
+        for (size_t i = 0; i < size_; ++i) {
+            threads_.emplace_back([this] { run(); });
+        }
+    });
+
+    {
+        std::lock_guard lock(mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    condition_.notify_one();
+}
+
+// private
+// Queued tasks are run before stopping, their futures are always satisfied.
+void worker_pool::run() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return stopped_ || ! tasks_.empty(); });
+            if (tasks_.empty()) {
+                return;
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace kth::database
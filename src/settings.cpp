@@ -10,14 +10,16 @@ namespace kth::database {
 
 using namespace std::filesystem;
 
-//TODO(fernando): look for good defaults
-constexpr auto db_size_pruned_mainnet  = 100 * (uint64_t(1) << 30); //100 GiB
-constexpr auto db_size_default_mainnet = 200 * (uint64_t(1) << 30); //200 GiB
-constexpr auto db_size_full_mainnet    = 600 * (uint64_t(1) << 30); //600 GiB
+// Initial map sizes, the map grows by db_growth_step as it fills up.
+constexpr auto db_size_pruned_mainnet  =  4 * (uint64_t(1) << 30); // 4 GiB
+constexpr auto db_size_default_mainnet =  8 * (uint64_t(1) << 30); // 8 GiB
+constexpr auto db_size_full_mainnet    = 16 * (uint64_t(1) << 30); //16 GiB
 
-constexpr auto db_size_pruned_testnet4  =  5 * (uint64_t(1) << 30); // 5 GiB
-constexpr auto db_size_default_testnet4 = 20 * (uint64_t(1) << 30); //20 GiB
-constexpr auto db_size_full_testnet4    = 50 * (uint64_t(1) << 30); //50 GiB
+constexpr auto db_size_pruned_testnet4  = 1 * (uint64_t(1) << 30); // 1 GiB
+constexpr auto db_size_default_testnet4 = 2 * (uint64_t(1) << 30); // 2 GiB
+constexpr auto db_size_full_testnet4    = 4 * (uint64_t(1) << 30); // 4 GiB
+
+constexpr auto db_growth_step_default = 4 * (uint64_t(1) << 30); // 4 GiB
 
 constexpr
 auto get_db_max_size_mainnet(db_mode_type mode) {
@@ -41,8 +43,19 @@ settings::settings()
     , db_mode(db_mode_type::blocks)
     , reorg_pool_limit(100)      //TODO(fernando): look for a good default
     , db_max_size(get_db_max_size_mainnet(db_mode))
+    , db_growth_step(db_growth_step_default)
     , safe_mode(true)
     , cache_capacity(0)
+    , batch_max_blocks(0)
+    , batch_max_bytes(0)
+    , pipeline_depth(0)
+    , max_readers(0)
+    , worker_threads(0)
+    , index_history(true)
+    , index_history_standard(false)
+    , index_spend(true)
+    , index_transaction_hash(true)
+    , index_in_background(false)
 {}
 
 settings::settings(domain::config::network context)
@@ -77,4 +90,12 @@ settings::settings(domain::config::network context)
     }
 }
 
+db_indexes_t settings::indexes() const {
+    return (index_history ? db_index_history : 0)
+         | (index_history && index_history_standard ? db_index_history_standard : 0)
+         | (index_spend ? db_index_spend : 0)
+         | (index_transaction_hash ? db_index_transaction_hash : 0)
+         | (index_in_background ? db_index_deferred : 0);
+}
+
 } // namespace kth::database
@@ -2,7 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chrono>
+#include <cstring>
 #include <filesystem>
+#include <future>
 #include <tuple>
 
 #include <test_helpers.hpp>
@@ -45,6 +48,30 @@ domain::chain::block get_block(std::string const& enc) {
     return domain::create_old<domain::chain::block>(data);
 }
 
+// Blocks #4334, #4966, #4561, #4991 and #4556, then block #5217 spending their coinbases.
+std::vector<domain::chain::block> get_spend_chain() {
+    return {
+        // Block #4334
+        // BlockHash 000000009cdad3c55df9c9bc88265329254a6c8ca810fa7f0e953c947df86dc7
+        get_block("010000005a0aeca67f7e43582c2b0138b2daa0c8dc1bedbb2477cfba2d3f96bf0000000065dabdbdb83e9820e4f666f3634d88308909789f7ae29e730812784a96485e3cd5899749ffff001dc2544c010101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0804ffff001d028e00ffffffff0100f2052a01000000434104b48f20398caaf3ff5d40710e0af87a4b86fd19d125ddacf15a2a023831d1731350e5fd40d0e28bb6481ad1843847213764feb98a2dd041069a8c39c842e1da93ac00000000"),
+        // Block #4966
+        // BlockHash 000000004f6a440a95a5d2d6c89f3e6b46587cd43f76efbaa96ef5d37ea90961
+        get_block("010000002cba11cca7170e1da742fcfb83d15c091bac17a79c089e944dda904a00000000b7404d6a9c451a9f527a7fbeb54839c2bca2eac7b138cdd700be19d733efa0fc82609e49ffff001df66339030101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704ffff001d0121ffffffff0100f2052a01000000434104c20502b45fe276d418a32b55435cb4361dea4e173c36a8e0ad52518b17f2d48cde4336c8ac8d2270e6040469f11c56036db1feef803fb529e36d0f599261cb19ac00000000"),
+        // Block #4561
+        // BlockHash 0000000089abf237d732a1515f7066e7ba29e1833664da8b704c8575c0465223
+        get_block("0100000052df1ff74876f2de37db341e12f932768f2a18dcc09dd024a1e676aa00000000cc07817ab589551d698ba7eb2a6efd6670d6951792ad52e2bd5832bf2f4930ecb5f19949ffff001d4045c6010101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0804ffff001d029f00ffffffff0100f2052a010000004341044bdc62d08cc074664cef09b24b01125a5e92fc2d61f821d6fddac367eb80b06a0a6148feabb0d25717f9eb84950ef0d3e7fe49ce7fb5a6e14da881a5b2bc64c0ac00000000"),
+        // Block #4991
+        // BlockHash 00000000fa413253e1d30ff687f239b528330c810e3de86e42a538175682599d
+        get_block("0100000040eb019191a99f1f3ef5e04606314d80a635e214ca3347388259ad4000000000f61fefef8ee758b273ee64e1bf5c07485dd74cd065a5ce0d59827e0700cad0d98c9f9e49ffff001d20a92f010101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704ffff001d013affffffff0100f2052a01000000434104debec4c8f781d5223a90aa90416ee51abf15d37086cc2d9be67873534fb06ae68c8a4e0ed0a7eedff9c97fe23f03e652d7f44501286dc1f75148bfaa9e386300ac00000000"),
+        // Block #4556
+        // BlockHash 0000000054d4f171b0eab3cd4e31da4ce5a1a06f27b39bf36c5902c9bb8ef5c4
+        get_block("0100000021a06106f13b4f0112a63e77fae3a48ffe10716ff3cdfb35371032990000000015327dc99375fc1fdc02e15394369daa6e23ad4dc27e7c1c4af21606add5b068dadf9949ffff001dda8444000101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0804ffff001d029600ffffffff0100f2052a0100000043410475804bd8be2560ab2ebd170228429814d60e58d7415a93dc51f23e4cb2f8b5188dd56fa8d519e9ef9c16d6ab22c1c8304e10e74a28444eb26821948b2d1482a4ac00000000"),
+        // Block #5217
+        // BlockHash 0000000025075f093c42a0393c844bc59f90024b18a9f588f6fa3fc37487c3c2
+        get_block("01000000944bb801c604dda3d51758f292afdca8d973288434c8fe4bf0b5982d000000008a7d204ffe05282b05f280459401b59be41b089cefc911f4fb5641f90309d942b929a149ffff001d1b8d847f0301000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0804ffff001d02c500ffffffff0100f2052a01000000434104f4af426e464d972012256f4cbe5df528aa99b1ceb489968a56cf6b295e6fad1473be89f66fbd3d16adf3dfba7c5253517d11d1d188fe858720497c4fc0a1ef9dac00000000010000000465dabdbdb83e9820e4f666f3634d88308909789f7ae29e730812784a96485e3c000000004948304502204c52c2301dcc3f6af7a3ef2ad118185ca2d52a7ae90013332ad53732a085b8d4022100f074ab99e77d5d4c54eb6bfc82c42a094d7d7eaf632d52897ef058c617a2bb2301ffffffffb7404d6a9c451a9f527a7fbeb54839c2bca2eac7b138cdd700be19d733efa0fc000000004847304402206c55518aa596824d1e760afcfeb7b0103a1a82ea8dcd4c3474becc8246ba823702205009cbc40affa3414f9a139f38a86f81a401193f759fb514b9b1d4e2e49f82a401ffffffffcc07817ab589551d698ba7eb2a6efd6670d6951792ad52e2bd5832bf2f4930ec0000000049483045022100b485b4daa4af75b7b34b4f2338e7b96809c75fab5577905ade0789c7f821a69e022010d73d2a3c7fcfc6db911dead795b0aa7d5448447ad5efc7e516699955a18ac801fffffffff61fefef8ee758b273ee64e1bf5c07485dd74cd065a5ce0d59827e0700cad0d9000000004a493046022100bc6e89ee580d1c721b15c36d0a1218c9e78f6f7537616553341bbd1199fe615a02210093062f2c1a1c87f55b710011976a03dff57428e38dd640f6fbdef0fa52ad462d01ffffffff0100c817a80400000043410408998c08bbe6bba756e9b864722fe76ca403929382db2b120f9f621966b00af48f4b014b458bccd4f2acf63b1487ecb9547bc87bdecb08e9c4d08c138c76439aac00000000010000000115327dc99375fc1fdc02e15394369daa6e23ad4dc27e7c1c4af21606add5b068000000004a49304602210086b55b7f2fa5395d1e90a85115ada930afa01b86116d6bbeeecd8e2b97eefbac022100d653846d378845df2ced4b4923dcae4b6ddd5e8434b25e1602928235054c8d5301ffffffff0100f2052a01000000434104b68b035858a00051ca70dd4ba297168d9a3720b642c2e0cd08846bfbb144233b11b24c4b8565353b579bd7109800e42a1fc1e20dbdfbba6a12d0089aab313181ac00000000")
+    };
+}
+
 domain::chain::block get_genesis() {
     std::string genesis_enc =
         "01000000"
@@ -163,7 +190,7 @@ std::tuple<KTH_DB_env*, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_d
     REQUIRE(kth_db_env_set_mapsize(env_, db_size) == KTH_DB_SUCCESS);
 
 
-    REQUIRE(kth_db_env_set_maxdbs(env_, 12) == KTH_DB_SUCCESS);
+    REQUIRE(kth_db_env_set_maxdbs(env_, max_dbs_full_) == KTH_DB_SUCCESS);
     // REQUIRE(kth_db_env_set_maxdbs(env_, 7) == KTH_DB_SUCCESS);
     // REQUIRE(kth_db_env_set_maxdbs(env_, 6) == KTH_DB_SUCCESS);
 
@@ -180,11 +207,9 @@ std::tuple<KTH_DB_env*, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_dbi, KTH_DB_d
     REQUIRE(kth_db_dbi_open(db_txn, reorg_index_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED, &dbi_reorg_index_) == KTH_DB_SUCCESS);
     REQUIRE(kth_db_dbi_open(db_txn, reorg_block_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_reorg_block_) == KTH_DB_SUCCESS);
 
-    REQUIRE(kth_db_dbi_open(db_txn, block_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_block_db_) == KTH_DB_SUCCESS);
-
-    REQUIRE(kth_db_dbi_open(db_txn, block_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_DUPSORT | KTH_DB_INTEGERKEY | KTH_DB_DUPFIXED  | MDB_INTEGERDUP, &dbi_block_db_)== KTH_DB_SUCCESS);
+    REQUIRE(kth_db_dbi_open(db_txn, block_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_block_db_)== KTH_DB_SUCCESS);
     REQUIRE(kth_db_dbi_open(db_txn, transaction_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_INTEGERKEY, &dbi_transaction_db_)== KTH_DB_SUCCESS);
-    REQUIRE(kth_db_dbi_open(db_txn, transaction_hash_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_transaction_hash_db_)== KTH_DB_SUCCESS);
+    REQUIRE(kth_db_dbi_open(db_txn, transaction_hash_db_name, KTH_DB_CONDITIONAL_CREATE | tx_hash_prefix_flags, &dbi_transaction_hash_db_)== KTH_DB_SUCCESS);
     REQUIRE(kth_db_dbi_open(db_txn, history_db_name, KTH_DB_CONDITIONAL_CREATE | KTH_DB_DUPSORT | KTH_DB_DUPFIXED, &dbi_history_db_)== KTH_DB_SUCCESS);
     REQUIRE(kth_db_dbi_open(db_txn, spend_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_spend_db_)== KTH_DB_SUCCESS);
     REQUIRE(kth_db_dbi_open(db_txn, transaction_unconfirmed_db_name, KTH_DB_CONDITIONAL_CREATE, &dbi_transaction_unconfirmed_db_) == KTH_DB_SUCCESS);
@@ -227,9 +252,9 @@ void check_reorg_output(KTH_DB_env* env_, KTH_DB_dbi& dbi_reorg_pool_, std::stri
     REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
 
     data_chunk data {static_cast<uint8_t*>(kth_db_get_data(value)), static_cast<uint8_t*>(kth_db_get_data(value)) + kth_db_get_size(value)};
-    auto output = domain::create_old<domain::chain::output>(data, false);
+    auto const entry = domain::create_old<utxo_entry>(data);
 
-    REQUIRE(encode_base16(output.to_data(true)) == output_enc);
+    REQUIRE(encode_base16(entry.output().to_data(true)) == output_enc);
 }
 
 void check_reorg_output_just_existence(KTH_DB_env* env_, KTH_DB_dbi& dbi_reorg_pool_, std::string txid_enc, uint32_t pos) {
@@ -306,30 +331,15 @@ void check_blocks_db(KTH_DB_env* env_, KTH_DB_dbi& dbi_blocks_db_, KTH_DB_dbi& d
     REQUIRE(kth_db_txn_begin(env_, NULL, KTH_DB_RDONLY, &db_txn) == KTH_DB_SUCCESS);
 
 
-    KTH_DB_cursor* cursor;
-    REQUIRE(kth_db_cursor_open(db_txn, dbi_blocks_db_, &cursor) == KTH_DB_SUCCESS);
-
-
     auto key = kth_db_make_value(sizeof(height), &height);
     domain::chain::transaction::list tx_list;
 
     KTH_DB_val value;
-    int rc;
-    REQUIRE(kth_db_cursor_get(cursor, &key, &value, MDB_SET) == KTH_DB_SUCCESS);
-
-    auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));
-
-    auto key_tx = kth_db_make_value(sizeof(tx_id), &tx_id);
-    KTH_DB_val value_tx;
-
-    REQUIRE(kth_db_get(db_txn, dbi_transaction_db_, &key_tx, &value_tx) == KTH_DB_SUCCESS);
-
-    data_chunk data_tx {static_cast<uint8_t*>(kth_db_get_data(value_tx)), static_cast<uint8_t*>(kth_db_get_data(value_tx)) + kth_db_get_size(value_tx)};
-    auto entry = domain::create_old<transaction_entry>(data_tx);
-    tx_list.push_back(std::move(entry.transaction()));
+    REQUIRE(kth_db_get(db_txn, dbi_blocks_db_, &key, &value) == KTH_DB_SUCCESS);
+    auto const range = block_tx_range::from_value(value);
 
-    while ((rc = kth_db_cursor_get(cursor, &key, &value, MDB_NEXT_DUP)) == 0) {
-        auto tx_id = *static_cast<uint32_t*>(kth_db_get_data(value));;
+    for (uint32_t i = 0; i < range.count; ++i) {
+        tx_id_t tx_id = range.first + i;
         auto key_tx = kth_db_make_value(sizeof(tx_id), &tx_id);
         KTH_DB_val value_tx;
 
@@ -340,9 +350,6 @@ void check_blocks_db(KTH_DB_env* env_, KTH_DB_dbi& dbi_blocks_db_, KTH_DB_dbi& d
         tx_list.push_back(std::move(entry.transaction()));
     }
 
-
-    kth_db_cursor_close(cursor);
-
     REQUIRE(kth_db_get(db_txn, dbi_block_header_, &key, &value) == KTH_DB_SUCCESS);
 
     data_chunk data_header {static_cast<uint8_t*>(kth_db_get_data(value)), static_cast<uint8_t*>(kth_db_get_data(value)) + kth_db_get_size(value)};
@@ -356,6 +363,27 @@ void check_blocks_db(KTH_DB_env* env_, KTH_DB_dbi& dbi_blocks_db_, KTH_DB_dbi& d
     REQUIRE(block.is_valid());
 }
 
+// Appends rows history rows of key, two rows per height, value i for row i.
+void seed_history(short_hash const& key, uint32_t rows) {
+    auto const dbs = open_dbs();
+    auto env_ = std::get<0>(dbs);
+    auto dbi_history_db_ = std::get<9>(dbs);
+
+    KTH_DB_txn* db_txn;
+    REQUIRE(kth_db_txn_begin(env_, NULL, 0, &db_txn) == KTH_DB_SUCCESS);
+    for (uint32_t i = 0; i < rows; ++i) {
+        hash_digest txid {};
+        txid[0] = uint8_t(i);
+        txid[1] = uint8_t(i >> 8);
+        auto row = history_row::make(i, point{txid, 0}, point_kind::output, i / 2, 0, i);
+        auto k = kth_db_make_value(key.size(), key.data());
+        auto v = kth_db_make_value(sizeof(row), &row);
+        REQUIRE(kth_db_put(db_txn, dbi_history_db_, &k, &v, KTH_DB_APPENDDUP) == KTH_DB_SUCCESS);
+    }
+    REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
+    kth_db_env_close(env_);
+}
+
 void check_transactions_db_just_existence(KTH_DB_env* env_, KTH_DB_dbi& dbi_transaction_db_, uint64_t id) {
     KTH_DB_txn* db_txn;
 
@@ -610,6 +638,1217 @@ TEST_CASE("internal database  open", "[None]") {
     REQUIRE(db.open());
 }
 
+TEST_CASE("internal database  utxo cache", "[None]") {
+    hash_digest txid;
+    REQUIRE(decode_hash(txid, "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+
+    utxo_cache cache(4);
+    REQUIRE(cache.enabled());
+
+    REQUIRE(cache.insert(output_point{txid, 0}, data_chunk{0}, 10));
+    REQUIRE(cache.insert(output_point{txid, 1}, data_chunk{1}, 11));
+    REQUIRE( ! cache.insert(output_point{txid, 1}, data_chunk{1}, 11));
+    cache.commit();
+
+    REQUIRE(cache.remove(output_point{txid, 0}));
+    REQUIRE(cache.insert(output_point{txid, 2}, data_chunk{2}, 12));
+    cache.rollback();
+
+    REQUIRE(cache.find(output_point{txid, 0}));
+    REQUIRE( ! cache.find(output_point{txid, 2}));
+    REQUIRE(cache.size() == 2);
+
+    REQUIRE(cache.insert(output_point{txid, 2}, data_chunk{2}, 12));
+    REQUIRE(cache.insert(output_point{txid, 3}, data_chunk{3}, 13));
+    REQUIRE(cache.full());
+
+    // Oldest heights first, down to 3/4 of the capacity.
+    auto const batch = cache.take_flush_batch(false);
+    REQUIRE(batch.size() == 1);
+    REQUIRE(batch[0].second == data_chunk{0});
+    REQUIRE(cache.find(output_point{txid, 0}));     // visible until commit
+    cache.commit();
+    REQUIRE( ! cache.find(output_point{txid, 0}));
+    REQUIRE(cache.lowest_height() == 11);
+
+    REQUIRE(cache.take_flush_batch(true).size() == 3);
+    REQUIRE(cache.lowest_height() == max_uint32);
+    cache.rollback();
+    REQUIRE(cache.size() == 3);
+    REQUIRE(cache.lowest_height() == 11);
+}
+
+TEST_CASE("internal database  utxo cache recovery", "[None]") {
+    auto const chain = get_spend_chain();
+    auto const path = fs::path(DIRECTORY) / "internal_db_cache";
+    auto const crashed = fs::path(DIRECTORY) / "internal_db_cache_crashed";
+
+    std::error_code ec;
+    remove_all(path, ec);
+    remove_all(crashed, ec);
+    {
+        // Old blocks, pushed through a cache of 4 entries.
+        internal_database db(path, db_mode_type::full, 10, db_size, true, 4);
+        REQUIRE(db.create());
+        for (uint32_t height = 0; height < chain.size(); ++height) {
+            REQUIRE(db.push_block(chain[height], height, 1) == result_code::success);
+        }
+
+        // A copy of the committed state, as left by a stop without close().
+        fs::copy(path, crashed, fs::copy_options::recursive);
+    }
+
+    // The outputs still cached are restored from the stored blocks.
+    internal_database db(crashed, db_mode_type::full, 10, db_size, true, 4);
+    REQUIRE(db.open());
+
+    auto const& spender = chain.back();
+    for (uint32_t height = 0; height < 5; ++height) {
+        REQUIRE( ! db.get_utxo(output_point{chain[height].transactions()[0].hash(), 0}).is_valid());
+    }
+    for (auto const& tx : spender.transactions()) {
+        auto const entry = db.get_utxo(output_point{tx.hash(), 0});
+        REQUIRE(entry.is_valid());
+        REQUIRE(entry.height() == 5);
+        REQUIRE(entry.output() == tx.outputs()[0]);
+    }
+    REQUIRE(db.close());
+
+    // Clean once restored.
+    REQUIRE(db.open());
+}
+
+TEST_CASE("internal database  batch", "[None]") {
+    auto const genesis = get_genesis();
+
+    // Block 1 - 00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048
+    auto const b1 = get_block("010000006fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000982051fd1e4ba744bbbe680e1fee14677ba1a3c3540bf7b1cdb606e857233e0e61bc6649ffff001d01e362990101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704ffff001d0104ffffffff0100f2052a0100000043410496b538e853519c726a2c91e61ec11600ae1390813a627c66fb8be7947be63c52da7589379515d4e0a604f8141781e62294721166bf621e73a82cbf2342c858eeac00000000");
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true, 0, 2, 0);
+    REQUIRE(db.open());
+    REQUIRE(db.begin_batch());
+
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+    REQUIRE( ! db.get_header(0).is_valid());        // not commited yet
+
+    // The failing block is discarded, the batch is kept.
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::duplicated_key);
+
+    REQUIRE(db.push_block(b1, 1, 1) == result_code::success);
+    REQUIRE(db.get_header(0).is_valid());
+    REQUIRE(db.get_header(1).is_valid());
+
+    REQUIRE(db.end_batch() == result_code::success);
+}
+
+TEST_CASE("internal database  batch owner", "[None]") {
+    auto const genesis = get_genesis();
+
+    // Block 1 - 00000000839a8e6886ab5951d76f411475428afc90947ee320161bbf18eb6048
+    auto const b1 = get_block("010000006fe28c0ab6f1b372c1a6a246ae63f74f931e8365e15a089c68d6190000000000982051fd1e4ba744bbbe680e1fee14677ba1a3c3540bf7b1cdb606e857233e0e61bc6649ffff001d01e362990101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704ffff001d0104ffffffff0100f2052a0100000043410496b538e853519c726a2c91e61ec11600ae1390813a627c66fb8be7947be63c52da7589379515d4e0a604f8141781e62294721166bf621e73a82cbf2342c858eeac00000000");
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true, 0, 10, 0);
+    REQUIRE(db.open());
+    REQUIRE(db.begin_batch());
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    // Another thread does not join the batch, its block waits for the commit.
+    auto other = std::async(std::launch::async, [&] {
+        auto const ended = db.end_batch();
+        return std::make_tuple(ended, db.push_block(b1, 1, 1));
+    });
+    REQUIRE(other.wait_for(std::chrono::milliseconds(100)) == std::future_status::timeout);
+    REQUIRE( ! db.get_header(0).is_valid());        // not commited yet
+
+    REQUIRE(db.end_batch() == result_code::success);
+    auto const [ended, pushed] = other.get();
+    REQUIRE(ended == result_code::success);         // not the owner, nothing to end
+    REQUIRE(pushed == result_code::success);
+    REQUIRE(db.get_header(0).is_valid());
+    REQUIRE(db.get_header(1).is_valid());
+    REQUIRE(db.discarded_blocks() == 0);
+}
+
+
+// Both the cached and the stored entries are found, by point and in bulk.
+template <typename DB>
+void check_utxos(DB const& db, std::vector<output_point> const& unspent, std::vector<output_point> const& spent) {
+    for (auto const& point : unspent) {
+        REQUIRE(db.get_utxo(point).is_valid());
+    }
+    for (auto const& point : spent) {
+        REQUIRE( ! db.get_utxo(point).is_valid());
+    }
+
+    auto points = unspent;
+    points.insert(points.end(), spent.begin(), spent.end());
+    auto const found = db.get_utxos(points);
+    REQUIRE(found);
+    for (size_t i = 0; i < points.size(); ++i) {
+        REQUIRE((*found)[i].is_valid() == (i < unspent.size()));
+    }
+}
+
+TEST_CASE("internal database  utxo cache push and pop", "[None]") {
+    auto const chain = get_spend_chain();
+    auto const& spender = chain.back();
+
+    std::vector<output_point> coinbases;
+    for (size_t height = 0; height < 5; ++height) {
+        coinbases.emplace_back(chain[height].transactions()[0].hash(), 0);
+    }
+    std::vector<output_point> created;
+    for (auto const& tx : spender.transactions()) {
+        created.emplace_back(tx.hash(), 0);
+    }
+
+    // The last transaction also spends an output that does not exist.
+    auto failing = spender;
+    auto tx = failing.transactions().back();
+    tx.inputs()[0].previous_output().set_hash(null_hash);
+    tx.set_version(2);     //To change the tx hash
+    failing.transactions().push_back(tx);
+
+    auto const path = fs::path(DIRECTORY) / "internal_db_cache_old";
+    std::error_code ec;
+    remove_all(path, ec);
+    {
+        // Every block is old, pushed through a cache of 4 entries.
+        internal_database db(path, db_mode_type::full, 10, db_size, true, 4);
+        REQUIRE(db.create());
+
+        // The cache fills up and is partially flushed.
+        for (uint32_t height = 0; height < 5; ++height) {
+            REQUIRE(db.push_block(chain[height], height, 1) == result_code::success);
+            check_utxos(db, {coinbases.begin(), coinbases.begin() + height + 1}, {});
+        }
+
+        // The cached entries removed or flushed by the failing block are back.
+        REQUIRE(db.push_block(failing, 5, 1) == result_code::key_not_found);
+        check_utxos(db, coinbases, created);
+
+        // Some coinbases are spent while cached, the others from the DB.
+        REQUIRE(db.push_block(spender, 5, 1) == result_code::success);
+        check_utxos(db, created, coinbases);
+    }
+
+    // Flushed on close.
+    {
+        internal_database db(path, db_mode_type::full, 10, db_size, true, 4);
+        REQUIRE(db.open());
+        check_utxos(db, created, coinbases);
+    }
+
+    // Only the spender is recent: the cache is flushed before it is pushed and
+    // the spent outputs go to the reorg pool.
+    using my_clock = dummy_clock<1235298745 + 600>;
+    remove_all(path, ec);
+    {
+        internal_database_basis<my_clock> db(path, db_mode_type::full, 10, db_size, true, 4);
+        REQUIRE(db.create());
+        for (uint32_t height = 0; height < 5; ++height) {
+            REQUIRE(db.push_block(chain[height], height, 1) == result_code::success);
+        }
+
+        REQUIRE(db.push_block(spender, 5, 1) == result_code::success);
+        check_utxos(db, created, coinbases);
+
+        domain::chain::block popped;
+        REQUIRE(db.pop_block(popped) == result_code::success);
+        REQUIRE(popped.hash() == spender.hash());
+        check_utxos(db, coinbases, created);
+
+        // Pushed again after the pop.
+        REQUIRE(db.push_block(spender, 5, 1) == result_code::success);
+        check_utxos(db, created, coinbases);
+    }
+
+    internal_database_basis<my_clock> db(path, db_mode_type::full, 10, db_size, true, 4);
+    REQUIRE(db.open());
+    check_utxos(db, created, coinbases);
+}
+
+TEST_CASE("internal database  intra block spend", "[None]") {
+    auto const chain = get_spend_chain();
+    auto const& b0 = chain[0];
+    auto const& b4 = chain[4];
+    auto spender0 = chain[5];
+
+    // Output 0 of the second transaction spent by a new transaction of the same block.
+    auto const& tx1 = spender0.transactions()[1];
+    auto tx3 = spender0.transactions()[2];
+    tx3.inputs()[0].previous_output().set_hash(tx1.hash());
+    tx3.set_version(2);     //To change the tx hash
+    spender0.transactions().push_back(tx3);
+
+    auto const tx1_hash = spender0.transactions()[1].hash();
+    auto const tx3_hash = spender0.transactions()[3].hash();
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    for (uint32_t height = 0; height < 5; ++height) {
+        REQUIRE(db.push_block(chain[height], height, 1) == result_code::success);
+    }
+    REQUIRE(db.push_block(spender0, 5, 1) == result_code::success);
+
+    // Created and spent in the same block, it never reaches the UTXO set.
+    REQUIRE( ! db.get_utxo(output_point{tx1_hash, 0}).is_valid());
+    REQUIRE(db.get_utxo(output_point{tx3_hash, 0}).is_valid());
+    REQUIRE( ! db.get_utxo(output_point{b0.transactions()[0].hash(), 0}).is_valid());
+    REQUIRE(db.close());
+
+    KTH_DB_env* env_;
+    KTH_DB_dbi dbi_utxo_;
+    KTH_DB_dbi dbi_reorg_pool_;
+    KTH_DB_dbi dbi_reorg_index_;
+    KTH_DB_dbi dbi_block_header_;
+    KTH_DB_dbi dbi_block_header_by_hash_;
+    KTH_DB_dbi dbi_reorg_block_;
+    KTH_DB_dbi dbi_block_db_;
+    KTH_DB_dbi dbi_transaction_db_;
+    KTH_DB_dbi dbi_transaction_hash_db_;
+    KTH_DB_dbi dbi_transaction_unconfirmed_db_;
+    KTH_DB_dbi dbi_history_db_;
+    KTH_DB_dbi dbi_spend_db_;
+
+    // Blocks pushed before the intra block spends were skipped have the spent
+    // output in the reorg pool, as any other spent output.
+    std::tie(env_, dbi_utxo_, dbi_reorg_pool_, dbi_reorg_index_, dbi_block_header_, dbi_block_header_by_hash_, dbi_reorg_block_
+    , dbi_block_db_
+    , dbi_transaction_db_
+    , dbi_history_db_
+    , dbi_spend_db_
+    , dbi_transaction_hash_db_
+    , dbi_transaction_unconfirmed_db_
+    ) = open_dbs();
+
+    {
+        KTH_DB_txn* db_txn;
+        REQUIRE(kth_db_txn_begin(env_, NULL, 0, &db_txn) == KTH_DB_SUCCESS);
+        uint32_t height = 5;
+        auto keyarr = output_point{tx1_hash, 0}.to_data(KTH_INTERNAL_DB_WIRE);
+        auto valuearr = utxo_entry{spender0.transactions()[1].outputs()[0], 5, 1, false}.to_data();
+        auto key = kth_db_make_value(keyarr.size(), keyarr.data());
+        auto value = kth_db_make_value(valuearr.size(), valuearr.data());
+        auto key_index = kth_db_make_value(sizeof(height), &height);
+        REQUIRE(kth_db_put(db_txn, dbi_reorg_pool_, &key, &value, KTH_DB_NOOVERWRITE) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_put(db_txn, dbi_reorg_index_, &key_index, &key, 0) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
+    }
+
+    close_everything(env_, dbi_utxo_, dbi_reorg_pool_, dbi_reorg_index_, dbi_block_header_, dbi_block_header_by_hash_, dbi_reorg_block_
+        , dbi_block_db_
+        , dbi_transaction_db_
+        , dbi_history_db_
+        , dbi_spend_db_
+        , dbi_transaction_hash_db_
+        , dbi_transaction_unconfirmed_db_
+    );
+
+    REQUIRE(db.open());
+
+    domain::chain::block popped;
+    REQUIRE(db.pop_block(popped) == result_code::success);
+    REQUIRE(popped.hash() == spender0.hash());
+
+    REQUIRE( ! db.get_utxo(output_point{tx1_hash, 0}).is_valid());
+    REQUIRE( ! db.get_utxo(output_point{tx3_hash, 0}).is_valid());
+    REQUIRE(db.get_utxo(output_point{b0.transactions()[0].hash(), 0}).is_valid());
+    REQUIRE(db.get_utxo(output_point{b4.transactions()[0].hash(), 0}).is_valid());
+    REQUIRE(db.close());
+
+    // The pop removes the leftover output with the reorg index of the height.
+    std::tie(env_, dbi_utxo_, dbi_reorg_pool_, dbi_reorg_index_, dbi_block_header_, dbi_block_header_by_hash_, dbi_reorg_block_
+    , dbi_block_db_
+    , dbi_transaction_db_
+    , dbi_history_db_
+    , dbi_spend_db_
+    , dbi_transaction_hash_db_
+    , dbi_transaction_unconfirmed_db_
+    ) = open_dbs();
+
+    check_reorg_output_doesnt_exists(env_, dbi_reorg_pool_, encode_hash(tx1_hash), 0);
+
+    close_everything(env_, dbi_utxo_, dbi_reorg_pool_, dbi_reorg_index_, dbi_block_header_, dbi_block_header_by_hash_, dbi_reorg_block_
+        , dbi_block_db_
+        , dbi_transaction_db_
+        , dbi_history_db_
+        , dbi_spend_db_
+        , dbi_transaction_hash_db_
+        , dbi_transaction_unconfirmed_db_
+    );
+}
+
+
+TEST_CASE("internal database  compact utxo entry", "[None]") {
+    data_chunk data;
+
+    // P2PKH
+    REQUIRE(decode_base16(data, "00f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac"));
+    auto const p2pkh = domain::create_old<domain::chain::output>(data, false);
+
+    // P2PK, uncompressed public key
+    REQUIRE(decode_base16(data, "00f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac"));
+    auto const p2pk = domain::create_old<domain::chain::output>(data, false);
+
+    for (auto const& output : {p2pkh, p2pk}) {
+        utxo_entry const entry(output, 600000, 1570000000, true);
+        auto const encoded = entry.to_data();
+        REQUIRE(encoded.size() == entry.serialized_size());
+
+        auto const res = domain::create_old<utxo_entry>(encoded);
+        REQUIRE(res.is_valid());
+        REQUIRE(res.output() == output);
+        REQUIRE(res.height() == 600000);
+        REQUIRE(res.median_time_past() == 1570000000);
+        REQUIRE(res.coinbase());
+    }
+
+    // height/coinbase: 3, median time past: 4, tag: 1, amount: 1, hash: 20
+    REQUIRE(utxo_entry(p2pkh, 600000, 1570000000, false).to_data().size() == 29);
+
+    for (uint64_t amount : {uint64_t(0), uint64_t(1), uint64_t(546), uint64_t(5000000000), uint64_t(123456789), uint64_t(2100000000000000)}) {
+        REQUIRE(utxo_entry::decompress_amount(utxo_entry::compress_amount(amount)) == amount);
+    }
+}
+
+TEST_CASE("internal database  utxo view", "[None]") {
+    data_chunk data;
+    REQUIRE(decode_base16(data, "00f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac"));
+    auto const p2pkh = domain::create_old<domain::chain::output>(data, false);
+
+    auto const encoded = utxo_entry(p2pkh, 600000, 1570000000, false).to_data();
+    auto const view = utxo_view::from_data(utxo_view::bytes_t{encoded.data(), encoded.size()});
+    REQUIRE(view.is_valid());
+    REQUIRE(view.value() == p2pkh.value());
+    REQUIRE(view.height() == 600000);
+    REQUIRE(view.median_time_past() == 1570000000);
+    REQUIRE( ! view.coinbase());
+    REQUIRE( ! view.tokens());
+    auto const script = p2pkh.script().to_data(false);
+    REQUIRE(data_chunk(view.script().begin(), view.script().end()) == script);
+    REQUIRE(view.to_entry().output() == p2pkh);
+
+    REQUIRE( ! utxo_view::from_data(utxo_view::bytes_t{encoded.data(), encoded.size() - 1}).is_valid());
+
+    // Genesis output: P2PK with an uncompressed key, stored raw.
+    auto const genesis = get_genesis();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    output_point const point{genesis.transactions()[0].hash(), 0};
+    auto const entry = db.get_utxo(point);
+
+    auto db_txn = db.begin_read();
+    REQUIRE(db_txn != nullptr);
+    auto const genesis_view = db.get_utxo_view(point, db_txn);
+    REQUIRE(genesis_view.is_valid());
+    REQUIRE(genesis_view.value() == entry.output().value());
+    REQUIRE(genesis_view.height() == 0);
+    REQUIRE(genesis_view.median_time_past() == 1);
+    REQUIRE(genesis_view.coinbase());
+    auto const genesis_script = entry.output().script().to_data(false);
+    REQUIRE(data_chunk(genesis_view.script().begin(), genesis_view.script().end()) == genesis_script);
+    REQUIRE( ! db.get_utxo_view(output_point{null_hash, 0}, db_txn).is_valid());
+    db.end_read(db_txn);
+}
+
+TEST_CASE("internal database  get utxos", "[None]") {
+    auto const genesis = get_genesis();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    output_point const coinbase{genesis.transactions()[0].hash(), 0};
+    std::vector<output_point> const points {
+        output_point{null_hash, 0},
+        coinbase,
+        output_point{genesis.transactions()[0].hash(), 1}
+    };
+
+    for (size_t threads : {size_t(1), size_t(4)}) {
+        auto const found = db.get_utxos(points, threads);
+        REQUIRE(found);
+        auto const& res = *found;
+        REQUIRE(res.size() == points.size());
+        REQUIRE( ! res[0].is_valid());
+        REQUIRE(res[1].is_valid());
+        REQUIRE(res[1].output() == db.get_utxo(coinbase).output());
+        REQUIRE(res[1].height() == 0);
+        REQUIRE( ! res[2].is_valid());
+    }
+
+    REQUIRE(db.get_utxos({}));
+    REQUIRE(db.get_utxos({})->empty());
+}
+
+TEST_CASE("internal database  get utxos in parallel", "[None]") {
+    auto const chain = get_spend_chain();
+    auto const& spender = chain.back();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_all, 3);
+    REQUIRE(db.open());
+    for (uint32_t height = 0; height < chain.size(); ++height) {
+        REQUIRE(db.push_block(chain[height], height, 1) == result_code::success);
+    }
+
+    // More than 1024 lookups per thread, the sorted range is split on the workers.
+    // Unspent, spent and missing points are spread across the key space.
+    std::vector<output_point> points;
+    std::vector<domain::chain::output const*> expected;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        if (i % 100 == 0) {
+            auto const& tx = spender.transactions()[(i / 100) % spender.transactions().size()];
+            points.emplace_back(tx.hash(), 0);
+            expected.push_back(&tx.outputs()[0]);
+        } else if (i % 100 == 50) {
+            points.emplace_back(chain[(i / 100) % 5].transactions()[0].hash(), 0);
+            expected.push_back(nullptr);
+        } else {
+            hash_digest hash = null_hash;
+            hash[0] = uint8_t(i);
+            hash[1] = uint8_t(i >> 8);
+            points.emplace_back(hash, i);
+            expected.push_back(nullptr);
+        }
+    }
+
+    for (size_t threads : {size_t(1), size_t(3), size_t(8)}) {
+        auto const found = db.get_utxos(points, threads);
+        REQUIRE(found);
+        auto const& res = *found;
+        REQUIRE(res.size() == points.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+            REQUIRE(res[i].is_valid() == (expected[i] != nullptr));
+            if (expected[i] != nullptr) {
+                REQUIRE(res[i].output() == *expected[i]);
+                REQUIRE(res[i].height() == 5);
+            }
+        }
+    }
+}
+
+TEST_CASE("internal database  worker pool", "[None]") {
+    worker_pool pool(2);
+    REQUIRE(pool.size() == 2);
+
+    std::vector<std::future<size_t>> results;
+    for (size_t i = 0; i < 16; ++i) {
+        results.push_back(pool.submit([i] { return i * i; }));
+    }
+    for (size_t i = 0; i < results.size(); ++i) {
+        REQUIRE(results[i].get() == i * i);
+    }
+}
+
+TEST_CASE("internal database  read snapshot", "[None]") {
+    auto const genesis = get_genesis();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+
+    read_snapshot snapshot(db);
+    REQUIRE(snapshot.is_valid());
+
+    uint32_t height;
+    REQUIRE(snapshot.get_last_height(height) == result_code::db_empty);
+
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    // The snapshot predates the block.
+    REQUIRE(snapshot.get_last_height(height) == result_code::db_empty);
+    REQUIRE( ! snapshot.get_header(genesis.hash()).first.is_valid());
+
+    REQUIRE(snapshot.refresh());
+    REQUIRE(snapshot.get_last_height(height) == result_code::success);
+    REQUIRE(height == 0);
+    REQUIRE(snapshot.get_header(genesis.hash()).second == 0);
+    REQUIRE(snapshot.get_header(0).hash() == genesis.hash());
+    REQUIRE(snapshot.get_headers(0, 0).size() == 1);
+    REQUIRE(snapshot.get_block(genesis.hash()).first.hash() == genesis.hash());
+    REQUIRE(snapshot.get_block(0).hash() == genesis.hash());
+
+    auto const& txid = genesis.transactions()[0].hash();
+    REQUIRE(snapshot.get_transaction(txid, max_uint32).is_valid());
+    REQUIRE(snapshot.get_utxo(output_point{txid, 0}).is_valid());
+    REQUIRE(snapshot.get_utxo_view(output_point{txid, 0}).height() == 0);
+
+    auto const address = domain::wallet::payment_address("1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa");
+    REQUIRE(snapshot.get_history(address.hash20(), max_uint32, 0).size() == 1);
+    REQUIRE(snapshot.get_history_txns(address.hash20(), max_uint32, 0).size() == 1);
+
+    snapshot.release();
+    REQUIRE( ! snapshot.is_valid());
+    REQUIRE( ! snapshot.get_utxo(output_point{txid, 0}).is_valid());
+}
+
+TEST_CASE("internal database  read transaction pool", "[None]") {
+    auto const genesis = get_genesis();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.read_txns().capacity() > 0);
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    auto const created = db.read_txns().created();
+    for (size_t i = 0; i < 100; ++i) {
+        REQUIRE(db.get_header(0).hash() == genesis.hash());
+    }
+
+    // Sequential reads reuse the same pooled transaction.
+    REQUIRE(db.read_txns().created() <= created + 1);
+    REQUIRE(db.read_txns().reused() >= 99);
+
+    REQUIRE(db.read_txns().readers() >= 1);
+    REQUIRE(db.read_txns().peak_readers() >= db.read_txns().readers());
+
+    // A renewed transaction sees the latest commit.
+    auto db_txn = db.begin_read();
+    REQUIRE(db_txn != nullptr);
+    REQUIRE(db.get_utxo_view(output_point{genesis.transactions()[0].hash(), 0}, db_txn).is_valid());
+    db.end_read(db_txn);
+}
+
+TEST_CASE("internal database  max readers", "[None]") {
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 300);
+        REQUIRE(db.open());
+        REQUIRE(db.read_txns().max_readers() == 300);
+        REQUIRE(db.read_txns().capacity() == 150);
+    }
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+        REQUIRE(db.read_txns().max_readers() >= 126);
+    }
+}
+
+TEST_CASE("internal database  map growth", "[None]") {
+    auto const genesis = get_genesis();
+
+    // The initial map is too small for the space reserved for a block.
+    internal_database db(db_path, db_mode_type::full, 10000000, 1 << 20, true, 0, 0, 0, 0, 1 << 20);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+    REQUIRE(db.get_header(0).hash() == genesis.hash());
+}
+
+TEST_CASE("internal database  block transaction ids", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+    REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+
+    // Every transaction of the block is read back, in block order.
+    auto const block = db.get_block(1);
+    REQUIRE(block.transactions().size() == spender.transactions().size());
+    for (size_t i = 0; i < block.transactions().size(); ++i) {
+        REQUIRE(block.transactions()[i].hash() == spender.transactions()[i].hash());
+    }
+
+    auto const entry = db.get_transaction(spender.transactions()[1].hash(), max_uint32);
+    REQUIRE(entry.is_valid());
+    REQUIRE(entry.height() == 1);
+    REQUIRE(entry.position() == 1);
+}
+
+TEST_CASE("internal database  transaction hash prefix", "[None]") {
+    auto const genesis = get_genesis();
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(genesis, 0, 1) == result_code::success);
+
+    auto const txid = genesis.transactions()[0].hash();
+    REQUIRE(db.get_transaction(txid, max_uint32).is_valid());
+
+    // Same 8-byte prefix, rejected by the stored hash bytes.
+    auto other = txid;
+    other[tx_hash_value::hash_offset] ^= 0x01;
+    REQUIRE(tx_hash_prefix(other) == tx_hash_prefix(txid));
+    REQUIRE( ! db.get_transaction(other, max_uint32).is_valid());
+
+    // Same 16 bytes, rejected by the hash of the stored transaction.
+    other = txid;
+    other.back() ^= 0x01;
+    REQUIRE(tx_hash_value::to_value(other, 0) == tx_hash_value::to_value(txid, 0));
+    REQUIRE( ! db.get_transaction(other, max_uint32).is_valid());
+}
+
+// Rewrites the UTXO entries of dbi with the encoding prior to db_version 1.
+void write_legacy_utxos(KTH_DB_txn* db_txn, KTH_DB_dbi dbi) {
+    KTH_DB_cursor* cursor;
+    REQUIRE(kth_db_cursor_open(db_txn, dbi, &cursor) == KTH_DB_SUCCESS);
+
+    KTH_DB_val key;
+    KTH_DB_val value;
+    auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_FIRST);
+    while (rc == KTH_DB_SUCCESS) {
+        auto const data = db_value_to_data_chunk(value);
+        byte_reader reader(data);
+        auto const entry = utxo_entry::from_data(reader);
+        REQUIRE(entry);
+
+        data_chunk legacy;
+        {
+            data_sink ostream(legacy);
+            ostream_writer sink(ostream);
+            sink.write_bytes(entry->output().to_data(false));
+            sink.write_4_bytes_little_endian(entry->height());
+            sink.write_4_bytes_little_endian(entry->median_time_past());
+            sink.write_byte(entry->coinbase() ? 1 : 0);
+            ostream.flush();
+        }
+        auto legacy_value = kth_db_make_value(legacy.size(), legacy.data());
+        REQUIRE(kth_db_cursor_put(cursor, &key, &legacy_value, KTH_DB_CURRENT) == KTH_DB_SUCCESS);
+        rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+    }
+    REQUIRE(rc == KTH_DB_NOTFOUND);
+    kth_db_cursor_close(cursor);
+}
+
+// Rewrites the history rows with the layout prior to db_version 5.
+void write_legacy_history(KTH_DB_txn* db_txn, KTH_DB_dbi dbi) {
+    std::vector<std::pair<data_chunk, std::vector<history_row>>> keys;
+    {
+        KTH_DB_cursor* cursor;
+        REQUIRE(kth_db_cursor_open(db_txn, dbi, &cursor) == KTH_DB_SUCCESS);
+
+        KTH_DB_val key;
+        KTH_DB_val value;
+        auto rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_FIRST);
+        while (rc == KTH_DB_SUCCESS) {
+            auto const address = db_value_to_data_chunk(key);
+            if (keys.empty() || keys.back().first != address) {
+                keys.emplace_back(address, std::vector<history_row>{});
+            }
+            history_row row;
+            std::memcpy(&row, kth_db_get_data(value), sizeof(row));
+            keys.back().second.push_back(row);
+            rc = kth_db_cursor_get(cursor, &key, &value, KTH_DB_NEXT);
+        }
+        REQUIRE(rc == KTH_DB_NOTFOUND);
+        kth_db_cursor_close(cursor);
+    }
+
+    for (auto& [address, rows] : keys) {
+        auto key = kth_db_make_value(address.size(), address.data());
+        REQUIRE(kth_db_del(db_txn, dbi, &key, NULL) == KTH_DB_SUCCESS);
+        for (auto const& row : rows) {
+            data_chunk legacy;
+            {
+                data_sink ostream(legacy);
+                ostream_writer sink(ostream);
+                sink.write_8_bytes_little_endian(row.id());
+                sink.write_bytes(row.point().to_data(false));
+                sink.write_byte(uint8_t(row.point_kind()));
+                sink.write_4_bytes_little_endian(row.height());
+                sink.write_4_bytes_little_endian(row.index());
+                sink.write_8_bytes_little_endian(row.value_or_checksum());
+                ostream.flush();
+            }
+            auto value = kth_db_make_value(legacy.size(), legacy.data());
+            REQUIRE(kth_db_put(db_txn, dbi, &key, &value, 0) == KTH_DB_SUCCESS);
+        }
+    }
+}
+
+KTH_DB_dbi open_properties(KTH_DB_txn* db_txn) {
+    KTH_DB_dbi dbi;
+    REQUIRE(kth_db_dbi_open(db_txn, "properties", KTH_DB_INTEGERKEY, &dbi) == KTH_DB_SUCCESS);
+    return dbi;
+}
+
+// The blocks are read back from the tables rebuilt by the upgrade.
+template <typename DB>
+void check_upgraded(DB const& db, domain::chain::block const& orig, domain::chain::block const& spender) {
+    auto const& coinbase = orig.transactions()[0];
+    auto const& spend = spender.transactions()[1];
+
+    REQUIRE( ! db.get_utxo(output_point{coinbase.hash(), 0}).is_valid());
+    auto const entry = db.get_utxo(output_point{spend.hash(), 0});
+    REQUIRE(entry.is_valid());
+    REQUIRE(entry.height() == 1);
+    REQUIRE(entry.output() == spend.outputs()[0]);
+
+    REQUIRE(db.get_block(0).hash() == orig.hash());
+    auto const block = db.get_block(1);
+    REQUIRE(block.transactions().size() == spender.transactions().size());
+    REQUIRE(block.transactions()[1].hash() == spend.hash());
+
+    auto const history = db.get_history(coinbase.outputs()[0].addresses().front().hash20(), max_uint32, 0);
+    REQUIRE(history.size() == 2);
+    REQUIRE(history.front().height == 0);
+    REQUIRE(history.back().height == 1);
+    REQUIRE(history.back().kind == domain::chain::point_kind::spend);
+}
+
+TEST_CASE("internal database  upgrade from version 0", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+    }
+
+    // The version 0 layout: no db_version property, legacy UTXO and history
+    // values. block_db and transaction_hash_db are rebuilt from transaction_db,
+    // their content is not read, transaction_hash_db had no flags.
+    {
+        auto const dbs = open_dbs();
+        auto env_ = std::get<0>(dbs);
+        auto dbi_transaction_hash_db_ = std::get<11>(dbs);
+
+        KTH_DB_txn* db_txn;
+        REQUIRE(kth_db_txn_begin(env_, NULL, 0, &db_txn) == KTH_DB_SUCCESS);
+        write_legacy_utxos(db_txn, std::get<1>(dbs));
+        write_legacy_utxos(db_txn, std::get<2>(dbs));
+        write_legacy_history(db_txn, std::get<9>(dbs));
+
+        REQUIRE(kth_db_drop(db_txn, dbi_transaction_hash_db_, 1) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_dbi_open(db_txn, "transactions_hash", KTH_DB_CREATE, &dbi_transaction_hash_db_) == KTH_DB_SUCCESS);
+
+        auto const dbi_properties = open_properties(db_txn);
+        property_code version_code = property_code::db_version;
+        auto key = kth_db_make_value(sizeof(version_code), &version_code);
+        REQUIRE(kth_db_del(db_txn, dbi_properties, &key, NULL) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
+        kth_db_env_close(env_);
+    }
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    check_upgraded(db, orig, spender);
+    for (auto const& tx : spender.transactions()) {
+        REQUIRE(db.get_transaction(tx.hash(), max_uint32).height() == 1);
+    }
+    REQUIRE(db.get_transaction(orig.transactions()[0].hash(), max_uint32).position() == 0);
+
+    // Upgraded once.
+    REQUIRE(db.close());
+    REQUIRE(db.open());
+    check_upgraded(db, orig, spender);
+}
+
+TEST_CASE("internal database  upgrade resumed", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+    }
+
+    // Stopped while rebuilding transaction_hash_db (version 5 to 6), after the
+    // transaction committing tx id 0 and its progress.
+    auto const& coinbase = spender.transactions()[0];
+    auto const& spend = spender.transactions()[1];
+    {
+        auto const dbs = open_dbs();
+        auto env_ = std::get<0>(dbs);
+        auto dbi_transaction_hash_db_ = std::get<11>(dbs);
+
+        KTH_DB_txn* db_txn;
+        REQUIRE(kth_db_txn_begin(env_, NULL, 0, &db_txn) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_drop(db_txn, dbi_transaction_hash_db_, 0) == KTH_DB_SUCCESS);
+        auto const& hash = orig.transactions()[0].hash();
+        auto prefix = tx_hash_prefix(hash);
+        auto key = kth_db_make_value(sizeof(prefix), &prefix);
+        auto hash_value = tx_hash_value::to_value(hash, 0);
+        auto value = kth_db_make_value(hash_value.size(), hash_value.data());
+        REQUIRE(kth_db_put(db_txn, dbi_transaction_hash_db_, &key, &value, 0) == KTH_DB_SUCCESS);
+
+        auto const dbi_properties = open_properties(db_txn);
+        property_code version_code = property_code::db_version;
+        uint32_t version = 5;
+        auto version_key = kth_db_make_value(sizeof(version_code), &version_code);
+        auto version_value = kth_db_make_value(sizeof(version), &version);
+        REQUIRE(kth_db_put(db_txn, dbi_properties, &version_key, &version_value, 0) == KTH_DB_SUCCESS);
+
+        property_code progress_code = property_code::db_upgrade_progress;
+        uint8_t progress[1 + sizeof(tx_id_t)] = {6};
+        tx_id_t next_id = 1;
+        std::memcpy(progress + 1, &next_id, sizeof(next_id));
+        auto progress_key = kth_db_make_value(sizeof(progress_code), &progress_code);
+        auto progress_value = kth_db_make_value(sizeof(progress), progress);
+        REQUIRE(kth_db_put(db_txn, dbi_properties, &progress_key, &progress_value, 0) == KTH_DB_SUCCESS);
+        REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
+        kth_db_env_close(env_);
+    }
+
+    // The table is not created again, the rebuild continues at tx id 1.
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    check_upgraded(db, orig, spender);
+    REQUIRE(db.get_transaction(orig.transactions()[0].hash(), max_uint32).is_valid());
+    REQUIRE(db.get_transaction(coinbase.hash(), max_uint32).position() == 0);
+    REQUIRE(db.get_transaction(spend.hash(), max_uint32).position() == 1);
+
+    REQUIRE(db.close());
+    REQUIRE(db.open());
+    REQUIRE(db.get_transaction(spend.hash(), max_uint32).is_valid());
+}
+
+TEST_CASE("internal database  counters survive reopen", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+    }
+
+    // The transaction ids continue after the stored counter, a restarted
+    // counter would collide with the ids of the first block.
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+
+    auto const block = db.get_block(1);
+    REQUIRE(block.transactions().size() == spender.transactions().size());
+    REQUIRE(db.get_block(0).transactions().size() == orig.transactions().size());
+
+    // Removed rows are given back, the block is pushed again with the same ids.
+    domain::chain::block popped;
+    REQUIRE(db.pop_block(popped) == result_code::success);
+    REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+    REQUIRE(db.get_transaction(spender.transactions()[1].hash(), max_uint32).position() == 1);
+}
+
+TEST_CASE("internal database  prepared history ids", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+
+    // The previous output is not populated, the spend row is numbered in the transaction.
+    auto const prepared = db.prepare_block(spender, 1, 1);
+    auto const& coinbase = prepared.transactions[0].outputs[0].history;
+    auto const& output = prepared.transactions[1].outputs[0].history;
+    REQUIRE(coinbase.id == 0);
+    REQUIRE(output.id == coinbase.keys.size());
+    REQUIRE(prepared.history_rows == coinbase.keys.size() + output.keys.size());
+    REQUIRE( ! prepared.transactions[1].inputs[0].history_resolved);
+
+    REQUIRE(db.push_block(prepared) == result_code::success);
+
+    auto const address = orig.transactions()[0].outputs()[0].addresses().front();
+    auto const history = db.get_history(address.hash20(), max_uint32, 0);
+    REQUIRE(history.size() == 2);
+    REQUIRE(history.back().kind == domain::chain::point_kind::spend);
+}
+
+TEST_CASE("internal database  history row layout", "[None]") {
+    hash_digest txid;
+    REQUIRE(decode_hash(txid, "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+    domain::chain::point const point{txid, 7};
+
+    auto const data = history_entry::factory_to_data(256, point, domain::chain::point_kind::spend, 1000, 7, 5000000000);
+    REQUIRE(data.size() == sizeof(history_row));
+
+    auto const& row = *reinterpret_cast<history_row const*>(data.data());
+    REQUIRE(row.id() == 256);
+    REQUIRE(row.height() == 1000);
+    REQUIRE(row.point() == point);
+    REQUIRE(row.point_kind() == domain::chain::point_kind::spend);
+    REQUIRE(row.index() == 7);
+    REQUIRE(row.value_or_checksum() == 5000000000);
+
+    // Byte order is (height, id) order.
+    auto const before = history_row::make(255, point, domain::chain::point_kind::output, 1000, 7, 1);
+    auto const after = history_row::make(256, point, domain::chain::point_kind::output, 1000, 7, 1);
+    auto const next_block = history_row::make(1, point, domain::chain::point_kind::output, 1001, 7, 1);
+    REQUIRE(std::memcmp(before.data(), after.data(), sizeof(history_row)) < 0);
+    REQUIRE(std::memcmp(after.data(), next_block.data(), sizeof(history_row)) < 0);
+}
+
+TEST_CASE("internal database  history pages", "[None]") {
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+    }
+
+    // Enough rows for several pages, two rows per height.
+    short_hash key {};
+    key[0] = 0x01;
+    seed_history(key, 1000);
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+
+    REQUIRE(db.get_history(key, max_uint32, 0).size() == 1000);
+
+    auto const from = db.get_history(key, max_uint32, 300);
+    REQUIRE(from.size() == 400);
+    REQUIRE(from.front().height == 300);
+    REQUIRE(from.front().value == 600);
+    REQUIRE(from.back().value == 999);
+
+    auto const limited = db.get_history(key, 10, 300);
+    REQUIRE(limited.size() == 10);
+    REQUIRE(limited.front().value == 600);
+    REQUIRE(limited.back().value == 609);
+
+    REQUIRE(db.get_history(key, max_uint32, 500).empty());
+    REQUIRE(db.get_history_txns(key, 5, 499).size() == 2);
+    REQUIRE(db.get_history_txns(key, 5, 0).size() == 5);
+}
+
+TEST_CASE("internal database  history pagination", "[None]") {
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+    }
+
+    short_hash key {};
+    key[0] = 0x02;
+    seed_history(key, 1000);
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+
+    // Newest first, across pages.
+    data_chunk token;
+    auto const newest = db.get_history_page(key, max_uint32, 0, true, {}, token);
+    REQUIRE(newest.size() == 1000);
+    REQUIRE(newest.front().value == 999);
+    REQUIRE(newest.back().value == 0);
+    REQUIRE(token.empty());
+
+    // Newest first, a page at a time.
+    uint64_t expected = 999;
+    data_chunk next;
+    size_t pages = 0;
+    do {
+        auto const page = db.get_history_page(key, 300, 100, true, token, next);
+        for (auto const& entry : page) {
+            REQUIRE(entry.value == expected--);
+        }
+        token = next;
+        ++pages;
+    } while ( ! token.empty());
+    REQUIRE(pages == 3);
+    REQUIRE(expected == 199);
+
+    // Oldest first, a page at a time.
+    expected = 200;
+    pages = 0;
+    do {
+        auto const page = db.get_history_page(key, 250, 100, false, token, next);
+        for (auto const& entry : page) {
+            REQUIRE(entry.value == expected++);
+        }
+        token = next;
+        ++pages;
+    } while ( ! token.empty());
+    REQUIRE(pages == 4);
+    REQUIRE(expected == 1000);
+
+    // Pages ending on the last row have no next page.
+    auto const last = db.get_history_page(key, 10, 495, false, {}, token);
+    REQUIRE(last.size() == 10);
+    REQUIRE(last.back().value == 999);
+    REQUIRE(token.empty());
+
+    auto const first = db.get_history_page(key, 10, 495, true, {}, token);
+    REQUIRE(first.size() == 10);
+    REQUIRE(first.back().value == 990);
+    REQUIRE(token.empty());
+
+    // One row more, one more page.
+    REQUIRE(db.get_history_page(key, 10, 494, false, {}, token).size() == 10);
+    REQUIRE( ! token.empty());
+    auto const rest = db.get_history_page(key, 10, 494, false, token, next);
+    REQUIRE(rest.size() == 2);
+    REQUIRE(rest.back().value == 999);
+    REQUIRE(next.empty());
+
+    REQUIRE(db.get_history_page(key, 10, 0, false, data_chunk(3), next).empty());
+}
+
+TEST_CASE("internal database  pop removes the history of its height", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    auto const address = orig.transactions()[0].outputs()[0].addresses().front().hash20();
+    auto const receiver = spender.transactions()[1].outputs()[0].addresses().front().hash20();
+    {
+        internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE(db.open());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+    }
+
+    // More rows of the address at the popped height and around it.
+    {
+        auto const dbs = open_dbs();
+        auto env_ = std::get<0>(dbs);
+        auto dbi_history_db_ = std::get<9>(dbs);
+
+        KTH_DB_txn* db_txn;
+        REQUIRE(kth_db_txn_begin(env_, NULL, 0, &db_txn) == KTH_DB_SUCCESS);
+        for (auto const [id, height] : {std::pair{1000, 0}, std::pair{1000, 1}, std::pair{1001, 1}, std::pair{0, 2}}) {
+            hash_digest txid {};
+            txid[0] = uint8_t(id);
+            txid[1] = uint8_t(height);
+            auto row = history_row::make(id, point{txid, 0}, point_kind::output, height, 0, 1);
+            auto k = kth_db_make_value(address.size(), const_cast<short_hash&>(address).data());
+            auto v = kth_db_make_value(sizeof(row), &row);
+            REQUIRE(kth_db_put(db_txn, dbi_history_db_, &k, &v, 0) == KTH_DB_SUCCESS);
+        }
+        REQUIRE(kth_db_txn_commit(db_txn) == KTH_DB_SUCCESS);
+        kth_db_env_close(env_);
+    }
+
+    internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+
+    auto heights = [&](short_hash const& key) {
+        std::vector<size_t> res;
+        for (auto const& entry : db.get_history(key, max_uint32, 0)) {
+            res.push_back(entry.height);
+        }
+        return res;
+    };
+    REQUIRE(heights(address) == std::vector<size_t>{0, 0, 1, 1, 1, 2});
+    REQUIRE(heights(receiver) == std::vector<size_t>{1});
+
+    domain::chain::block popped;
+    REQUIRE(db.pop_block(popped) == result_code::success);
+    REQUIRE(heights(address) == std::vector<size_t>{0, 0, 2});
+    REQUIRE(heights(receiver).empty());
+}
+
+TEST_CASE("internal database  optional indexes", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    auto const path = fs::path(DIRECTORY) / "internal_db_indexes";
+
+    std::error_code ec;
+    remove_all(path, ec);
+    {
+        internal_database db(path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_spend);
+        REQUIRE(db.create());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+
+        auto const& coinbase = orig.transactions()[0];
+        REQUIRE(db.get_spend(output_point{coinbase.hash(), 0}).is_valid());
+        REQUIRE(db.get_history(coinbase.outputs()[0].addresses().front().hash20(), max_uint32, 0).empty());
+        REQUIRE( ! db.get_transaction(coinbase.hash(), max_uint32).is_valid());
+
+        // Transactions are found by id, without transaction_hash_db.
+        domain::chain::block popped;
+        REQUIRE(db.pop_block(popped) == result_code::success);
+        REQUIRE( ! db.get_spend(output_point{coinbase.hash(), 0}).is_valid());
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+    }
+
+    // The indexes of a DB can not be changed.
+    {
+        internal_database db(path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE( ! db.open());
+    }
+
+    internal_database db(path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_spend);
+    REQUIRE(db.open());
+}
+
+TEST_CASE("internal database  standard history", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    auto const path = fs::path(DIRECTORY) / "internal_db_standard_history";
+
+    std::error_code ec;
+    remove_all(path, ec);
+    {
+        internal_database db(path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_all | db_index_history_standard);
+        REQUIRE(db.create());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+
+        // P2PK outputs (and their spends) have no history rows, P2PKH ones do.
+        auto const p2pk = orig.transactions()[0].outputs()[0].addresses().front().hash20();
+        auto const p2pkh = spender.transactions()[1].outputs()[0].addresses().front().hash20();
+        REQUIRE(db.get_history(p2pk, max_uint32, 0).empty());
+        REQUIRE(db.get_history(p2pkh, max_uint32, 0).size() == 1);
+
+        domain::chain::block popped;
+        REQUIRE(db.pop_block(popped) == result_code::success);
+        REQUIRE(db.get_history(p2pkh, max_uint32, 0).empty());
+    }
+
+    // The history of every output can not be enabled on the DB.
+    {
+        internal_database db(path, db_mode_type::full, 10000000, db_size, true);
+        REQUIRE( ! db.open());
+    }
+
+    internal_database db(path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_all | db_index_history_standard);
+    REQUIRE(db.open());
+}
+
+TEST_CASE("internal database  background indexes", "[None]") {
+    auto const orig = get_block("01000000a594fda9d85f69e762e498650d6fdb54d838657cea7841915203170000000000a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f505da904ce6ed5b1b017fe8070101000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b015cffffffff0100f2052a01000000434104283338ffd784c198147f99aed2cc16709c90b1522e3b3637b312a6f9130e0eda7081e373a96d36be319710cd5c134aaffba81ff08650d7de8af332fe4d8cde20ac00000000");
+    auto const spender = get_block("01000000ba8b9cda965dd8e536670f9ddec10e53aab14b20bacad27b9137190000000000190760b278fe7b8565fda3b968b918d5fd997f993b23674c0af3b6fde300b38f33a5914ce6ed5b1b01e32f570201000000010000000000000000000000000000000000000000000000000000000000000000ffffffff0704e6ed5b1b014effffffff0100f2052a01000000434104b68a50eaa0287eff855189f949c1c6e5f58b37c88231373d8a59809cbae83059cc6469d65c665ccfd1cfeb75c6e8e19413bba7fbff9bc762419a76d87b16086eac000000000100000001a6b97044d03da79c005b20ea9c0e1a6d9dc12d9f7b91a5911c9030a439eed8f5000000004948304502206e21798a42fae0e854281abd38bacd1aeed3ee3738d9e1446618c4571d1090db022100e2ac980643b0b82c0e88ffdfec6b64e3e6ba35e7ba5fdd7d5d6cc8d25c6b241501ffffffff0100f2052a010000001976a914404371705fa9bd789a2fcd52d2c580b65d35549d88ac00000000");
+    auto const path = fs::path(DIRECTORY) / "internal_db_background";
+
+    std::error_code ec;
+    remove_all(path, ec);
+    {
+        internal_database db(path, db_mode_type::full, 10000000, db_size, true, 0, 0, 0, 0, 0, db_index_all | db_index_deferred);
+        REQUIRE(db.create());
+        REQUIRE(db.push_block(orig, 0, 1) == result_code::success);
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+
+        auto const& coinbase = orig.transactions()[0];
+        auto const key = coinbase.outputs()[0].addresses().front().hash20();
+        output_point const point {coinbase.hash(), 0};
+
+        uint32_t indexed_height;
+        REQUIRE(db.get_indexed_height(indexed_height) == result_code::success);
+        REQUIRE(indexed_height == 0);
+        REQUIRE( ! db.is_index_complete());
+        REQUIRE(db.get_history(key, max_uint32, 0).empty());
+        REQUIRE( ! db.get_spend(point).is_valid());
+
+        uint32_t indexed;
+        REQUIRE(db.index_blocks(1, indexed) == result_code::success);
+        REQUIRE(indexed == 1);
+        REQUIRE(db.get_history(key, max_uint32, 0).size() == 1);
+
+        REQUIRE(db.index_blocks(10, indexed) == result_code::success);
+        REQUIRE(indexed == 1);
+        REQUIRE(db.is_index_complete());
+        REQUIRE(db.get_history(key, max_uint32, 0).size() == 2);
+        REQUIRE(db.get_spend(point).is_valid());
+
+        // The rows of a popped block are removed, it is indexed again once pushed.
+        domain::chain::block popped;
+        REQUIRE(db.pop_block(popped) == result_code::success);
+        REQUIRE(db.get_indexed_height(indexed_height) == result_code::success);
+        REQUIRE(indexed_height == 1);
+        REQUIRE(db.get_history(key, max_uint32, 0).size() == 1);
+        REQUIRE( ! db.get_spend(point).is_valid());
+
+        REQUIRE(db.push_block(spender, 1, 1) == result_code::success);
+        REQUIRE( ! db.is_index_complete());
+        REQUIRE(db.index_blocks(10, indexed) == result_code::success);
+        REQUIRE(indexed == 1);
+        REQUIRE(db.get_history(key, max_uint32, 0).size() == 2);
+        REQUIRE(db.get_spend(point).is_valid());
+    }
+
+    // Building the indexes in the background is not a property of the DB.
+    internal_database db(path, db_mode_type::full, 10000000, db_size, true);
+    REQUIRE(db.open());
+    REQUIRE(db.is_index_complete());
+}
 
 TEST_CASE("internal database  test get all transaction unconfirmed", "[None]") {
     internal_database db(db_path, db_mode_type::full, 10000000, db_size, true);